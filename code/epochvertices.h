@@ -0,0 +1,292 @@
+// Copyright(c) Facebook, Inc. and its affiliates.
+// All rights reserved.
+//
+// This source code is licensed under the BSD - style license found in the
+// LICENSE file in the root directory of this source tree.
+
+#pragma once
+
+///////////////////////////////////////////////////////
+// Rendering and deforming at the same time
+//
+// Deforming the vertices in place makes the renderer wait for the solver,
+// or copy the whole mesh every frame. EpochVertexStore keeps the vertices
+// in pages, and a deformation writes new copies of the pages it reaches,
+// and then publishes a new version of the mesh, with a new epoch, that
+// uses them. The pages it didn't reach are shared with the last version.
+//
+// Readers (the renderer, an exporter, picking) pin the version that is
+// current, and read it for as long as they need; it doesn't change, and
+// it isn't freed, until they unpin it. Neither pinning nor deforming
+// takes a lock. The versions and pages that were replaced are freed once
+// no reader pins an epoch that can still see them.
+//
+// There can be any number of readers, up to EPOCHVERTICES_MAX_READERS at
+// once, but only one thread can deform.
+//
+// Uses threadpool.h, and MeshSolver and meshBounds() from meshdeformer.h.
+///////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <vector>
+
+// The number of vertices in a page
+#define EPOCHVERTICES_PAGE_VERTICES 1024
+
+// The number of readers that can be added at once
+#define EPOCHVERTICES_MAX_READERS 16
+
+struct EpochVertexStoreStats
+{
+    unsigned long long epoch;              // the epoch of the current version
+    unsigned int       pages;              // the pages of the current version
+    unsigned int       lastDeformedPages;  // the pages the last deformation copied
+    unsigned int       retiredVersions;    // the versions that are replaced but not freed yet
+    unsigned int       retiredPages;       // the pages that are replaced but not freed yet
+    size_t             retiredBytes;
+};
+
+class EpochVertexStore
+{
+public:
+    struct Page
+    {
+        std::vector<vec3> vertices;
+        vec3              center;
+        float             radius;   // all the vertices are within radius of center
+    };
+
+    // A version of the mesh. It doesn't change once it is published.
+    struct Version
+    {
+        unsigned long long epoch;
+        unsigned int       vertexCount;
+        std::vector<Page*> pages;
+
+        vec3 position(unsigned int i) const
+        {
+            return pages[i / EPOCHVERTICES_PAGE_VERTICES]->vertices[i % EPOCHVERTICES_PAGE_VERTICES];
+        }
+
+        // Copies all the positions
+        void read(vec3* out) const
+        {
+            for (const Page* page : pages)
+            {
+                std::copy(page->vertices.begin(), page->vertices.end(), out);
+                out += page->vertices.size();
+            }
+        }
+    };
+
+    EpochVertexStore(const vec3* positions, unsigned int vertexCount)
+    {
+        Version* version = new Version();
+        version->epoch = 1;
+        version->vertexCount = vertexCount;
+        unsigned int pageCount = (vertexCount + EPOCHVERTICES_PAGE_VERTICES - 1) / EPOCHVERTICES_PAGE_VERTICES;
+        for (unsigned int p = 0; p < pageCount; p++)
+        {
+            unsigned int first = p * EPOCHVERTICES_PAGE_VERTICES;
+            unsigned int last = min((int)(first + EPOCHVERTICES_PAGE_VERTICES), (int)vertexCount);
+            Page* page = new Page();
+            page->vertices.assign(positions + first, positions + last);
+            updateBounds(*page);
+            version->pages.push_back(page);
+        }
+        current = version;
+
+        for (unsigned int r = 0; r < EPOCHVERTICES_MAX_READERS; r++)
+        {
+            readers[r] = false;
+            pins[r] = 0;
+        }
+    }
+
+    // All the readers must be removed
+    ~EpochVertexStore()
+    {
+        Version* version = current.load();
+        for (Page* page : version->pages)
+        {
+            delete page;
+        }
+        delete version;
+        for (const Retired& r : retired)
+        {
+            delete r.version;
+            delete r.page;
+        }
+    }
+
+    EpochVertexStore(const EpochVertexStore&) = delete;
+    EpochVertexStore& operator=(const EpochVertexStore&) = delete;
+
+    // Returns a reader for pin() and unpin(), for the use of a single thread, or ~0u if there are
+    // EPOCHVERTICES_MAX_READERS already. Can be called from any thread.
+    unsigned int addReader()
+    {
+        for (unsigned int r = 0; r < EPOCHVERTICES_MAX_READERS; r++)
+        {
+            bool used = false;
+            if (readers[r].compare_exchange_strong(used, true))
+            {
+                return r;
+            }
+        }
+        return ~0u;
+    }
+
+    // The reader must be unpinned
+    void removeReader(unsigned int reader)
+    {
+        readers[reader] = false;
+    }
+
+    // Returns the current version. It stays valid, and doesn't change, until the reader unpins it.
+    const Version& pin(unsigned int reader)
+    {
+        for (;;)
+        {
+            // once the pin is visible, the deformation can't free what this epoch can see. If the
+            // epoch moved on before that, pin again.
+            unsigned long long e = epoch.load();
+            pins[reader].store(e);
+            if (epoch.load() == e)
+            {
+                return *current.load();
+            }
+        }
+    }
+
+    void unpin(unsigned int reader)
+    {
+        pins[reader].store(0);
+    }
+
+    // Deforms the vertices, and publishes the new version. Pages that are farther than radius from
+    // center skip the deformation, so the solver must not move their vertices; a negative radius
+    // reaches every page (like Kelvinlets). Returns the number of pages that were deformed.
+    // Only one thread can deform.
+    unsigned int deform(ThreadPool& pool, const MeshSolver& solver, vec3 center = vec3(0, 0, 0), float radius = -1.0f)
+    {
+        const Version* last = current.load();
+        Version* version = new Version(*last);
+        version->epoch = last->epoch + 1;
+        touched.clear();
+        for (unsigned int p = 0; p < last->pages.size(); p++)
+        {
+            const Page& page = *last->pages[p];
+            if (radius < 0.0f || length(page.center - center) <= page.radius + radius)
+            {
+                touched.push_back(p);
+            }
+        }
+
+        // the new pages are written from the pages of the last version, which readers can be reading
+        pool.parallelFor(0, (unsigned int)touched.size(), [&](unsigned int t)
+        {
+            const Page& from = *last->pages[touched[t]];
+            Page* page = new Page();
+            page->vertices.resize(from.vertices.size());
+            for (unsigned int i = 0; i < from.vertices.size(); i++)
+            {
+                page->vertices[i] = solver(from.vertices[i]);
+            }
+            updateBounds(*page);
+            version->pages[touched[t]] = page;
+        });
+
+        publish(version);
+        lastDeformed = (unsigned int)touched.size();
+        return lastDeformed;
+    }
+
+    // The current version, for the thread that deforms. Other threads must pin().
+    const Version& currentVersion() const { return *current.load(); }
+
+    // Frees the versions and pages that no reader can see anymore. deform() does it too.
+    void reclaim()
+    {
+        unsigned long long oldest = epoch.load();
+        for (unsigned int r = 0; r < EPOCHVERTICES_MAX_READERS; r++)
+        {
+            unsigned long long pinned = pins[r].load();
+            if (pinned != 0 && pinned < oldest)
+            {
+                oldest = pinned;
+            }
+        }
+
+        // what was replaced at epoch e can only be seen by readers pinned at e or before
+        unsigned int kept = 0;
+        for (unsigned int k = 0; k < retired.size(); k++)
+        {
+            if (retired[k].epoch < oldest)
+            {
+                delete retired[k].version;
+                delete retired[k].page;
+            }
+            else
+            {
+                retired[kept++] = retired[k];
+            }
+        }
+        retired.resize(kept);
+    }
+
+    EpochVertexStoreStats stats() const
+    {
+        EpochVertexStoreStats stats = {};
+        const Version& version = *current.load();
+        stats.epoch = version.epoch;
+        stats.pages = (unsigned int)version.pages.size();
+        stats.lastDeformedPages = lastDeformed;
+        for (const Retired& r : retired)
+        {
+            stats.retiredVersions += r.version ? 1 : 0;
+            stats.retiredPages += r.page ? 1 : 0;
+            stats.retiredBytes += r.version ? r.version->pages.size() * sizeof(Page*) : 0;
+            stats.retiredBytes += r.page ? r.page->vertices.size() * sizeof(vec3) : 0;
+        }
+        return stats;
+    }
+
+private:
+    // A version or a page that was replaced at epoch
+    struct Retired
+    {
+        unsigned long long epoch;
+        Version*           version;
+        Page*              page;
+    };
+
+    void publish(Version* version)
+    {
+        Version* last = current.load();
+        current.store(version);
+        epoch.store(version->epoch);
+
+        retired.push_back({ last->epoch, last, nullptr });
+        for (unsigned int t : touched)
+        {
+            retired.push_back({ last->epoch, nullptr, last->pages[t] });
+        }
+        reclaim();
+    }
+
+    static void updateBounds(Page& page)
+    {
+        meshBounds(page.vertices.data(), 0, (unsigned int)page.vertices.size(), page.center, page.radius);
+    }
+
+    std::atomic<Version*>           current;
+    std::atomic<unsigned long long> epoch{ 1 };
+    std::atomic<bool>               readers[EPOCHVERTICES_MAX_READERS];
+    std::atomic<unsigned long long> pins[EPOCHVERTICES_MAX_READERS];  // the epoch of every reader, or 0
+    std::vector<Retired>            retired;       // in order of epoch
+    std::vector<unsigned int>       touched;
+    unsigned int                    lastDeformed = 0;
+};
@@ -0,0 +1,285 @@
+// Copyright(c) Facebook, Inc. and its affiliates.
+// All rights reserved.
+//
+// This source code is licensed under the BSD - style license found in the
+// LICENSE file in the root directory of this source tree.
+
+#pragma once
+
+///////////////////////////////////////////////////////
+// Deforming dense meshes through a cached flow map
+//
+// The deformation of a stroke is smooth at the scale of the brush
+// radius, but the examples in test.cpp integrate every vertex, and a
+// dense mesh has many vertices per radius. A FlowMap integrates the
+// stroke only at the nodes of a sparse grid, and moves every vertex by
+// the tricubic (Catmull-Rom) interpolation of the displacements of the
+// 4x4x4 nodes around it.
+//
+// The nodes are only integrated where a vertex needs them, and they are
+// kept, so deforming another mesh with the same stroke only integrates
+// the nodes that the first meshes didn't need.
+//
+// flowMapSpacing() picks the spacing of the nodes from the radius of the
+// brush and a tolerance. The interpolation reproduces quadratic fields,
+// so its error falls off with the cube of the spacing, relative to how
+// far the stroke moves the points. The grid pays off on dense meshes,
+// and when many meshes share a stroke; when it doesn't, the vertices
+// are integrated directly.
+//
+// Uses deformMesh() and gridKey() from meshdeformer.h, and KelvinletSpeedBound() from
+// strokereplay.h, so include those (and threadpool.h) first.
+///////////////////////////////////////////////////////
+
+#include <unordered_map>
+#include <vector>
+
+// The spacing of the nodes, as a fraction of the radius, when the stroke moves points by the tolerance
+#define FLOWMAP_MAX_SPACING 0.5f
+
+// The smallest spacing of the nodes, as a fraction of the radius
+#define FLOWMAP_MIN_SPACING (1.0f / 64.0f)
+
+// The fraction of the tolerance that the vertices outside the bounds of a Kelvinlet stroke may move by
+#define FLOWMAP_CUTOFF_FRACTION 0.25f
+
+struct FlowMapStats
+{
+    unsigned int vertices;
+    unsigned int interpolatedVertices;
+    unsigned int directVertices;   // the vertices that called the solver, because the grid wasn't worth it
+    unsigned int integratedNodes;  // the nodes that weren't in the cache yet
+};
+
+// The spacing of the nodes, so that the interpolation of a stroke that moves points by up to
+// displacement is within about tolerance. A stroke of many frames that uses a FlowMap for every
+// frame adds up their errors, so use a fraction of maxerror.
+INLINE float flowMapSpacing(float radius, float tolerance, float displacement)
+{
+    float scale = displacement > tolerance ? pow(tolerance / displacement, 1.0f / 3.0f) : 1.0f;
+    return radius * max(FLOWMAP_MAX_SPACING * scale, FLOWMAP_MIN_SPACING);
+}
+
+// Bounds the points that a stroke of Kelvinlets moves by more than FLOWMAP_CUTOFF_FRACTION of
+// tolerance, with KelvinletSpeedBound()
+INLINE void flowMapKelvinletBounds(const Kelvinlet* kelvinlets, unsigned int count, float tolerance, vec3& lo, vec3& hi)
+{
+    if (count == 0)
+    {
+        lo = hi = vec3(0, 0, 0);
+        return;
+    }
+
+    lo = hi = kelvinlets[0].origin;
+    float outer = 0.0f;
+    for (unsigned int frame = 0; frame < count; frame++)
+    {
+        const Kelvinlet& kelvinlet = kelvinlets[frame];
+        vec3 end = kelvinlet.origin + kelvinlet.linearVelocity * kelvinlet.dt;
+        lo = vec3(min(lo.x, min(kelvinlet.origin.x, end.x)), min(lo.y, min(kelvinlet.origin.y, end.y)), min(lo.z, min(kelvinlet.origin.z, end.z)));
+        hi = vec3(max(hi.x, max(kelvinlet.origin.x, end.x)), max(hi.y, max(kelvinlet.origin.y, end.y)), max(hi.z, max(kelvinlet.origin.z, end.z)));
+        outer = max(outer, kelvinlet.radius);
+    }
+
+    // find the distance from the path of the tool where the stroke moves points by less than the cutoff
+    float cutoff = FLOWMAP_CUTOFF_FRACTION * tolerance;
+    auto moves = [&](float distance)
+    {
+        float d = 0.0f;
+        for (unsigned int frame = 0; frame < count; frame++)
+        {
+            d += KelvinletSpeedBound(kelvinlets[frame], distance) * kelvinlets[frame].dt;
+        }
+        return d;
+    };
+    float inner = 0.0f;
+    while (moves(outer) > cutoff)
+    {
+        inner = outer;
+        outer *= 2;
+    }
+    for (int i = 0; i < 16; i++)
+    {
+        float middle = (inner + outer) * 0.5f;
+        if (moves(middle) > cutoff)
+        {
+            inner = middle;
+        }
+        else
+        {
+            outer = middle;
+        }
+    }
+
+    lo = lo - vec3(outer, outer, outer);
+    hi = hi + vec3(outer, outer, outer);
+}
+
+// Catmull-Rom weights of the 4 nodes around t, for t in [0, 1)
+INLINE void flowMapWeights(float t, float w[4])
+{
+    w[0] = ((-t + 2) * t - 1) * t * 0.5f;
+    w[1] = ((3 * t - 5) * t * t + 2) * 0.5f;
+    w[2] = ((-3 * t + 4) * t + 1) * t * 0.5f;
+    w[3] = (t - 1) * t * t * 0.5f;
+}
+
+class FlowMap
+{
+public:
+    // Vertices outside [lo, hi] are not moved. See flowMapSpacing() and flowMapKelvinletBounds().
+    FlowMap(float spacing, vec3 lo, vec3 hi)
+        : spacing(spacing), lo(lo), hi(hi)
+    {
+    }
+
+    // Moves every vertex inside the bounds by the interpolated displacement of the nodes, and
+    // copies the others. solver(position) returns where the stroke moves position; it is called
+    // for the nodes that aren't in the cache yet. Use the same solver every time.
+    // When the mesh needs more new nodes than it has vertices in the new cells, the grid
+    // would cost more than it saves, so those vertices call solver directly, and the new
+    // nodes aren't kept.
+    // positions and deformed may be the same array.
+    template <typename Solver>
+    FlowMapStats deform(ThreadPool& pool, const vec3* positions, vec3* deformed, unsigned int vertexCount, const Solver& solver)
+    {
+        const unsigned int outside = ~0u;
+        const unsigned int direct = ~0u - 1;
+
+        FlowMapStats stats = { vertexCount, 0, 0, 0 };
+
+        // find the cells of the vertices, and add the nodes around the new cells
+        std::vector<unsigned int> vertexCells(vertexCount);
+        unsigned int firstNode = (unsigned int)nodePositions.size();
+        unsigned int firstCell = (unsigned int)cellKeys.size();
+        unsigned int newCellVertices = 0;
+        for (unsigned int i = 0; i < vertexCount; i++)
+        {
+            vec3 p = positions[i];
+            if (p.x < lo.x || p.y < lo.y || p.z < lo.z || p.x > hi.x || p.y > hi.y || p.z > hi.z)
+            {
+                vertexCells[i] = outside;
+                continue;
+            }
+
+            int cx = (int)floor(p.x / spacing);
+            int cy = (int)floor(p.y / spacing);
+            int cz = (int)floor(p.z / spacing);
+            unsigned long long cellKey = gridKey(cx, cy, cz);
+            auto cell = cells.find(cellKey);
+            if (cell == cells.end())
+            {
+                cell = cells.emplace(cellKey, (unsigned int)cellKeys.size()).first;
+                cellKeys.push_back(cellKey);
+                for (int z = -1; z <= 2; z++)
+                {
+                    for (int y = -1; y <= 2; y++)
+                    {
+                        for (int x = -1; x <= 2; x++)
+                        {
+                            unsigned long long nodeKey = gridKey(cx + x, cy + y, cz + z);
+                            auto node = nodes.find(nodeKey);
+                            if (node == nodes.end())
+                            {
+                                node = nodes.emplace(nodeKey, (unsigned int)nodePositions.size()).first;
+                                nodeKeys.push_back(nodeKey);
+                                nodePositions.push_back(vec3((float)(cx + x), (float)(cy + y), (float)(cz + z)) * spacing);
+                            }
+                            cellNodes.push_back(node->second);
+                        }
+                    }
+                }
+            }
+            vertexCells[i] = cell->second;
+            newCellVertices += cell->second >= firstCell ? 1 : 0;
+        }
+
+        // integrate the new nodes, or give up on them
+        unsigned int newNodes = (unsigned int)nodePositions.size() - firstNode;
+        if (newNodes > newCellVertices)
+        {
+            for (unsigned int i = 0; i < vertexCount; i++)
+            {
+                if (vertexCells[i] != outside && vertexCells[i] >= firstCell)
+                {
+                    vertexCells[i] = direct;
+                }
+            }
+            for (unsigned int c = firstCell; c < cellKeys.size(); c++)
+            {
+                cells.erase(cellKeys[c]);
+            }
+            for (unsigned int n = firstNode; n < nodeKeys.size(); n++)
+            {
+                nodes.erase(nodeKeys[n]);
+            }
+            cellKeys.resize(firstCell);
+            cellNodes.resize(firstCell * 64);
+            nodeKeys.resize(firstNode);
+            nodePositions.resize(firstNode);
+            stats.directVertices = newCellVertices;
+        }
+        else
+        {
+            stats.integratedNodes = newNodes;
+            nodeDisplacements.resize(nodePositions.size());
+            pool.parallelFor(firstNode, (unsigned int)nodePositions.size(), [&](unsigned int n)
+            {
+                nodeDisplacements[n] = solver(nodePositions[n]) - nodePositions[n];
+            });
+        }
+
+        // interpolate the vertices
+        deformMesh(pool, positions, deformed, vertexCount, [&](vec3 p, unsigned int i)
+        {
+            if (vertexCells[i] == outside)
+            {
+                return p;
+            }
+            if (vertexCells[i] == direct)
+            {
+                return solver(p);
+            }
+
+            vec3 g = vec3(p.x / spacing, p.y / spacing, p.z / spacing);
+            float wx[4], wy[4], wz[4];
+            flowMapWeights(g.x - floor(g.x), wx);
+            flowMapWeights(g.y - floor(g.y), wy);
+            flowMapWeights(g.z - floor(g.z), wz);
+
+            const unsigned int* n = &cellNodes[vertexCells[i] * 64];
+            vec3 displacement(0, 0, 0);
+            for (unsigned int z = 0; z < 4; z++)
+            {
+                for (unsigned int y = 0; y < 4; y++)
+                {
+                    vec3 row = nodeDisplacements[n[0]] * wx[0] + nodeDisplacements[n[1]] * wx[1] + nodeDisplacements[n[2]] * wx[2] + nodeDisplacements[n[3]] * wx[3];
+                    displacement = displacement + row * (wy[y] * wz[z]);
+                    n += 4;
+                }
+            }
+            return p + displacement;
+        });
+
+        for (unsigned int i = 0; i < vertexCount; i++)
+        {
+            stats.interpolatedVertices += vertexCells[i] < direct ? 1 : 0;
+        }
+        return stats;
+    }
+
+    // The number of nodes in the cache
+    unsigned int nodeCount() const { return (unsigned int)nodePositions.size(); }
+
+private:
+    float                                                spacing;
+    vec3                                                 lo;
+    vec3                                                 hi;
+    std::unordered_map<unsigned long long, unsigned int> nodes;  // grid coordinates to node index
+    std::unordered_map<unsigned long long, unsigned int> cells;  // grid coordinates to cell index
+    std::vector<unsigned long long>                      nodeKeys;
+    std::vector<unsigned long long>                      cellKeys;
+    std::vector<unsigned int>                            cellNodes;  // the 4x4x4 nodes around every cell
+    std::vector<vec3>                                    nodePositions;
+    std::vector<vec3>                                    nodeDisplacements;
+};
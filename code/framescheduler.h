@@ -0,0 +1,314 @@
+// Copyright(c) Facebook, Inc. and its affiliates.
+// All rights reserved.
+//
+// This source code is licensed under the BSD - style license found in the
+// LICENSE file in the root directory of this source tree.
+
+#pragma once
+
+///////////////////////////////////////////////////////
+// Deforming within a frame budget
+//
+// In VR, a frame that takes too long is dropped, which is much worse
+// than part of the mesh catching up a frame or two late, far from the
+// tool. FrameScheduler splits the vertices into tiles, and every frame,
+// brings the tiles up to date in priority order until the time budget
+// runs out:
+// - first the tiles that are about to fall more than
+//   FRAMESCHEDULER_MAX_LAG frames behind, the most behind first
+// - then the tiles in view before the others
+// - then the tiles nearest the tip of the tool first
+// The other tiles keep the frames they haven't applied yet, and apply
+// them in order in a later frame, so once they catch up, the result is
+// the same as deforming every vertex every frame. A tile that is too far
+// behind to catch up within what is left of the budget applies as many
+// of its frames as fit, and when the tiles about to fall behind can't
+// all catch up, they share the budget. So when every frame is over
+// budget, no tile falls much further behind than the others, instead of
+// the far tiles never catching up. run() reports the backlog, and the tiles
+// that fell too far behind (deadline misses).
+//
+// Include threadpool.h first, and meshdeformer.h for MeshSolver and meshBounds().
+///////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <vector>
+
+// The number of vertices in a tile
+#define FRAMESCHEDULER_TILE_VERTICES 256
+
+// The number of frames a tile can fall behind before it is a deadline miss
+#define FRAMESCHEDULER_MAX_LAG 2
+
+// How quickly the estimate of the cost of a tile follows the measured cost
+#define FRAMESCHEDULER_COST_SMOOTHING 0.25
+
+struct FrameSchedulerStats
+{
+    unsigned int       frame;              // the number of frames submitted
+    unsigned int       processedTiles;     // the tiles that applied frames during this run
+    unsigned int       backlogTiles;       // the tiles that are still behind
+    unsigned long long backlogTileFrames;  // the frames that those tiles haven't applied yet
+    unsigned int       maxLag;             // the number of frames the most out of date tile is behind
+    unsigned int       lateTiles;          // the tiles more than FRAMESCHEDULER_MAX_LAG frames behind
+    bool               overran;            // whether the run took longer than the budget
+    double             seconds;
+};
+
+class FrameScheduler
+{
+public:
+    // visible(center, radius) returns whether a sphere is in view
+    typedef std::function<bool(vec3, float)> Visibility;
+
+    // positions is deformed in place, as the tiles catch up
+    FrameScheduler(vec3* positions, unsigned int vertexCount)
+        : positions(positions)
+    {
+        unsigned int tileCount = (vertexCount + FRAMESCHEDULER_TILE_VERTICES - 1) / FRAMESCHEDULER_TILE_VERTICES;
+        tiles.resize(tileCount);
+        for (unsigned int t = 0; t < tileCount; t++)
+        {
+            tiles[t].first = t * FRAMESCHEDULER_TILE_VERTICES;
+            tiles[t].last = min((int)(tiles[t].first + FRAMESCHEDULER_TILE_VERTICES), (int)vertexCount);
+            tiles[t].next = 0;
+            updateBounds(tiles[t]);
+        }
+    }
+
+    // Adds the next frame. Tiles that are farther than radius from center when they apply the frame
+    // skip it; a negative radius reaches every tile (like Kelvinlets).
+    void submit(const MeshSolver& solver, vec3 center = vec3(0, 0, 0), float radius = -1.0f)
+    {
+        Frame frame = { solver, center, radius };
+        frames.push_back(frame);
+    }
+
+    // Brings tiles up to date in priority order, until budgetSeconds runs out
+    FrameSchedulerStats run(ThreadPool& pool, double budgetSeconds, vec3 tip, const Visibility& visible = nullptr)
+    {
+        auto start = std::chrono::steady_clock::now();
+        unsigned int submitted = firstFrame + (unsigned int)frames.size();
+
+        // sort the tiles that are behind by priority
+        order.clear();
+        priorities.resize(tiles.size());
+        for (unsigned int t = 0; t < tiles.size(); t++)
+        {
+            const Tile& tile = tiles[t];
+            if (tile.next == submitted)
+            {
+                continue;
+            }
+            Priority& priority = priorities[t];
+            priority.lag = submitted - tile.next;
+            priority.urgent = priority.lag >= FRAMESCHEDULER_MAX_LAG;
+            priority.inview = !visible || visible(tile.center, tile.radius);
+            priority.distance = max(length(tile.center - tip) - tile.radius, 0.0f);
+            order.push_back(t);
+        }
+        std::sort(order.begin(), order.end(), [&](unsigned int a, unsigned int b)
+        {
+            const Priority& pa = priorities[a];
+            const Priority& pb = priorities[b];
+            if (pa.urgent != pb.urgent)
+            {
+                return pa.urgent;
+            }
+            if (pa.urgent && pa.lag != pb.lag)
+            {
+                return pa.lag > pb.lag;
+            }
+            if (pa.inview != pb.inview)
+            {
+                return pa.inview;
+            }
+            return pa.distance < pb.distance;
+        });
+
+        // every thread takes the next tile while the budget lasts
+        std::atomic<unsigned int> cursor(0);
+        std::atomic<bool> stop(false);
+        std::atomic<unsigned int> processed(0);
+        std::atomic<unsigned long long> appliedTileFrames(0);
+        std::atomic<unsigned long long> appliedNanoseconds(0);
+        double costPerTileFrame = tileFrameCost;
+        // until a run measures the rate, there is no level: the urgent tiles apply what fits
+        unsigned int level = tileFrameRate > 0.0 ? urgentLevel(budgetSeconds * tileFrameRate) : 0;
+        pool.parallelFor(0, pool.threadCount() + 1, [&](unsigned int)
+        {
+            while (!stop)
+            {
+                unsigned int index = cursor++;
+                if (index >= order.size())
+                {
+                    return;
+                }
+
+                // the frames of the tile that fit in what is left of the budget
+                Tile& tile = tiles[order[index]];
+                double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                unsigned int lag = submitted - tile.next;
+                unsigned int fit = costPerTileFrame > 0.0 ? (unsigned int)std::min(std::max((budgetSeconds - elapsed) / costPerTileFrame, 0.0), (double)lag) : lag;
+                if (fit == 0)
+                {
+                    stop = true;
+                    return;
+                }
+                // an urgent tile only catches up to the level, to leave the budget to the others
+                if (priorities[order[index]].urgent)
+                {
+                    if (lag <= level)
+                    {
+                        continue;
+                    }
+                    fit = min((int)fit, (int)(lag - level));
+                }
+
+                auto tileStart = std::chrono::steady_clock::now();
+                appliedTileFrames += fit;
+                catchUp(tile, tile.next + fit);
+                appliedNanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - tileStart).count();
+                processed++;
+            }
+        });
+
+        if (appliedTileFrames > 0)
+        {
+            double measured = appliedNanoseconds * 1e-9 / appliedTileFrames;
+            tileFrameCost = tileFrameCost > 0.0 ? tileFrameCost + (measured - tileFrameCost) * FRAMESCHEDULER_COST_SMOOTHING : measured;
+            double rate = appliedTileFrames / std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            tileFrameRate = tileFrameRate > 0.0 ? tileFrameRate + (rate - tileFrameRate) * FRAMESCHEDULER_COST_SMOOTHING : rate;
+        }
+        dropAppliedFrames();
+
+        FrameSchedulerStats stats = backlog();
+        stats.processedTiles = processed;
+        stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        stats.overran = stats.seconds > budgetSeconds;
+        return stats;
+    }
+
+    // Brings every tile up to date, whatever it takes
+    void finish(ThreadPool& pool)
+    {
+        unsigned int submitted = firstFrame + (unsigned int)frames.size();
+        pool.parallelFor(0, (unsigned int)tiles.size(), [&](unsigned int t)
+        {
+            catchUp(tiles[t], submitted);
+        });
+        dropAppliedFrames();
+    }
+
+private:
+    struct Frame
+    {
+        MeshSolver solver;
+        vec3   center;
+        float  radius;
+    };
+
+    struct Priority
+    {
+        unsigned int lag;       // the frames the tile hasn't applied yet
+        bool         urgent;
+        bool         inview;
+        float        distance;
+    };
+
+    struct Tile
+    {
+        unsigned int first;
+        unsigned int last;
+        unsigned int next;    // the next frame to apply
+        vec3         center;  // the bounds of the vertices
+        float        radius;
+    };
+
+    void updateBounds(Tile& tile)
+    {
+        meshBounds(positions, tile.first, tile.last, tile.center, tile.radius);
+    }
+
+    // The lag the urgent tiles catch up to, when there isn't the time for all of them to catch up:
+    // the tiles most behind catch up to the same lag, as far as tileFrames lasts, so that none
+    // falls further behind than the others. 0 when they can all catch up.
+    unsigned int urgentLevel(double tileFrames) const
+    {
+        // the order starts with the urgent tiles, the most behind first. Bringing the first k
+        // down to a level takes the sum of their lags, less k times the level.
+        double above = 0.0;
+        unsigned int k = 0;
+        for (; k < order.size() && priorities[order[k]].urgent; k++)
+        {
+            unsigned int lag = priorities[order[k]].lag;
+            if (k > 0 && above - tileFrames >= (double)lag * k)
+            {
+                break;
+            }
+            above += lag;
+        }
+        return k > 0 && above > tileFrames ? (unsigned int)((above - tileFrames) / k) : 0;
+    }
+
+    // Applies the frames the tile hasn't applied yet, in order, up to frame end
+    void catchUp(Tile& tile, unsigned int end)
+    {
+        for (; tile.next < end; tile.next++)
+        {
+            const Frame& frame = frames[tile.next - firstFrame];
+            if (frame.radius >= 0.0f && length(tile.center - frame.center) > tile.radius + frame.radius)
+            {
+                continue;
+            }
+            for (unsigned int i = tile.first; i < tile.last; i++)
+            {
+                positions[i] = frame.solver(positions[i]);
+            }
+            updateBounds(tile);
+        }
+    }
+
+    // Forgets the frames that every tile has applied
+    void dropAppliedFrames()
+    {
+        unsigned int oldest = firstFrame + (unsigned int)frames.size();
+        for (const Tile& tile : tiles)
+        {
+            oldest = min((int)oldest, (int)tile.next);
+        }
+        while (firstFrame < oldest)
+        {
+            frames.pop_front();
+            firstFrame++;
+        }
+    }
+
+    FrameSchedulerStats backlog() const
+    {
+        FrameSchedulerStats stats = {};
+        stats.frame = firstFrame + (unsigned int)frames.size();
+        for (const Tile& tile : tiles)
+        {
+            unsigned int lag = stats.frame - tile.next;
+            stats.backlogTiles += lag > 0 ? 1 : 0;
+            stats.backlogTileFrames += lag;
+            stats.maxLag = max((int)stats.maxLag, (int)lag);
+            stats.lateTiles += lag > FRAMESCHEDULER_MAX_LAG ? 1 : 0;
+        }
+        return stats;
+    }
+
+    vec3*                     positions;
+    std::vector<Tile>         tiles;
+    std::deque<Frame>         frames;
+    unsigned int              firstFrame = 0;  // the index of frames[0]
+    double                    tileFrameCost = 0.0;  // the estimated seconds to apply a frame to a tile
+    double                    tileFrameRate = 0.0;  // the estimated frames applied to tiles per second of a run, by all the threads
+    std::vector<unsigned int> order;
+    std::vector<Priority>     priorities;
+};
@@ -65,6 +65,10 @@ float distance(vec3 a, vec3 b)
     return length(a - b);
 }
 
+// GLSL's abs() for floats. Without it, abs(float) in the solvers can
+// resolve to the int abs() from <cstdlib>, which truncates the result.
+using std::abs;
+
 float saturate(float t)
 {
     if (t < 0)
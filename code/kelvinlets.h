@@ -331,7 +331,7 @@ KEvaluatePinchTwoDeformers(float t, vec3 x, Kelvinlet kelvinlet0, Kelvinlet kelv
 #define EVALUATE KEvaluate
 #define PARAMETERLIST Kelvinlet kelvinlet
 #define PARAMETERS kelvinlet
-#include "ODESolvers.h"
+#include "odesolvers.h"
 #undef PARAMETERS
 #undef PARAMETERLIST
 #undef EVALUATE
@@ -341,7 +341,7 @@ KEvaluatePinchTwoDeformers(float t, vec3 x, Kelvinlet kelvinlet0, Kelvinlet kelv
 #define EVALUATE KEvaluateTwoDeformers
 #define PARAMETERLIST Kelvinlet kelvinlet0, Kelvinlet kelvinlet1
 #define PARAMETERS kelvinlet0, kelvinlet1
-#include "ODESolvers.h"
+#include "odesolvers.h"
 #undef PARAMETERS
 #undef PARAMETERLIST
 #undef EVALUATE
@@ -0,0 +1,159 @@
+// Copyright(c) Facebook, Inc. and its affiliates.
+// All rights reserved.
+//
+// This source code is licensed under the BSD - style license found in the
+// LICENSE file in the root directory of this source tree.
+
+#pragma once
+
+///////////////////////////////////////////////////////
+// Deforming only the parts of a mesh that are read
+//
+// Several strokes, layers or tools can be queued against a mesh before
+// anything reads it, and then only part of it is read: the visible
+// region, an exported selection, a picking query. LazyMesh records the
+// deformations, and only applies them to a tile of vertices when
+// positions in that tile are read. A tile applies all of its pending
+// deformations in one pass, one vertex at a time, so every vertex is
+// loaded and stored once however many deformations are pending, and a
+// tile that is never read is never deformed.
+//
+// The tiles are ranges of consecutive vertices, which are close to each
+// other in most meshes. A deformation can have a bounding sphere, and
+// vertices outside of it skip that deformation.
+//
+// Include threadpool.h and meshdeformer.h (for MeshSolver) first.
+///////////////////////////////////////////////////////
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <vector>
+
+// The number of vertices in a tile
+#define LAZYMESH_TILE_VERTICES 256
+
+class LazyMesh
+{
+public:
+    LazyMesh(const vec3* positions, unsigned int vertexCount)
+        : vertices(positions, positions + vertexCount), tileNext((vertexCount + LAZYMESH_TILE_VERTICES - 1) / LAZYMESH_TILE_VERTICES, 0)
+    {
+    }
+
+    // Records a deformation. Vertices farther than radius from center skip it, so the solver must
+    // not move them; a negative radius reaches every vertex (like Kelvinlets).
+    void deform(const MeshSolver& solver, vec3 center = vec3(0, 0, 0), float radius = -1.0f)
+    {
+        Deformer deformer = { solver, center, radius };
+        deformers.push_back(deformer);
+    }
+
+    // Returns the position of vertex i, applying the pending deformations of its tile
+    vec3 position(unsigned int i)
+    {
+        evaluateTile(i / LAZYMESH_TILE_VERTICES);
+        return vertices[i];
+    }
+
+    // Applies the pending deformations of the tiles of vertices [first, first + count), and returns
+    // all the positions. Only the positions in that range are up to date.
+    const vec3* positions(ThreadPool& pool, unsigned int first, unsigned int count)
+    {
+        if (count > 0)
+        {
+            unsigned int firstTile = first / LAZYMESH_TILE_VERTICES;
+            unsigned int lastTile = (first + count - 1) / LAZYMESH_TILE_VERTICES;
+            pool.parallelFor(firstTile, lastTile + 1, [&](unsigned int tile)
+            {
+                evaluateTile(tile);
+            });
+            dropAppliedDeformers();
+        }
+        return vertices.data();
+    }
+
+    // Applies every pending deformation, and returns all the positions
+    const vec3* positions(ThreadPool& pool)
+    {
+        return positions(pool, 0, (unsigned int)vertices.size());
+    }
+
+    unsigned int vertexCount() const { return (unsigned int)vertices.size(); }
+    unsigned int tileCount() const { return (unsigned int)tileNext.size(); }
+
+    // The tiles that have deformations pending
+    unsigned int dirtyTiles() const
+    {
+        unsigned int submitted = firstDeformer + (unsigned int)deformers.size();
+        unsigned int dirty = 0;
+        for (unsigned int next : tileNext)
+        {
+            dirty += next < submitted ? 1 : 0;
+        }
+        return dirty;
+    }
+
+    // The number of (vertex, deformation) pairs that were evaluated so far
+    unsigned long long evaluatedVertexDeformations() const { return evaluated; }
+
+private:
+    struct Deformer
+    {
+        MeshSolver solver;
+        vec3   center;
+        float  radius;
+    };
+
+    void evaluateTile(unsigned int tile)
+    {
+        unsigned int submitted = firstDeformer + (unsigned int)deformers.size();
+        unsigned int next = tileNext[tile];
+        if (next == submitted)
+        {
+            return;
+        }
+
+        unsigned int first = tile * LAZYMESH_TILE_VERTICES;
+        unsigned int last = min((int)(first + LAZYMESH_TILE_VERTICES), (int)vertices.size());
+        unsigned long long count = 0;
+        for (unsigned int i = first; i < last; i++)
+        {
+            vec3 p = vertices[i];
+            for (unsigned int d = next; d < submitted; d++)
+            {
+                const Deformer& deformer = deformers[d - firstDeformer];
+                if (deformer.radius >= 0.0f && dot(p - deformer.center, p - deformer.center) > deformer.radius * deformer.radius)
+                {
+                    continue;
+                }
+                p = deformer.solver(p);
+                count++;
+            }
+            vertices[i] = p;
+        }
+        tileNext[tile] = submitted;
+        evaluated += count;
+    }
+
+    // Forgets the deformations that every tile has applied
+    void dropAppliedDeformers()
+    {
+        unsigned int oldest = firstDeformer + (unsigned int)deformers.size();
+        for (unsigned int next : tileNext)
+        {
+            oldest = min((int)oldest, (int)next);
+        }
+        while (firstDeformer < oldest)
+        {
+            deformers.pop_front();
+            firstDeformer++;
+        }
+    }
+
+    std::vector<vec3>               vertices;
+    std::vector<unsigned int>       tileNext;  // the next deformation every tile has to apply
+    std::deque<Deformer>            deformers;
+    unsigned int                    firstDeformer = 0;  // the index of deformers[0]
+    std::atomic<unsigned long long> evaluated{ 0 };
+};
@@ -0,0 +1,115 @@
+// Copyright(c) Facebook, Inc. and its affiliates.
+// All rights reserved.
+//
+// This source code is licensed under the BSD - style license found in the
+// LICENSE file in the root directory of this source tree.
+
+#pragma once
+
+///////////////////////////////////////////////////////
+// Deforming a whole mesh on the CPU
+//
+// The examples in test.cpp integrate one vertex after the other. The
+// adaptive solvers take many more steps near the tool than far away
+// from it, and the expensive vertices are usually next to each other,
+// so splitting the mesh into one equal part per thread leaves most of
+// the threads idle. deformMesh() splits the vertices into small chunks
+// that the threads of a work-stealing ThreadPool balance between them.
+//
+// Every vertex is integrated on its own, with the same inputs, whatever
+// thread integrates it, so the results are bit-identical for any number
+// of threads.
+//
+// The threads come from threadpool.h, which must be included first.
+///////////////////////////////////////////////////////
+
+// The number of vertices in a chunk: small enough to balance, large enough
+// that taking a chunk costs much less than integrating it
+#define MESHDEFORMER_VERTICES_PER_CHUNK 64
+
+// The number of chunks that deformMesh() and forEachMeshChunk() split vertexCount vertices into
+INLINE unsigned int meshChunkCount(unsigned int vertexCount)
+{
+    return (vertexCount + MESHDEFORMER_VERTICES_PER_CHUNK - 1) / MESHDEFORMER_VERTICES_PER_CHUNK;
+}
+
+// Calls f(chunk, first, last) for every chunk of the vertices [0, vertexCount), with the threads
+// of the pool. For loops over the vertices that do more than deform them, like writing a list per
+// chunk, or checking for cancellation between chunks.
+template <typename F>
+INLINE void forEachMeshChunk(ThreadPool& pool, unsigned int vertexCount, const F& f)
+{
+    pool.parallelFor(0, meshChunkCount(vertexCount), [&](unsigned int chunk)
+    {
+        unsigned int first = chunk * MESHDEFORMER_VERTICES_PER_CHUNK;
+        unsigned int last = min((int)(first + MESHDEFORMER_VERTICES_PER_CHUNK), (int)vertexCount);
+        f(chunk, first, last);
+    });
+}
+
+// Bounds the vertices [first, last) with a sphere, e.g. to cull a tile or a page of the mesh
+INLINE void meshBounds(const vec3* positions, unsigned int first, unsigned int last, vec3& center, float& radius)
+{
+    vec3 lo = positions[first];
+    vec3 hi = positions[first];
+    for (unsigned int i = first + 1; i < last; i++)
+    {
+        lo = vec3(min(lo.x, positions[i].x), min(lo.y, positions[i].y), min(lo.z, positions[i].z));
+        hi = vec3(max(hi.x, positions[i].x), max(hi.y, positions[i].y), max(hi.z, positions[i].z));
+    }
+    center = (lo + hi) * 0.5f;
+    radius = length(hi - lo) * 0.5f;
+}
+
+// The key of the cell (x, y, z) of a sparse grid, e.g. in an unordered_map of the cells that
+// vertices fall in. The coordinates are biased by 2^20 and keep 21 bits each, so the keys are
+// distinct within a million cells of the origin, in either direction.
+INLINE unsigned long long gridKey(int x, int y, int z)
+{
+    const unsigned long long mask = (1ull << 21) - 1;
+    return ((unsigned long long)(x + (1 << 20)) & mask) | (((unsigned long long)(y + (1 << 20)) & mask) << 21) | (((unsigned long long)(z + (1 << 20)) & mask) << 42);
+}
+
+// The solver that the mesh classes keep: solver(position) returns where a deformation
+// (a stroke, a frame, a motion) moves position
+typedef std::function<vec3(vec3)> MeshSolver;
+
+// Calls solver(position, i), or solver(position) if it doesn't take the index of the vertex
+template <typename Solver>
+INLINE auto callMeshSolver(const Solver& solver, vec3 position, unsigned int i, int) -> decltype(solver(position, i))
+{
+    return solver(position, i);
+}
+
+template <typename Solver>
+INLINE auto callMeshSolver(const Solver& solver, vec3 position, unsigned int, long) -> decltype(solver(position))
+{
+    return solver(position);
+}
+
+// Calls solver(position, i) for every vertex i, and writes the result to deformed[i]. solver can
+// also be solver(position), when it doesn't depend on the vertex. It can wrap any of the
+// Integrate* functions, for example:
+//     deformMesh(pool, mesh.vertices.data(), mesh.vertices.data(), count, [&](vec3 position, unsigned int i)
+//     {
+//         return IntegrateKelvinlets_AdaptiveBS32(position, kelvinlet.time, kelvinlet.time + kelvinlet.dt, toleranceForVertex(tolerances, i), kelvinlet);
+//     });
+// positions and deformed may be the same array.
+template <typename Solver>
+INLINE void deformMesh(ThreadPool& pool, const vec3* positions, vec3* deformed, unsigned int vertexCount, const Solver& solver)
+{
+    forEachMeshChunk(pool, vertexCount, [&](unsigned int, unsigned int first, unsigned int last)
+    {
+        for (unsigned int i = first; i < last; i++)
+        {
+            deformed[i] = callMeshSolver(solver, positions[i], i, 0);
+        }
+    });
+}
+
+// Deforms positions in place
+template <typename Solver>
+INLINE void deformMesh(ThreadPool& pool, vec3* positions, unsigned int vertexCount, const Solver& solver)
+{
+    deformMesh(pool, positions, positions, vertexCount, solver);
+}
@@ -58,7 +58,7 @@ NonElasticEvaluateODE_TwoDeformers(float t, vec3 x, Deformation deformer0, Defor
 #define EVALUATE NonElasticEvaluateODE
 #define PARAMETERLIST Deformation deformer
 #define PARAMETERS deformer
-#include "ODESolvers.h"
+#include "odesolvers.h"
 #undef PARAMETERS
 #undef PARAMETERLIST
 #undef EVALUATE
@@ -68,7 +68,7 @@ NonElasticEvaluateODE_TwoDeformers(float t, vec3 x, Deformation deformer0, Defor
 #define EVALUATE NonElasticEvaluateODE_TwoDeformers
 #define PARAMETERLIST Deformation deformer0, Deformation deformer1
 #define PARAMETERS deformer0, deformer1
-#include "ODESolvers.h"
+#include "odesolvers.h"
 #undef PARAMETERS
 #undef PARAMETERLIST
 #undef EVALUATE
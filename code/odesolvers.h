@@ -4,7 +4,11 @@
 // This source code is licensed under the BSD - style license found in the
 // LICENSE file in the root directory of this source tree.
 
-#pragma once
+// There is intentionally no #pragma once in this file:
+// it is included once for every variant of the solvers.
+// Without SCOPE there is no variant to generate, so an
+// include of this file on its own does nothing.
+#ifdef SCOPE
 
 /*
  * This file contains a collection of ODE solvers
@@ -76,6 +80,14 @@
 // we use this dt instead of a smaller value.
 #define ADAPTIVE_INTEGRATOR_MINIMUM_DT 0.001f
 
+// The most the adaptive integrators can grow dt
+// from one step to the next. The error estimate
+// can be zero, or nearly so, by chance (when the
+// two answers agree), and the next step would take
+// you all the way to the end, where the estimate
+// isn't reliable anymore.
+#define ADAPTIVE_INTEGRATOR_MAXIMUM_GROWTH 5.0f
+
 ///////////////////////////////////////////////////////
 // Integrator step functions
 ///////////////////////////////////////////////////////
@@ -243,7 +255,7 @@ SCOPE(dormandprincerungekutta)(float t, float dt, vec3 x, PARAMETERLIST)
     vec3 k4 = dt*EVALUATE(t + dt*a4, x + k1*b41 + k2*b42 + k3*b43, PARAMETERS);
     vec3 k5 = dt*EVALUATE(t + dt*a5, x + k1*b51 + k2*b52 + k3*b53 + k4*b54, PARAMETERS);
     vec3 k6 = dt*EVALUATE(t + dt*a6, x + k1*b61 + k2*b62 + k3*b63 + k4*b64 + k5*b65, PARAMETERS);
-    vec3 k7 = dt*EVALUATE(t + dt*a7, x + k1*b71 + k2*b72 + k3*b73 + k4*b74 + k5*b75 + k5*b76, PARAMETERS);
+    vec3 k7 = dt*EVALUATE(t + dt*a7, x + k1*b71 + k2*b72 + k3*b73 + k4*b74 + k5*b75 + k6*b76, PARAMETERS);
 
     SCOPE(DormandPrinceRungeKuttaResult) result;
 	result.fourthorder = x + k1*d1 + k2*d2 + k3*d3 + k4*d4 + k5*d5 + k6*d6 + k7*d7;
@@ -360,12 +372,13 @@ INLINE vec3 SCOPE(_AdaptiveRK)(vec3 pos, float tstart, float tend, float maxerro
 
         float safety = 0.9f;
         float newdt = dt * safety * pow(maxerror / error, 0.2f);
+        newdt = min(newdt, dt * ADAPTIVE_INTEGRATOR_MAXIMUM_GROWTH);
 
         if (error <= maxerror || dt <= ADAPTIVE_INTEGRATOR_MINIMUM_DT)
         {
             pos = fullstep;
             t += dt;
-            dt = newdt;
+            dt = max(newdt, ADAPTIVE_INTEGRATOR_MINIMUM_DT);
         }
         else
         {
@@ -393,12 +406,13 @@ INLINE vec3 SCOPE(_AdaptiveRKF45)(vec3 pos, float tstart, float tend, float maxe
 
         float safety = 0.9f;
         float newdt = dt * safety * pow(maxerror / error, 0.20f);
+        newdt = min(newdt, dt * ADAPTIVE_INTEGRATOR_MAXIMUM_GROWTH);
 
         if (error <= maxerror || dt <= ADAPTIVE_INTEGRATOR_MINIMUM_DT)
         {
             pos = rk45.fifthorder;  // local extrapolation
             t += dt;
-            dt = newdt;
+            dt = max(newdt, ADAPTIVE_INTEGRATOR_MINIMUM_DT);
 
         }
         else
@@ -427,12 +441,13 @@ INLINE vec3 SCOPE(_AdaptiveDP54)(vec3 pos, float tstart, float tend, float maxer
 
         float safety = 0.9f;
         float newdt = dt * safety * pow(maxerror / error, 0.2f);
+        newdt = min(newdt, dt * ADAPTIVE_INTEGRATOR_MAXIMUM_GROWTH);
 
         if (error <= maxerror || dt <= ADAPTIVE_INTEGRATOR_MINIMUM_DT)
         {
             pos = dprk.fifthorder;    // local extrapolation
             t += dt;
-            dt = newdt;
+            dt = max(newdt, ADAPTIVE_INTEGRATOR_MINIMUM_DT);
         }
         else
         {
@@ -460,12 +475,13 @@ INLINE vec3 SCOPE(_AdaptiveBS32)(vec3 pos, float tstart, float tend, float maxer
 
         float safety = 0.9f;
         float newdt = dt * safety * pow(maxerror / error, 1/3.0f);
+        newdt = min(newdt, dt * ADAPTIVE_INTEGRATOR_MAXIMUM_GROWTH);
 
         if (error <= maxerror || dt <= ADAPTIVE_INTEGRATOR_MINIMUM_DT)
         {
             pos = bsrk.thirdorder;    // local extrapolation
             t += dt;
-            dt = newdt;
+            dt = max(newdt, ADAPTIVE_INTEGRATOR_MINIMUM_DT);
         }
         else
         {
@@ -478,3 +494,127 @@ INLINE vec3 SCOPE(_AdaptiveBS32)(vec3 pos, float tstart, float tend, float maxer
 
     return pos;
 }
+
+///////////////////////////////////////////////////////
+// Backward solvers
+//
+// These integrate from tend back to tstart, so that
+// they return where a position that the forward
+// solver with the same tstart and tend moved to came
+// from. Kelvinlets and nonelastic deformations are
+// invertible, so this undoes a deformation up to the
+// error of the two solvers, without storing the
+// positions from before the deformation.
+///////////////////////////////////////////////////////
+
+// This takes a single RK4 step backward.
+INLINE vec3 SCOPE(_RungeKuttaBackward)(vec3 pos, float tstart, float tend, PARAMETERLIST)
+{
+    float t = tend;
+    float dt = (tstart - tend);
+
+    pos = SCOPE(rungekutta)(t, dt, pos, PARAMETERS);
+
+    return pos;
+}
+
+INLINE vec3 SCOPE(_AdaptiveRKF45Backward)(vec3 pos, float tstart, float tend, float maxerror, PARAMETERLIST)
+{
+    // t goes down from tend to tstart, and dt is the (positive) size of the steps
+    float t = tend;
+    float dt = (tend - tstart) * ADAPTIVE_INTEGRATOR_INITIAL_DT;
+    while (t > tstart)
+    {
+        dt = min(dt, t - tstart);
+
+        SCOPE(RK45Result) rk45 = SCOPE(rungekuttafehlberg)(t, -dt, pos, PARAMETERS);
+
+        float error = length(rk45.fifthorder - rk45.fourthorder) / dt;
+
+        float safety = 0.9f;
+        float newdt = dt * safety * pow(maxerror / error, 0.20f);
+        newdt = min(newdt, dt * ADAPTIVE_INTEGRATOR_MAXIMUM_GROWTH);
+
+        if (error <= maxerror || dt <= ADAPTIVE_INTEGRATOR_MINIMUM_DT)
+        {
+            pos = rk45.fifthorder;  // local extrapolation
+            t -= dt;
+            dt = max(newdt, ADAPTIVE_INTEGRATOR_MINIMUM_DT);
+        }
+        else
+        {
+            dt = (abs(newdt - dt) < 0.00001f) ? dt / 2.f : newdt;
+            dt = max(dt, ADAPTIVE_INTEGRATOR_MINIMUM_DT);
+        }
+    }
+
+    return pos;
+}
+
+INLINE vec3 SCOPE(_AdaptiveDP54Backward)(vec3 pos, float tstart, float tend, float maxerror, PARAMETERLIST)
+{
+    // t goes down from tend to tstart, and dt is the (positive) size of the steps
+    float t = tend;
+    float dt = (tend - tstart) * ADAPTIVE_INTEGRATOR_INITIAL_DT;
+    while (t > tstart)
+    {
+        dt = min(dt, t - tstart);
+
+        SCOPE(DormandPrinceRungeKuttaResult) dprk = SCOPE(dormandprincerungekutta)(t, -dt, pos, PARAMETERS);
+
+        float error = length(dprk.fifthorder - dprk.fourthorder) / dt;
+
+        float safety = 0.9f;
+        float newdt = dt * safety * pow(maxerror / error, 0.2f);
+        newdt = min(newdt, dt * ADAPTIVE_INTEGRATOR_MAXIMUM_GROWTH);
+
+        if (error <= maxerror || dt <= ADAPTIVE_INTEGRATOR_MINIMUM_DT)
+        {
+            pos = dprk.fifthorder;    // local extrapolation
+            t -= dt;
+            dt = max(newdt, ADAPTIVE_INTEGRATOR_MINIMUM_DT);
+        }
+        else
+        {
+            dt = (abs(newdt - dt) < 0.00001f) ? dt / 2.f : newdt;
+            dt = max(dt, ADAPTIVE_INTEGRATOR_MINIMUM_DT);
+        }
+    }
+
+    return pos;
+}
+
+INLINE vec3 SCOPE(_AdaptiveBS32Backward)(vec3 pos, float tstart, float tend, float maxerror, PARAMETERLIST)
+{
+    // t goes down from tend to tstart, and dt is the (positive) size of the steps
+    float t = tend;
+    float dt = (tend - tstart) * ADAPTIVE_INTEGRATOR_INITIAL_DT;
+    while (t > tstart)
+    {
+        dt = min(dt, t - tstart);
+
+        SCOPE(BogackiShampineRungeKuttaResult) bsrk = SCOPE(bogackishampinerungekutta)(t, -dt, pos, PARAMETERS);
+
+        float error = length(bsrk.thirdorder - bsrk.secondorder) / dt;
+
+        float safety = 0.9f;
+        float newdt = dt * safety * pow(maxerror / error, 1/3.0f);
+        newdt = min(newdt, dt * ADAPTIVE_INTEGRATOR_MAXIMUM_GROWTH);
+
+        if (error <= maxerror || dt <= ADAPTIVE_INTEGRATOR_MINIMUM_DT)
+        {
+            pos = bsrk.thirdorder;    // local extrapolation
+            t -= dt;
+            dt = max(newdt, ADAPTIVE_INTEGRATOR_MINIMUM_DT);
+        }
+        else
+        {
+            dt = (abs(newdt - dt) < 0.00001f) ? dt / 2.f : newdt;
+            dt = max(dt, ADAPTIVE_INTEGRATOR_MINIMUM_DT);
+        }
+    }
+
+    return pos;
+}
+
+#endif // SCOPE
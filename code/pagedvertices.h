@@ -0,0 +1,499 @@
+// Copyright(c) Facebook, Inc. and its affiliates.
+// All rights reserved.
+//
+// This source code is licensed under the BSD - style license found in the
+// LICENSE file in the root directory of this source tree.
+
+#pragma once
+
+///////////////////////////////////////////////////////
+// Copy-on-write vertex pages for undo and redo
+//
+// Copying all the vertices of a mesh before every stroke, so that it can
+// be undone, costs tens of megabytes per stroke on large sculpts.
+// PagedVertexStore keeps the vertices in pages that are shared between
+// the mesh and its undo and redo history. Every page keeps a chain of
+// the versions the history holds, each with the number of checkpoints in
+// a row that hold it, so a checkpoint only counts one more checkpoint for
+// each page, and a stroke only copies the pages it writes. The history
+// grows with the size of the edits, not of the mesh, and the bytes it
+// uses are counted as pages come and go, not by walking it.
+//
+// The history has a memory budget. When it is over the budget, the
+// pages that only the history uses are compressed, oldest first, and
+// when that isn't enough, the oldest checkpoints are forgotten. The
+// compression is lossless: undo restores the exact positions.
+//
+// Pages are bounded with meshBounds() from meshdeformer.h, and compressed
+// with vertexcodec.h; include those and threadpool.h first.
+///////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <vector>
+
+// The number of vertices in a page
+#define PAGEDVERTICES_PAGE_VERTICES 1024
+
+struct PagedVertexStoreStats
+{
+    unsigned int pages;              // the pages of the mesh
+    unsigned int historyPages;       // the pages that only the history uses
+    unsigned int compressedPages;    // the ones that are compressed
+    size_t       historyBytes;       // the memory the history uses
+    unsigned int undoCheckpoints;
+    unsigned int redoCheckpoints;
+    unsigned int droppedCheckpoints; // the checkpoints that were forgotten to stay within the budget
+};
+
+class PagedVertexStore
+{
+public:
+    PagedVertexStore(const vec3* positions, unsigned int vertexCount, size_t historyBudgetBytes)
+        : historyBudget(historyBudgetBytes)
+    {
+        unsigned int pageCount = (vertexCount + PAGEDVERTICES_PAGE_VERTICES - 1) / PAGEDVERTICES_PAGE_VERTICES;
+        for (unsigned int p = 0; p < pageCount; p++)
+        {
+            unsigned int first = p * PAGEDVERTICES_PAGE_VERTICES;
+            unsigned int last = min((int)(first + PAGEDVERTICES_PAGE_VERTICES), (int)vertexCount);
+            std::shared_ptr<Page> page = std::make_shared<Page>();
+            page->vertices.assign(positions + first, positions + last);
+            updateBounds(*page);
+            page->inMesh = true;
+            pages.push_back(page);
+        }
+        undoRuns.resize(pageCount);
+        redoRuns.resize(pageCount);
+    }
+
+    vec3 position(unsigned int i) const
+    {
+        return pages[i / PAGEDVERTICES_PAGE_VERTICES]->vertices[i % PAGEDVERTICES_PAGE_VERTICES];
+    }
+
+    void setPosition(unsigned int i, vec3 position)
+    {
+        copied = false;
+        Page& page = writablePage(i / PAGEDVERTICES_PAGE_VERTICES);
+        page.vertices[i % PAGEDVERTICES_PAGE_VERTICES] = position;
+        updateBounds(page);
+        if (copied)
+        {
+            enforceBudget();
+        }
+    }
+
+    // Copies all the positions
+    void read(vec3* out) const
+    {
+        for (const std::shared_ptr<Page>& page : pages)
+        {
+            std::copy(page->vertices.begin(), page->vertices.end(), out);
+            out += page->vertices.size();
+        }
+    }
+
+    // Deforms the vertices. Pages that are farther than radius from center skip the deformation,
+    // so the solver must not move their vertices; a negative radius reaches every page (like
+    // Kelvinlets). Returns the number of pages that were deformed.
+    unsigned int deform(ThreadPool& pool, const MeshSolver& solver, vec3 center = vec3(0, 0, 0), float radius = -1.0f)
+    {
+        touched.clear();
+        copied = false;
+        for (unsigned int p = 0; p < pages.size(); p++)
+        {
+            const Page& page = *pages[p];
+            if (radius < 0.0f || length(page.center - center) <= page.radius + radius)
+            {
+                writablePage(p);
+                touched.push_back(p);
+            }
+        }
+
+        pool.parallelFor(0, (unsigned int)touched.size(), [&](unsigned int t)
+        {
+            Page& page = *pages[touched[t]];
+            for (vec3& vertex : page.vertices)
+            {
+                vertex = solver(vertex);
+            }
+            updateBounds(page);
+        });
+        if (copied)
+        {
+            enforceBudget();
+        }
+        return (unsigned int)touched.size();
+    }
+
+    // Remembers the current positions, so that undo() can return to them. Call this before
+    // every stroke. Forgets the redo history.
+    void checkpoint()
+    {
+        for (unsigned int p = 0; p < pages.size(); p++)
+        {
+            pushRun(undoRuns[p], pages[p]);
+            while (!redoRuns[p].empty())
+            {
+                popRun(redoRuns[p]);
+            }
+        }
+        undoCount++;
+        redoCount = 0;
+        enforceBudget();
+    }
+
+    // Returns to the last checkpoint. Returns false if there isn't one.
+    bool undo()
+    {
+        if (undoCount == 0)
+        {
+            return false;
+        }
+        for (unsigned int p = 0; p < pages.size(); p++)
+        {
+            pushRun(redoRuns[p], pages[p]);
+            setMeshPage(p, undoRuns[p].back().page);
+            popRun(undoRuns[p]);
+        }
+        undoCount--;
+        redoCount++;
+        enforceBudget();
+        return true;
+    }
+
+    // Returns to where the last undo() was. Returns false if there isn't one.
+    bool redo()
+    {
+        if (redoCount == 0)
+        {
+            return false;
+        }
+        for (unsigned int p = 0; p < pages.size(); p++)
+        {
+            pushRun(undoRuns[p], pages[p]);
+            setMeshPage(p, redoRuns[p].back().page);
+            popRun(redoRuns[p]);
+        }
+        undoCount++;
+        redoCount--;
+        enforceBudget();
+        return true;
+    }
+
+    PagedVertexStoreStats stats() const
+    {
+        PagedVertexStoreStats stats = {};
+        stats.pages = (unsigned int)pages.size();
+        stats.historyPages = historyPages;
+        stats.compressedPages = compressedPages;
+        stats.historyBytes = historyBytes();
+        stats.undoCheckpoints = undoCount;
+        stats.redoCheckpoints = redoCount;
+        stats.droppedCheckpoints = droppedCheckpoints;
+        return stats;
+    }
+
+private:
+    // A page keeps its vertices, or their compressed bytes when only the history uses it
+    struct Page
+    {
+        std::vector<vec3>          vertices;
+        std::vector<unsigned char> compressed;
+        unsigned int               count = 0;  // the number of vertices, when they are compressed
+        std::shared_ptr<Page>      reference;  // the newer version they are compressed against
+        vec3                       center;     // the bounds of the vertices
+        float                      radius = 0.0f;
+        bool                       inMesh = false;
+        unsigned int               runs = 0;       // the runs of the history that hold the page
+        unsigned int               referrers = 0;  // the pages compressed against it
+    };
+
+    // The checkpoints that hold the same version of a page, one after the other. Every page of
+    // the mesh has a chain of runs for the undo history, oldest first, and another for the redo
+    // history, with the one undo() made last at the back.
+    struct Run
+    {
+        std::shared_ptr<Page> page;
+        unsigned int          checkpoints;
+    };
+
+    typedef std::deque<Run> RunChain;
+
+    // Copies the page first if the history shares it, and sets copied
+    Page& writablePage(unsigned int p)
+    {
+        if (pages[p].use_count() > 1)
+        {
+            copied = true;
+            std::shared_ptr<Page> page = std::make_shared<Page>();
+            page->vertices = pages[p]->vertices;
+            page->center = pages[p]->center;
+            page->radius = pages[p]->radius;
+            setMeshPage(p, page);
+        }
+        return *pages[p];
+    }
+
+    void updateBounds(Page& page)
+    {
+        meshBounds(page.vertices.data(), 0, (unsigned int)page.vertices.size(), page.center, page.radius);
+    }
+
+    // Whether the page counts toward the history: the history uses it and the mesh doesn't
+    static bool inHistory(const Page& page)
+    {
+        return !page.inMesh && (page.runs > 0 || page.referrers > 0);
+    }
+
+    static size_t pageBytes(const Page& page)
+    {
+        return page.vertices.empty() ? page.compressed.size() : page.vertices.size() * sizeof(vec3);
+    }
+
+    // Changes the bookkeeping of a page with change(page), and keeps the counts of the history up
+    // to date. A page that only compressed pages use is kept in orphans, so it can be compressed
+    // too; a page that nothing uses anymore lets go of the page it is compressed against.
+    template <typename F>
+    void account(std::shared_ptr<Page> page, F change)
+    {
+        bool wasInHistory = inHistory(*page);
+        bool wasOrphan = wasInHistory && page->runs == 0 && page->referrers > 0;
+        if (wasInHistory)
+        {
+            historyPageBytes -= pageBytes(*page);
+            historyPages--;
+            compressedPages -= page->vertices.empty() ? 1 : 0;
+        }
+
+        change(*page);
+
+        bool isInHistory = inHistory(*page);
+        bool isOrphan = isInHistory && page->runs == 0 && page->referrers > 0;
+        if (isInHistory)
+        {
+            historyPageBytes += pageBytes(*page);
+            historyPages++;
+            compressedPages += page->vertices.empty() ? 1 : 0;
+        }
+        if (isOrphan && !wasOrphan)
+        {
+            orphans.push_back(page);
+        }
+        else if (wasOrphan && !isOrphan)
+        {
+            orphans.erase(std::find(orphans.begin(), orphans.end(), page));
+        }
+
+        if (!page->inMesh && page->runs == 0 && page->referrers == 0 && page->reference)
+        {
+            std::shared_ptr<Page> reference;
+            reference.swap(page->reference);
+            account(reference, removeReferrer);
+        }
+    }
+
+    static void removeReferrer(Page& page)
+    {
+        page.referrers--;
+    }
+
+    // Adds a checkpoint that holds page to the newest end of a chain
+    void pushRun(RunChain& chain, const std::shared_ptr<Page>& page)
+    {
+        if (!chain.empty() && chain.back().page == page)
+        {
+            chain.back().checkpoints++;
+            return;
+        }
+        chain.push_back({ page, 1 });
+        runCount++;
+        account(page, [](Page& p) { p.runs++; });
+    }
+
+    // Removes the checkpoint at the newest end of a chain
+    void popRun(RunChain& chain)
+    {
+        if (--chain.back().checkpoints > 0)
+        {
+            return;
+        }
+        std::shared_ptr<Page> page = chain.back().page;
+        chain.pop_back();
+        runCount--;
+        account(page, [](Page& p) { p.runs--; });
+    }
+
+    // Removes the checkpoint at the oldest end of a chain
+    void popOldestRun(RunChain& chain)
+    {
+        if (--chain.front().checkpoints > 0)
+        {
+            return;
+        }
+        std::shared_ptr<Page> page = chain.front().page;
+        chain.pop_front();
+        runCount--;
+        account(page, [](Page& p) { p.runs--; });
+    }
+
+    void setMeshPage(unsigned int p, const std::shared_ptr<Page>& page)
+    {
+        if (pages[p] == page)
+        {
+            return;
+        }
+        std::shared_ptr<Page> last = pages[p];
+        pages[p] = page;
+        account(last, [](Page& l) { l.inMesh = false; });
+        account(page, [](Page& n) { n.inMesh = true; });
+        if (page->vertices.empty())
+        {
+            decompress(page);
+        }
+    }
+
+    size_t historyBytes() const
+    {
+        return historyPageBytes + runCount * sizeof(Run);
+    }
+
+    // Compresses the oldest pages of the history, and then forgets the oldest checkpoints, until
+    // the history fits in the budget
+    void enforceBudget()
+    {
+        if (historyBytes() <= historyBudget)
+        {
+            return;
+        }
+
+        // the oldest runs of every page first, and then the pages that only compressed pages use
+        for (std::vector<RunChain>* chains : { &undoRuns, &redoRuns })
+        {
+            for (size_t r = 0; historyBytes() > historyBudget; r++)
+            {
+                bool more = false;
+                for (unsigned int p = 0; p < pages.size() && historyBytes() > historyBudget; p++)
+                {
+                    RunChain& chain = (*chains)[p];
+                    if (r >= chain.size())
+                    {
+                        continue;
+                    }
+                    more = true;
+                    const std::shared_ptr<Page>& page = chain[r].page;
+                    if (!page->inMesh && !page->vertices.empty())
+                    {
+                        compress(page, r + 1 < chain.size() ? chain[r + 1].page : pages[p]);
+                    }
+                }
+                if (!more)
+                {
+                    break;
+                }
+            }
+        }
+        for (size_t o = 0; o < orphans.size() && historyBytes() > historyBudget; o++)
+        {
+            if (!orphans[o]->vertices.empty())
+            {
+                compress(orphans[o], std::shared_ptr<Page>());
+            }
+        }
+
+        while (historyBytes() > historyBudget && undoCount > 0)
+        {
+            for (unsigned int p = 0; p < pages.size(); p++)
+            {
+                popOldestRun(undoRuns[p]);
+            }
+            undoCount--;
+            droppedCheckpoints++;
+        }
+    }
+
+    // Compresses the vertices against the newer version of the page, which only differs in the
+    // vertices that a stroke moved (see vertexcodec.h)
+    void compress(const std::shared_ptr<Page>& page, const std::shared_ptr<Page>& newer)
+    {
+        account(page, [&](Page& older)
+        {
+            unsigned int count = (unsigned int)older.vertices.size();
+            std::vector<vec3> newerVertices;
+            if (newer)
+            {
+                newerVertices.resize(count);
+                decode(*newer, newerVertices.data());
+            }
+            std::vector<unsigned int> bits(count * 3);
+            vertexDeltaBits(older.vertices.data(), newer ? newerVertices.data() : nullptr, count, bits.data());
+
+            older.compressed.clear();
+            encodeVertexBits(bits.data(), count * 3, older.compressed);
+            older.compressed.shrink_to_fit();
+            older.count = count;
+            older.reference = newer;
+            std::vector<vec3>().swap(older.vertices);
+        });
+        if (newer)
+        {
+            account(newer, [](Page& n) { n.referrers++; });
+        }
+    }
+
+    // Writes the vertices of a page, compressed or not
+    static void decode(const Page& page, vec3* vertices)
+    {
+        if (!page.vertices.empty())
+        {
+            std::copy(page.vertices.begin(), page.vertices.end(), vertices);
+            return;
+        }
+
+        unsigned int count = page.count;
+        std::vector<vec3> newerVertices;
+        if (page.reference)
+        {
+            newerVertices.resize(count);
+            decode(*page.reference, newerVertices.data());
+        }
+        std::vector<unsigned int> bits(count * 3);
+        decodeVertexBits(page.compressed.data(), count * 3, bits.data());
+        vertexFromDeltaBits(bits.data(), page.reference ? newerVertices.data() : nullptr, count, vertices);
+    }
+
+    void decompress(const std::shared_ptr<Page>& page)
+    {
+        std::shared_ptr<Page> reference = page->reference;
+        account(page, [](Page& p)
+        {
+            std::vector<vec3> vertices(p.count);
+            decode(p, vertices.data());
+            p.vertices.swap(vertices);
+            std::vector<unsigned char>().swap(p.compressed);
+            p.reference.reset();
+        });
+        if (reference)
+        {
+            account(reference, removeReferrer);
+        }
+    }
+
+    size_t                             historyBudget;
+    std::vector<std::shared_ptr<Page>> pages;     // the pages of the mesh
+    std::vector<RunChain>              undoRuns;  // one chain per page of the mesh
+    std::vector<RunChain>              redoRuns;
+    std::vector<std::shared_ptr<Page>> orphans;   // the pages that only compressed pages use
+    unsigned int                       undoCount = 0;
+    unsigned int                       redoCount = 0;
+    size_t                             runCount = 0;
+    size_t                             historyPageBytes = 0;
+    unsigned int                       historyPages = 0;     // the pages that only the history uses
+    unsigned int                       compressedPages = 0;  // the ones that are compressed
+    unsigned int                       droppedCheckpoints = 0;
+    std::vector<unsigned int>          touched;
+    bool                               copied = false;  // whether a write copied a page, which grows the history
+};
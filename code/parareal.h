@@ -0,0 +1,213 @@
+// Copyright(c) Facebook, Inc. and its affiliates.
+// All rights reserved.
+//
+// This source code is licensed under the BSD - style license found in the
+// LICENSE file in the root directory of this source tree.
+
+#pragma once
+
+///////////////////////////////////////////////////////
+// Parallel-in-time (Parareal) integration of recorded strokes
+//
+// Replaying a long stroke integrates every vertex through every frame
+// in order, so a small mesh doesn't have enough vertices to keep many
+// cores busy. Parareal splits the stroke into segments of frames, and
+// iterates:
+//
+//   U[n+1] = G(U[n]) + F(U_previous[n]) - G(U_previous[n])
+//
+// where G is a cheap coarse propagator (a single RK4 step per frame
+// of the segment) and F is the accurate fine propagator (several RK4
+// steps per frame). All of the fine solves of an iteration are
+// independent, so they run in parallel. After k iterations, the first
+// k segments are exact, so this always converges in at most one
+// iteration per segment. It converges in far fewer when F - G is
+// small and smooth: G is then a good guess of how a change at the
+// start of a segment moves its end. F takes fixed steps, not the
+// adaptive solvers' steps: those depend on the start position, so F
+// wouldn't be smooth, and the corrections wouldn't shrink below its
+// error. With PARAREAL_FINE_STEPS of 4, F is about 256 times as
+// accurate as G, and the recorded strokes converge in one iteration.
+//
+// Include threadpool.h and tolerance.h (for ToleranceField) first.
+///////////////////////////////////////////////////////
+
+#include <vector>
+
+// The number of vertices that one task of the pool integrates
+#define PARAREAL_VERTICES_PER_TASK 256
+
+// The number of RK4 steps per frame of the fine propagator
+#define PARAREAL_FINE_STEPS 4
+
+struct PararealResult
+{
+    int   iterations;     // number of Parareal iterations (fine solves of every segment)
+    float maxCorrection;  // the largest change of a segment boundary in the last iteration
+};
+
+// Coarse propagator: a single RK4 step for each frame in [firstFrame, endFrame).
+// This is what tests 6 and 7 in test.cpp do.
+INLINE vec3
+IntegrateKelvinletStroke_RungeKutta(vec3 pos, const Kelvinlet* kelvinlets, unsigned int firstFrame, unsigned int endFrame)
+{
+    for (unsigned int frame = firstFrame; frame < endFrame; frame++)
+    {
+        pos = IntegrateKelvinlets_RungeKutta(pos, kelvinlets[frame].time, kelvinlets[frame].time + kelvinlets[frame].dt, kelvinlets[frame]);
+    }
+    return pos;
+}
+
+// Fine propagator: PARAREAL_FINE_STEPS RK4 steps for each frame in [firstFrame, endFrame)
+INLINE vec3
+IntegrateKelvinletStroke_RungeKuttaSubsteps(vec3 pos, const Kelvinlet* kelvinlets, unsigned int firstFrame, unsigned int endFrame)
+{
+    for (unsigned int frame = firstFrame; frame < endFrame; frame++)
+    {
+        const Kelvinlet& kelvinlet = kelvinlets[frame];
+        for (unsigned int step = 0; step < PARAREAL_FINE_STEPS; step++)
+        {
+            float t0 = kelvinlet.time + kelvinlet.dt * step / PARAREAL_FINE_STEPS;
+            float t1 = kelvinlet.time + kelvinlet.dt * (step + 1) / PARAREAL_FINE_STEPS;
+            pos = IntegrateKelvinlets_RungeKutta(pos, t0, t1, kelvinlet);
+        }
+    }
+    return pos;
+}
+
+// Deforms positions with every Kelvinlet of a stroke, in order, iterating
+// until no segment boundary of a vertex moves by more than its tolerance.
+// segmentCount of 0 uses one segment per thread of the pool.
+INLINE PararealResult
+IntegrateKelvinletStroke_Parareal(ThreadPool& pool, vec3* positions, unsigned int vertexCount, ToleranceField maxerror,
+                                  const Kelvinlet* kelvinlets, unsigned int frameCount, unsigned int segmentCount = 0)
+{
+    PararealResult result;
+    result.iterations = 0;
+    result.maxCorrection = 0.0f;
+
+    if (vertexCount == 0 || frameCount == 0)
+    {
+        return result;
+    }
+
+    if (segmentCount == 0)
+    {
+        segmentCount = pool.threadCount();
+    }
+    segmentCount = max(min((int)segmentCount, (int)frameCount), 1);
+
+    // segment n covers frames [segmentStart[n], segmentStart[n + 1])
+    std::vector<unsigned int> segmentStart(segmentCount + 1);
+    for (unsigned int n = 0; n <= segmentCount; n++)
+    {
+        segmentStart[n] = (unsigned int)((unsigned long long)frameCount * n / segmentCount);
+    }
+
+    unsigned int taskCount = (vertexCount + PARAREAL_VERTICES_PER_TASK - 1) / PARAREAL_VERTICES_PER_TASK;
+
+    // boundaries[n * vertexCount + i] is vertex i at the start of segment n
+    std::vector<vec3> boundaries((segmentCount + 1) * vertexCount);
+    std::vector<vec3> coarse(segmentCount * vertexCount);
+    std::vector<vec3> fine(segmentCount * vertexCount);
+    std::vector<float> taskCorrection(taskCount);
+    std::vector<float> taskConvergence(taskCount);
+
+    for (unsigned int i = 0; i < vertexCount; i++)
+    {
+        boundaries[i] = positions[i];
+    }
+
+    // initial coarse sweep
+    pool.parallelFor(0, taskCount, [&](unsigned int task)
+    {
+        unsigned int first = task * PARAREAL_VERTICES_PER_TASK;
+        unsigned int last = min((int)(first + PARAREAL_VERTICES_PER_TASK), (int)vertexCount);
+        for (unsigned int n = 0; n < segmentCount; n++)
+        {
+            for (unsigned int i = first; i < last; i++)
+            {
+                coarse[n * vertexCount + i] = IntegrateKelvinletStroke_RungeKutta(boundaries[n * vertexCount + i], kelvinlets, segmentStart[n], segmentStart[n + 1]);
+                boundaries[(n + 1) * vertexCount + i] = coarse[n * vertexCount + i];
+            }
+        }
+    });
+
+    for (unsigned int k = 0; k < segmentCount; k++)
+    {
+        // segments before k are already exact, so only the rest need a fine solve
+        unsigned int activeSegments = segmentCount - k;
+        pool.parallelFor(0, activeSegments * taskCount, [&](unsigned int job)
+        {
+            unsigned int n = k + job / taskCount;
+            unsigned int first = (job % taskCount) * PARAREAL_VERTICES_PER_TASK;
+            unsigned int last = min((int)(first + PARAREAL_VERTICES_PER_TASK), (int)vertexCount);
+            for (unsigned int i = first; i < last; i++)
+            {
+                fine[n * vertexCount + i] = IntegrateKelvinletStroke_RungeKuttaSubsteps(boundaries[n * vertexCount + i], kelvinlets, segmentStart[n], segmentStart[n + 1]);
+            }
+        });
+
+        // coarse sweep with the correction, sequential in segments but parallel in vertices
+        pool.parallelFor(0, taskCount, [&](unsigned int task)
+        {
+            unsigned int first = task * PARAREAL_VERTICES_PER_TASK;
+            unsigned int last = min((int)(first + PARAREAL_VERTICES_PER_TASK), (int)vertexCount);
+            // convergence is the largest correction relative to the vertex's tolerance
+            float correction = 0.0f;
+            float convergence = 0.0f;
+            for (unsigned int i = first; i < last; i++)
+            {
+                float c = length(fine[k * vertexCount + i] - boundaries[(k + 1) * vertexCount + i]);
+                correction = max(correction, c);
+                convergence = max(convergence, c / toleranceForVertex(maxerror, i));
+                boundaries[(k + 1) * vertexCount + i] = fine[k * vertexCount + i];
+            }
+            for (unsigned int n = k + 1; n < segmentCount; n++)
+            {
+                for (unsigned int i = first; i < last; i++)
+                {
+                    vec3 previouscoarse = coarse[n * vertexCount + i];
+                    vec3 newcoarse = IntegrateKelvinletStroke_RungeKutta(boundaries[n * vertexCount + i], kelvinlets, segmentStart[n], segmentStart[n + 1]);
+                    vec3 boundary = newcoarse + fine[n * vertexCount + i] - previouscoarse;
+
+                    float c = length(boundary - boundaries[(n + 1) * vertexCount + i]);
+                    correction = max(correction, c);
+                    convergence = max(convergence, c / toleranceForVertex(maxerror, i));
+                    coarse[n * vertexCount + i] = newcoarse;
+                    boundaries[(n + 1) * vertexCount + i] = boundary;
+                }
+            }
+            taskCorrection[task] = correction;
+            taskConvergence[task] = convergence;
+        });
+
+        result.iterations = k + 1;
+        result.maxCorrection = 0.0f;
+        float convergence = 0.0f;
+        for (unsigned int task = 0; task < taskCount; task++)
+        {
+            result.maxCorrection = max(result.maxCorrection, taskCorrection[task]);
+            convergence = max(convergence, taskConvergence[task]);
+        }
+
+        if (convergence <= 1.0f)
+        {
+            break;
+        }
+    }
+
+    for (unsigned int i = 0; i < vertexCount; i++)
+    {
+        positions[i] = boundaries[segmentCount * vertexCount + i];
+    }
+
+    return result;
+}
+
+INLINE PararealResult
+IntegrateKelvinletStroke_Parareal(ThreadPool& pool, vec3* positions, unsigned int vertexCount, float maxerror,
+                                  const Kelvinlet* kelvinlets, unsigned int frameCount, unsigned int segmentCount = 0)
+{
+    return IntegrateKelvinletStroke_Parareal(pool, positions, vertexCount, uniformToleranceField(maxerror), kelvinlets, frameCount, segmentCount);
+}
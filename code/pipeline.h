@@ -0,0 +1,268 @@
+// Copyright(c) Facebook, Inc. and its affiliates.
+// All rights reserved.
+//
+// This source code is licensed under the BSD - style license found in the
+// LICENSE file in the root directory of this source tree.
+
+#pragma once
+
+///////////////////////////////////////////////////////
+// A pipeline for applying strokes to many meshes offline
+//
+// Applying a stroke to a mesh is a chain of steps: load the mesh and
+// the stroke, build the Kelvinlets, deform, compute normals, and write
+// the result. Done one job after the other, the CPU idles while the
+// disk is busy and the other way around. Pipeline runs every stage on
+// its own thread(s), connected by small bounded queues, so that loading
+// job N+1, deforming job N, and writing job N-1 overlap. The bounded
+// queues keep a fast stage from running far ahead and holding many
+// meshes in memory.
+//
+// Each stage keeps counters (jobs, and time spent working, waiting for
+// input, and waiting for room in the next queue) that can be read while
+// the pipeline runs, to find the stage that limits the throughput.
+///////////////////////////////////////////////////////
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A queue that blocks push() while it is full and pop() while it is empty
+template <typename T>
+class BoundedQueue
+{
+public:
+    explicit BoundedQueue(unsigned int capacity) : capacity(max((int)capacity, 1)) {}
+
+    // returns false if the queue was closed
+    bool push(T item)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        notFull.wait(lock, [this]() { return closed || items.size() < capacity; });
+        if (closed)
+        {
+            return false;
+        }
+        items.push_back(std::move(item));
+        notEmpty.notify_one();
+        return true;
+    }
+
+    // returns false once the queue is closed and empty
+    bool pop(T& item)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        notEmpty.wait(lock, [this]() { return closed || !items.empty(); });
+        if (items.empty())
+        {
+            return false;
+        }
+        item = std::move(items.front());
+        items.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+
+    // wakes everyone up; the items that are still queued can be popped
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        notFull.notify_all();
+        notEmpty.notify_all();
+    }
+
+private:
+    unsigned int            capacity;
+    std::deque<T>           items;
+    std::mutex              mutex;
+    std::condition_variable notFull;
+    std::condition_variable notEmpty;
+    bool                    closed = false;
+};
+
+// The counters of a stage. Throughput is jobs / (the time the pipeline ran).
+struct PipelineStageStats
+{
+    const char* name;
+    unsigned int jobs;
+    double busySeconds;     // running the stage
+    double starvedSeconds;  // waiting for the previous stage
+    double blockedSeconds;  // waiting for room in the next stage's queue
+};
+
+// Job is moved from stage to stage; every stage changes it in place.
+template <typename Job>
+class Pipeline
+{
+public:
+    // source(job) fills in the next job, and returns false when there are no more.
+    // queueCapacity is the number of jobs that can wait between two stages.
+    Pipeline(const char* sourceName, std::function<bool(Job&)> source, unsigned int queueCapacity = 2)
+        : queueCapacity(queueCapacity)
+    {
+        addStage(sourceName, nullptr, 1);
+        this->source = std::move(source);
+    }
+
+    Pipeline(const Pipeline&) = delete;
+    Pipeline& operator=(const Pipeline&) = delete;
+
+    // Stages run in the order they are added. A stage with more than one thread
+    // runs several jobs at once, so the jobs may leave it in a different order.
+    void addStage(const char* name, std::function<void(Job&)> fn, unsigned int threadCount = 1)
+    {
+        std::unique_ptr<Stage> stage(new Stage());
+        stage->name = name;
+        stage->fn = std::move(fn);
+        stage->threadCount = max((int)threadCount, 1);
+        stages.push_back(std::move(stage));
+    }
+
+    // Runs every job through every stage, and returns when the last one is done
+    void run()
+    {
+        // the queues and counters are all made before the first thread starts, so the vectors
+        // don't move while the threads use them. The last thread of a stage to finish closes
+        // the next queue.
+        std::vector<std::unique_ptr<BoundedQueue<Job>>> queues;
+        std::vector<std::unique_ptr<std::atomic<unsigned int>>> remaining;
+        for (size_t s = 1; s < stages.size(); s++)
+        {
+            queues.emplace_back(new BoundedQueue<Job>(queueCapacity));
+            remaining.emplace_back(new std::atomic<unsigned int>(stages[s]->threadCount));
+        }
+
+        start = Clock::now();
+        running = true;
+
+        std::vector<std::thread> threads;
+        threads.emplace_back([&]()
+        {
+            Stage& stage = *stages[0];
+            for (;;)
+            {
+                Job job;
+                Clock::time_point t0 = Clock::now();
+                if (!source(job))
+                {
+                    break;
+                }
+                Clock::time_point t1 = Clock::now();
+                if (!queues.empty())
+                {
+                    queues[0]->push(std::move(job));
+                }
+                stage.add(stage.busy, t1 - t0);
+                stage.add(stage.blocked, Clock::now() - t1);
+                stage.jobs++;
+            }
+            if (!queues.empty())
+            {
+                queues[0]->close();
+            }
+        });
+
+        for (size_t s = 1; s < stages.size(); s++)
+        {
+            for (unsigned int t = 0; t < stages[s]->threadCount; t++)
+            {
+                threads.emplace_back([&, s]()
+                {
+                    Stage& stage = *stages[s];
+                    BoundedQueue<Job>& input = *queues[s - 1];
+                    BoundedQueue<Job>* output = s < queues.size() ? queues[s].get() : nullptr;
+                    for (;;)
+                    {
+                        Job job;
+                        Clock::time_point t0 = Clock::now();
+                        if (!input.pop(job))
+                        {
+                            break;
+                        }
+                        Clock::time_point t1 = Clock::now();
+                        stage.fn(job);
+                        Clock::time_point t2 = Clock::now();
+                        if (output)
+                        {
+                            output->push(std::move(job));
+                        }
+                        stage.add(stage.starved, t1 - t0);
+                        stage.add(stage.busy, t2 - t1);
+                        stage.add(stage.blocked, Clock::now() - t2);
+                        stage.jobs++;
+                    }
+                    if (--*remaining[s - 1] == 0 && output)
+                    {
+                        output->close();
+                    }
+                });
+            }
+        }
+
+        for (std::thread& thread : threads)
+        {
+            thread.join();
+        }
+
+        elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+        running = false;
+    }
+
+    unsigned int stageCount() const { return (unsigned int)stages.size(); }
+
+    // Stage 0 is the source. This may be called while the pipeline runs.
+    PipelineStageStats stageStats(unsigned int stage) const
+    {
+        const Stage& s = *stages[stage];
+        PipelineStageStats stats;
+        stats.name = s.name;
+        stats.jobs = s.jobs;
+        stats.busySeconds = s.busy * 1e-9;
+        stats.starvedSeconds = s.starved * 1e-9;
+        stats.blockedSeconds = s.blocked * 1e-9;
+        return stats;
+    }
+
+    // the time the pipeline has run so far, or the time the last run() took
+    double elapsedSeconds() const
+    {
+        if (running)
+        {
+            return std::chrono::duration<double>(Clock::now() - start).count();
+        }
+        return elapsed * 1e-9;
+    }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Stage
+    {
+        const char*                     name;
+        std::function<void(Job&)>       fn;
+        unsigned int                    threadCount;
+        std::atomic<unsigned int>       jobs{0};
+        std::atomic<long long>          busy{0};     // nanoseconds
+        std::atomic<long long>          starved{0};  // nanoseconds
+        std::atomic<long long>          blocked{0};  // nanoseconds
+
+        void add(std::atomic<long long>& counter, Clock::duration duration)
+        {
+            counter += std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+        }
+    };
+
+    std::vector<std::unique_ptr<Stage>> stages;
+    std::function<bool(Job&)>           source;
+    unsigned int                        queueCapacity;
+    Clock::time_point                   start;
+    std::atomic<bool>                   running{false};
+    long long                           elapsed = 0;
+};
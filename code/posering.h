@@ -0,0 +1,254 @@
+// Copyright(c) Facebook, Inc. and its affiliates.
+// All rights reserved.
+//
+// This source code is licensed under the BSD - style license found in the
+// LICENSE file in the root directory of this source tree.
+
+#pragma once
+
+///////////////////////////////////////////////////////
+// Taking poses from the tracking thread
+//
+// When the poses are read in the render loop, the deformation only sees
+// one pose per frame, and the render thread waits for the deformation.
+// PoseRing is a lock-free ring of poses between one producer (a tracking
+// thread that reads the controller at the rate of its sensor, or a
+// recorded stroke played back) and one consumer. Neither side ever waits
+// for the other: push() fails when the ring is full, and pop() fails
+// when it is empty.
+//
+// PoseStreamDeformer is the consumer. Its own thread drains the ring,
+// builds the motion from every pose to the next, and deforms the mesh
+// with all the motions it drained at once, one after the other for every
+// vertex. So the deformation keeps up with the tracking when there are
+// more poses than it can deform one by one, and the results are the same
+// as deforming every motion in turn. The positions it publishes can be
+// copied from any thread at any time.
+//
+// Include threadpool.h and meshdeformer.h (for deformMesh()) first.
+///////////////////////////////////////////////////////
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// How long the deformation thread sleeps when there are no poses
+#define POSERING_IDLE_MICROSECONDS 100
+
+// A ring of poses for one producer thread and one consumer thread
+class PoseRing
+{
+public:
+    // capacity is rounded up to a power of two
+    explicit PoseRing(unsigned int capacity)
+    {
+        unsigned int size = 1;
+        while (size < capacity)
+        {
+            size *= 2;
+        }
+        poses.resize(size);
+        mask = size - 1;
+    }
+
+    PoseRing(const PoseRing&) = delete;
+    PoseRing& operator=(const PoseRing&) = delete;
+
+    // Called by the producer only. Returns false if the ring is full.
+    bool push(const Pose& pose)
+    {
+        unsigned int t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) > mask)
+        {
+            return false;
+        }
+        poses[t & mask] = pose;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Called by the consumer only. Returns false if the ring is empty.
+    bool pop(Pose& pose)
+    {
+        unsigned int h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire))
+        {
+            return false;
+        }
+        pose = poses[h & mask];
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Called by the consumer only. Appends every pose in the ring to out, and returns how many.
+    unsigned int drain(std::vector<Pose>& out)
+    {
+        unsigned int h = head.load(std::memory_order_relaxed);
+        unsigned int t = tail.load(std::memory_order_acquire);
+        for (unsigned int i = h; i != t; i++)
+        {
+            out.push_back(poses[i & mask]);
+        }
+        head.store(t, std::memory_order_release);
+        return t - h;
+    }
+
+    unsigned int capacity() const { return mask + 1; }
+
+private:
+    std::vector<Pose> poses;
+    unsigned int      mask;
+
+    // head and tail count up forever, and are apart so the threads don't share a cache line
+    alignas(64) std::atomic<unsigned int> head{ 0 };  // the next pose to pop
+    alignas(64) std::atomic<unsigned int> tail{ 0 };  // the next slot to push
+};
+
+struct PoseStreamStats
+{
+    unsigned int poses;     // the poses drained from the ring
+    unsigned int motions;   // the motions the mesh is deformed with
+    unsigned int batches;   // the passes over the mesh
+    unsigned int maxBatch;  // the most motions in a single pass
+};
+
+class PoseStreamDeformer
+{
+public:
+    // solverFor(motion) returns the solver of a motion
+    typedef std::function<MeshSolver(const Motion&)> SolverForMotion;
+
+    // The thread starts draining ring right away. threadCount of 0 uses
+    // backgroundThreadCount().
+    PoseStreamDeformer(PoseRing& ring, const vec3* positions, unsigned int vertexCount, const SolverForMotion& solverFor, unsigned int threadCount = 0)
+        : ring(ring), positions(positions, positions + vertexCount), published(positions, positions + vertexCount), solverFor(solverFor)
+    {
+        if (threadCount == 0)
+        {
+            threadCount = backgroundThreadCount();
+        }
+        pool.reset(new ThreadPool(threadCount));
+        worker = std::thread([this]() { run(); });
+    }
+
+    ~PoseStreamDeformer()
+    {
+        stop();
+    }
+
+    PoseStreamDeformer(const PoseStreamDeformer&) = delete;
+    PoseStreamDeformer& operator=(const PoseStreamDeformer&) = delete;
+
+    // Deforms with the poses left in the ring, and stops the thread. Call it once the producer
+    // has pushed its last pose.
+    void stop()
+    {
+        stopping = true;
+        if (worker.joinable())
+        {
+            worker.join();
+        }
+    }
+
+    // Copies the positions of the last pass over the mesh. Can be called from any thread.
+    void copyPositions(std::vector<vec3>& out) const
+    {
+        std::lock_guard<std::mutex> lock(publishMutex);
+        out = published;
+    }
+
+    // The positions, once stop() returned
+    const vec3* currentPositions() const { return positions.data(); }
+
+    PoseStreamStats getStats() const
+    {
+        std::lock_guard<std::mutex> lock(publishMutex);
+        return stats;
+    }
+
+private:
+    void run()
+    {
+        std::vector<Pose> poses;
+        std::vector<MeshSolver> solvers;
+        for (;;)
+        {
+            // read stopping first, so the poses pushed before stop() are drained
+            bool last = stopping;
+            poses.clear();
+            unsigned int drained = ring.drain(poses);
+
+            solvers.clear();
+            for (const Pose& pose : poses)
+            {
+                if (!started)
+                {
+                    started = true;
+                    previous = pose;
+                    continue;
+                }
+                if (pose.time <= previous.time)
+                {
+                    continue;
+                }
+                solvers.push_back(solverFor(buildMotion(previous, pose)));
+                previous = pose;
+            }
+
+            if (!solvers.empty())
+            {
+                deform(solvers);
+            }
+
+            if (drained > 0)
+            {
+                std::lock_guard<std::mutex> lock(publishMutex);
+                if (!solvers.empty())
+                {
+                    published = positions;
+                    stats.batches++;
+                    stats.maxBatch = max((int)stats.maxBatch, (int)solvers.size());
+                }
+                stats.poses += drained;
+                stats.motions += (unsigned int)solvers.size();
+            }
+            else if (last)
+            {
+                return;
+            }
+            else
+            {
+                std::this_thread::sleep_for(std::chrono::microseconds(POSERING_IDLE_MICROSECONDS));
+            }
+        }
+    }
+
+    // Deforms every vertex with every solver, in order
+    void deform(const std::vector<MeshSolver>& solvers)
+    {
+        deformMesh(*pool, positions.data(), (unsigned int)positions.size(), [&](vec3 p)
+        {
+            for (const MeshSolver& solver : solvers)
+            {
+                p = solver(p);
+            }
+            return p;
+        });
+    }
+
+    PoseRing&                   ring;
+    std::vector<vec3>           positions;    // deformed by the thread
+    std::vector<vec3>           published;    // the positions of the last pass
+    SolverForMotion             solverFor;
+    std::unique_ptr<ThreadPool> pool;
+    std::thread                 worker;
+    std::atomic<bool>           stopping{ false };
+    mutable std::mutex          publishMutex;
+    bool                        started = false;
+    Pose                        previous;     // the last pose a motion starts from
+    PoseStreamStats             stats = {};
+};
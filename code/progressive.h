@@ -0,0 +1,155 @@
+// Copyright(c) Facebook, Inc. and its affiliates.
+// All rights reserved.
+//
+// This source code is licensed under the BSD - style license found in the
+// LICENSE file in the root directory of this source tree.
+
+#pragma once
+
+///////////////////////////////////////////////////////
+// Progressive refinement for interactive drags
+//
+// While the user drags, the mesh has to follow the tool with as little
+// latency as possible, but when the user holds still, it should settle
+// on the accurate answer. ProgressiveDeformer deforms the mesh with a
+// cheap preview solver (a single _RungeKutta step, say) as soon as the
+// pose changes, and then refines it with an accurate solver (an
+// _Adaptive* one) on background threads, one tile at a time. Every tile
+// is published as soon as it is refined. When the pose changes again,
+// the refinement of the old pose is cancelled, and the tiles it hasn't
+// published yet are never published.
+//
+// Needs ThreadPool and deformMesh(), from threadpool.h and meshdeformer.h.
+///////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// The number of vertices that are refined and published together
+#define PROGRESSIVE_TILE_VERTICES 256
+
+class ProgressiveDeformer
+{
+public:
+    // rest are the positions before the move, and must stay valid. refineThreads of 0 uses
+    // backgroundThreadCount(), which leaves a hardware thread for the preview.
+    ProgressiveDeformer(const vec3* rest, unsigned int vertexCount, unsigned int refineThreads = 0)
+        : rest(rest), vertexCount(vertexCount), positions(rest, rest + vertexCount), preview(vertexCount)
+    {
+        if (refineThreads == 0)
+        {
+            refineThreads = backgroundThreadCount();
+        }
+        refinePool.reset(new ThreadPool(refineThreads));
+    }
+
+    ~ProgressiveDeformer()
+    {
+        cancel();
+    }
+
+    ProgressiveDeformer(const ProgressiveDeformer&) = delete;
+    ProgressiveDeformer& operator=(const ProgressiveDeformer&) = delete;
+
+    // Starts a new pose: cancels the refinement of the previous pose, publishes the preview of
+    // the new pose, and starts refining it in the background
+    void update(ThreadPool& pool, const MeshSolver& previewSolver, const MeshSolver& refineSolver)
+    {
+        cancel();
+
+        deformMesh(pool, rest, preview.data(), vertexCount, previewSolver);
+        {
+            std::lock_guard<std::mutex> lock(publishMutex);
+            positions.swap(preview);
+            refined = 0;
+        }
+
+        solver = refineSolver;
+        unsigned int current = generation;
+        refiner = std::thread([this, current]()
+        {
+            refinePool->parallelFor(0, tileCount(), [&](unsigned int tile)
+            {
+                refineTile(tile, current);
+            });
+        });
+    }
+
+    // Copies the latest published positions
+    void read(vec3* out)
+    {
+        std::lock_guard<std::mutex> lock(publishMutex);
+        std::copy(positions.begin(), positions.end(), out);
+    }
+
+    // Waits until the current pose is refined
+    void wait()
+    {
+        if (refiner.joinable())
+        {
+            refiner.join();
+        }
+    }
+
+    unsigned int tileCount() const { return (vertexCount + PROGRESSIVE_TILE_VERTICES - 1) / PROGRESSIVE_TILE_VERTICES; }
+
+    // The tiles of the current pose that are refined so far
+    unsigned int refinedTiles() const { return refined; }
+
+    // The tiles that were being refined, or not refined yet, when their pose changed
+    unsigned int cancelledTiles() const { return cancelled; }
+
+private:
+    // Stops the refinement of the current pose, and waits for the tiles in flight to give up
+    void cancel()
+    {
+        {
+            std::lock_guard<std::mutex> lock(publishMutex);
+            generation++;
+        }
+        wait();
+    }
+
+    void refineTile(unsigned int tile, unsigned int current)
+    {
+        unsigned int first = tile * PROGRESSIVE_TILE_VERTICES;
+        unsigned int last = min((int)(first + PROGRESSIVE_TILE_VERTICES), (int)vertexCount);
+
+        vec3 refinedPositions[PROGRESSIVE_TILE_VERTICES];
+        for (unsigned int i = first; i < last; i++)
+        {
+            if (generation != current)
+            {
+                cancelled++;
+                return;
+            }
+            refinedPositions[i - first] = solver(rest[i]);
+        }
+
+        std::lock_guard<std::mutex> lock(publishMutex);
+        if (generation != current)
+        {
+            cancelled++;
+            return;
+        }
+        std::copy(refinedPositions, refinedPositions + (last - first), positions.begin() + first);
+        refined++;
+    }
+
+    const vec3*                 rest;
+    unsigned int                vertexCount;
+    std::vector<vec3>           positions;  // the published positions
+    std::vector<vec3>           preview;
+    MeshSolver                  solver;     // the refine solver of the current pose
+    std::unique_ptr<ThreadPool> refinePool;
+    std::thread                 refiner;
+    std::mutex                  publishMutex;
+    std::atomic<unsigned int>   generation{ 0 };
+    std::atomic<unsigned int>   refined{ 0 };
+    std::atomic<unsigned int>   cancelled{ 0 };
+};
@@ -0,0 +1,264 @@
+// Copyright(c) Facebook, Inc. and its affiliates.
+// All rights reserved.
+//
+// This source code is licensed under the BSD - style license found in the
+// LICENSE file in the root directory of this source tree.
+
+#pragma once
+
+///////////////////////////////////////////////////////
+// Previewing strokes on a coarse proxy of the mesh
+//
+// Kelvinlets are smooth at the scale of the brush, so on a dense sculpt
+// most of the integrations compute nearly the same motion as their
+// neighbours. ProxyDeformer clusters the vertices in the cells of a
+// uniform grid, and picks the vertex nearest to the middle of every
+// cluster as a proxy vertex. Every vertex is bound to the nearest proxy
+// vertices in the cells around it, with radial basis weights.
+//
+// While a stroke is previewed, only the proxy vertices are integrated,
+// along with three points around each of them, a fraction of a cell away
+// in x, y and z. Those points give the deformation gradient of the flow
+// at the proxy vertex, so a proxy vertex moves the vertices bound to it
+// as the flow would, to first order: it carries their offset from it
+// along, stretched and rotated. Every vertex is the weighted sum of where
+// its proxy vertices carry it, in a parallel gather. So the preview
+// costs about four integrations per proxy vertex, not one per vertex,
+// and stays close even where the stroke stretches the mesh a lot.
+// commit() integrates every vertex with the solvers of the stroke, in
+// order, for the exact positions, and binds the proxy to them for the
+// next stroke.
+//
+// The preview and the binding run on deformMesh() and forEachMeshChunk(), so
+// include threadpool.h and meshdeformer.h first.
+///////////////////////////////////////////////////////
+
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+// The number of proxy vertices a vertex is bound to
+#define PROXYMESH_BINDING_COUNT 4
+
+// Keeps the weight of a proxy vertex finite at the proxy vertex itself, as a fraction of the cell size
+#define PROXYMESH_EPSILON 0.001f
+
+// How far the points that give the deformation gradient are from their proxy vertex, as a fraction
+// of the cell size
+#define PROXYMESH_GRADIENT_OFFSET 0.5f
+
+// The proxy vertices a vertex moves with, and how much. Unused weights are 0.
+struct ProxyBinding
+{
+    unsigned int proxies[PROXYMESH_BINDING_COUNT];
+    float        weights[PROXYMESH_BINDING_COUNT];
+};
+
+class ProxyDeformer
+{
+public:
+    // cellSize sets the size of the proxy: about one proxy vertex per cell the mesh touches.
+    // It should be a fraction of the inner radius of the brush.
+    ProxyDeformer(ThreadPool& pool, const vec3* positions, unsigned int vertexCount, float cellSize)
+        : cellSize(cellSize)
+    {
+        bind(pool, positions, vertexCount);
+    }
+
+    // Integrates the proxy vertices, and moves the preview positions with them
+    void preview(ThreadPool& pool, const MeshSolver& solver)
+    {
+        solvers.push_back(solver);
+        deformMesh(pool, proxyPositions.data(), (unsigned int)proxyPositions.size(), solver);
+
+        float offset = PROXYMESH_GRADIENT_OFFSET * cellSize;
+        deformMesh(pool, rest.data(), previewPositions.data(), (unsigned int)rest.size(), [&](vec3 restPosition, unsigned int i)
+        {
+            const ProxyBinding& binding = bindings[i];
+            vec3 position = vec3(0, 0, 0);
+            for (unsigned int k = 0; k < PROXYMESH_BINDING_COUNT; k++)
+            {
+                // the offset from the proxy vertex, times the deformation gradient at it
+                const vec3* proxy = &proxyPositions[binding.proxies[k] * 4];
+                vec3 d = (restPosition - proxyRest[binding.proxies[k]]) / offset;
+                vec3 carried = proxy[0] + (proxy[1] - proxy[0]) * d.x + (proxy[2] - proxy[0]) * d.y + (proxy[3] - proxy[0]) * d.z;
+                position = position + carried * binding.weights[k];
+            }
+            return position;
+        });
+    }
+
+    // Integrates every vertex of positions with the solvers previewed since the last commit, in
+    // order, and binds the proxy to the result. positions are usually the ones the proxy was
+    // bound to.
+    void commit(ThreadPool& pool, vec3* positions)
+    {
+        unsigned int vertexCount = (unsigned int)rest.size();
+        deformMesh(pool, positions, vertexCount, [&](vec3 p)
+        {
+            for (const MeshSolver& solver : solvers)
+            {
+                p = solver(p);
+            }
+            return p;
+        });
+        bind(pool, positions, vertexCount);
+    }
+
+    // Binds the proxy to positions, and forgets the previewed solvers
+    void bind(ThreadPool& pool, const vec3* positions, unsigned int vertexCount)
+    {
+        rest.assign(positions, positions + vertexCount);
+        previewPositions = rest;
+        solvers.clear();
+
+        // the clusters of the vertices, in the cells of the grid
+        std::unordered_map<unsigned long long, std::vector<unsigned int>> clusters;
+        for (unsigned int i = 0; i < vertexCount; i++)
+        {
+            Cell cell = cellOf(positions[i]);
+            clusters[gridKey(cell.x, cell.y, cell.z)].push_back(i);
+        }
+
+        // the proxy vertex of a cluster is its vertex nearest to its middle
+        proxyIndices.clear();
+        cells.clear();
+        for (const auto& cluster : clusters)
+        {
+            vec3 middle = vec3(0, 0, 0);
+            for (unsigned int i : cluster.second)
+            {
+                middle = middle + positions[i];
+            }
+            middle = middle / (float)cluster.second.size();
+
+            unsigned int nearest = cluster.second[0];
+            for (unsigned int i : cluster.second)
+            {
+                if (length(positions[i] - middle) < length(positions[nearest] - middle))
+                {
+                    nearest = i;
+                }
+            }
+            cells[cluster.first] = (unsigned int)proxyIndices.size();
+            proxyIndices.push_back(nearest);
+        }
+        proxyRest.resize(proxyIndices.size());
+        for (unsigned int p = 0; p < proxyIndices.size(); p++)
+        {
+            proxyRest[p] = positions[proxyIndices[p]];
+        }
+
+        // every proxy vertex is followed by its points in x, y and z
+        float offset = PROXYMESH_GRADIENT_OFFSET * cellSize;
+        proxyPositions.resize(proxyIndices.size() * 4);
+        for (unsigned int p = 0; p < proxyIndices.size(); p++)
+        {
+            proxyPositions[p * 4 + 0] = proxyRest[p];
+            proxyPositions[p * 4 + 1] = proxyRest[p] + vec3(offset, 0, 0);
+            proxyPositions[p * 4 + 2] = proxyRest[p] + vec3(0, offset, 0);
+            proxyPositions[p * 4 + 3] = proxyRest[p] + vec3(0, 0, offset);
+        }
+
+        // every vertex is bound to the nearest proxy vertices in the cells around it
+        bindings.resize(vertexCount);
+        forEachMeshChunk(pool, vertexCount, [&](unsigned int, unsigned int first, unsigned int last)
+        {
+            for (unsigned int i = first; i < last; i++)
+            {
+                bindVertex(positions[i], bindings[i]);
+            }
+        });
+    }
+
+    // The positions of the mesh, as the proxy moved them since the last bind
+    const vec3* currentPreview() const { return previewPositions.data(); }
+
+    unsigned int proxyVertexCount() const { return (unsigned int)proxyIndices.size(); }
+
+    // The vertex of the mesh that a proxy vertex is
+    unsigned int proxyVertex(unsigned int p) const { return proxyIndices[p]; }
+
+private:
+    struct Cell
+    {
+        int x, y, z;
+    };
+
+    Cell cellOf(vec3 position) const
+    {
+        return { (int)floor(position.x / cellSize), (int)floor(position.y / cellSize), (int)floor(position.z / cellSize) };
+    }
+
+    // Binds position to the nearest proxy vertices in its cell and the cells around it, with
+    // weights that fall off with the square of the distance
+    void bindVertex(vec3 position, ProxyBinding& binding) const
+    {
+        float distances[PROXYMESH_BINDING_COUNT];
+        unsigned int found = 0;
+        Cell cell = cellOf(position);
+        for (int z = cell.z - 1; z <= cell.z + 1; z++)
+        {
+            for (int y = cell.y - 1; y <= cell.y + 1; y++)
+            {
+                for (int x = cell.x - 1; x <= cell.x + 1; x++)
+                {
+                    auto proxy = cells.find(gridKey(x, y, z));
+                    if (proxy == cells.end())
+                    {
+                        continue;
+                    }
+
+                    // insert it in order of distance, and drop the farthest when they're all used
+                    float d = length(proxyRest[proxy->second] - position);
+                    unsigned int k = found < PROXYMESH_BINDING_COUNT ? found++ : PROXYMESH_BINDING_COUNT;
+                    while (k > 0 && distances[k - 1] > d)
+                    {
+                        if (k < PROXYMESH_BINDING_COUNT)
+                        {
+                            distances[k] = distances[k - 1];
+                            binding.proxies[k] = binding.proxies[k - 1];
+                        }
+                        k--;
+                    }
+                    if (k < PROXYMESH_BINDING_COUNT)
+                    {
+                        distances[k] = d;
+                        binding.proxies[k] = proxy->second;
+                    }
+                }
+            }
+        }
+
+        // the cell of the vertex always has a proxy vertex, so found is at least 1
+        float epsilon = PROXYMESH_EPSILON * cellSize;
+        float total = 0.0f;
+        for (unsigned int k = 0; k < PROXYMESH_BINDING_COUNT; k++)
+        {
+            binding.weights[k] = 0.0f;
+            if (k < found)
+            {
+                binding.weights[k] = 1.0f / (distances[k] * distances[k] + epsilon * epsilon);
+                total += binding.weights[k];
+            }
+            else
+            {
+                binding.proxies[k] = binding.proxies[0];
+            }
+        }
+        for (unsigned int k = 0; k < PROXYMESH_BINDING_COUNT; k++)
+        {
+            binding.weights[k] /= total;
+        }
+    }
+
+    float                                            cellSize;
+    std::vector<vec3>                                rest;              // the positions the proxy is bound to
+    std::vector<vec3>                                previewPositions;
+    std::vector<unsigned int>                        proxyIndices;      // the vertex of every proxy vertex
+    std::vector<vec3>                                proxyRest;
+    std::vector<vec3>                                proxyPositions;    // four per proxy vertex: the vertex, and its points in x, y and z
+    std::unordered_map<unsigned long long, unsigned int> cells;         // the proxy vertex of every cell
+    std::vector<ProxyBinding>                        bindings;
+    std::vector<MeshSolver>                          solvers;           // the solvers previewed since the last bind
+};
@@ -0,0 +1,362 @@
+// Copyright(c) Facebook, Inc. and its affiliates.
+// All rights reserved.
+//
+// This source code is licensed under the BSD - style license found in the
+// LICENSE file in the root directory of this source tree.
+
+#pragma once
+
+///////////////////////////////////////////////////////
+// Reference evaluators and solvers
+//
+// These are templated copies of the Kelvinlet and nonelastic evaluators
+// and of the solvers in odesolvers.h. Instantiated with double, they
+// are the ground truth that optimized code paths (and new solvers)
+// are compared against, so that an optimization can't silently change
+// the results. They follow the float code line by line, except that
+// the adaptive solvers measure error per step instead of per unit of
+// time, and allow much smaller steps.
+///////////////////////////////////////////////////////
+
+#include <cstring>
+
+// min()/max() in deformation.h are only defined for float and int
+template<typename T> T rmin(T a, T b) { return a < b ? a : b; }
+template<typename T> T rmax(T a, T b) { return a > b ? a : b; }
+
+template<typename T>
+struct tvec3
+{
+    tvec3() {};
+    explicit tvec3(T a) : x(a), y(a), z(a) {};
+    tvec3(T a, T b, T c) : x(a), y(b), z(c) {};
+    explicit tvec3(vec3 v) : x(v.x), y(v.y), z(v.z) {};
+
+    vec3 toVec3() const { return vec3((float)x, (float)y, (float)z); }
+
+    T x, y, z;
+};
+
+template<typename T> tvec3<T> operator*(tvec3<T> a, T b) { return tvec3<T>(a.x * b, a.y * b, a.z * b); }
+template<typename T> tvec3<T> operator*(T a, tvec3<T> b) { return tvec3<T>(b.x * a, b.y * a, b.z * a); }
+template<typename T> tvec3<T> operator/(tvec3<T> a, T b) { return tvec3<T>(a.x / b, a.y / b, a.z / b); }
+template<typename T> tvec3<T> operator+(tvec3<T> a, tvec3<T> b) { return tvec3<T>(a.x + b.x, a.y + b.y, a.z + b.z); }
+template<typename T> tvec3<T> operator-(tvec3<T> a, tvec3<T> b) { return tvec3<T>(a.x - b.x, a.y - b.y, a.z - b.z); }
+template<typename T> T dot(tvec3<T> a, tvec3<T> b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+template<typename T> T length(tvec3<T> v) { return sqrt(dot(v, v)); }
+
+// column major, the same as mat3x3
+template<typename T>
+struct tmat3x3
+{
+    tmat3x3() {};
+    tmat3x3(tvec3<T> vx, tvec3<T> vy, tvec3<T> vz) : cx(vx), cy(vy), cz(vz) {};
+    explicit tmat3x3(mat3x3 m) : cx(m.cx), cy(m.cy), cz(m.cz) {};
+
+    tvec3<T> cx, cy, cz;
+};
+
+template<typename T> tmat3x3<T> operator*(T a, tmat3x3<T> b) { return tmat3x3<T>(a * b.cx, a * b.cy, a * b.cz); }
+template<typename T> tmat3x3<T> operator+(tmat3x3<T> a, tmat3x3<T> b) { return tmat3x3<T>(a.cx + b.cx, a.cy + b.cy, a.cz + b.cz); }
+template<typename T> tvec3<T> operator*(tmat3x3<T> a, tvec3<T> b) { return b.x * a.cx + b.y * a.cy + b.z * a.cz; }
+
+template<typename T>
+struct TKelvinlet
+{
+    tvec3<T>    origin;
+    tvec3<T>    linearVelocity;
+    tvec3<T>    forceVector;
+    tmat3x3<T>  twistForceMatrix;
+    tmat3x3<T>  scaleForceMatrix;
+    T           time;
+    T           dt;
+    T           radius;
+    T           stiffness;
+    T           compressibility;
+};
+
+template<typename T>
+struct TDeformation
+{
+    tvec3<T>    origin;
+    tvec3<T>    linearVelocity;
+    tmat3x3<T>  displacementGradientTensor;
+    T           time;
+    T           dt;
+};
+
+template<typename T>
+TKelvinlet<T> referenceKelvinlet(Kelvinlet kelvinlet)
+{
+    TKelvinlet<T> k;
+    k.origin = tvec3<T>(kelvinlet.origin);
+    k.linearVelocity = tvec3<T>(kelvinlet.linearVelocity);
+    k.forceVector = tvec3<T>(kelvinlet.forceVector);
+    k.twistForceMatrix = tmat3x3<T>(kelvinlet.twistForceMatrix);
+    k.scaleForceMatrix = tmat3x3<T>(kelvinlet.scaleForceMatrix);
+    k.time = kelvinlet.time;
+    k.dt = kelvinlet.dt;
+    k.radius = kelvinlet.radius;
+    k.stiffness = kelvinlet.stiffness;
+    k.compressibility = kelvinlet.compressibility;
+    return k;
+}
+
+template<typename T>
+TDeformation<T> referenceDeformation(Deformation deformation)
+{
+    TDeformation<T> d;
+    d.origin = tvec3<T>(deformation.origin);
+    d.linearVelocity = tvec3<T>(deformation.linearVelocity);
+    d.displacementGradientTensor = tmat3x3<T>(deformation.displacementGradientTensor);
+    d.time = deformation.time;
+    d.dt = deformation.dt;
+    return d;
+}
+
+///////////////////////////////////////////////////////
+// Evaluators (see kelvinlets.h and nonelastic.h)
+///////////////////////////////////////////////////////
+
+template<typename T>
+tvec3<T> RKTranslationInner(tvec3<T> R, tvec3<T> loadForceVector, T radius, T stiffness, T compressibility)
+{
+    T a = 1 / (4 * T(PI) * stiffness);
+    T b = a / (4 * (1 - compressibility));
+
+    T rnorm = length(R);
+    T re = sqrt(rnorm*rnorm + radius * radius);
+
+    T firstterm = (a - b) / re;
+    tvec3<T> secondterm = (b / (re*re*re) * dot(R, loadForceVector)) * R;
+    T thirdterm = (a * radius*radius) / (2 * re*re*re);
+
+    return firstterm*loadForceVector + secondterm + thirdterm*loadForceVector;
+}
+
+template<typename T>
+tvec3<T> RKTwistInner(tvec3<T> R, tmat3x3<T> loadForceMatrix, T radius, T stiffness)
+{
+    T a = 1 / (4 * T(PI) * stiffness);
+
+    T Rnorm = length(R);
+    T re = sqrt(Rnorm*Rnorm + radius * radius);
+
+    return (-a * (1 / (re*re*re) + 3 * radius*radius / (2 * re*re*re*re*re))) * (loadForceMatrix * R);
+}
+
+template<typename T>
+tvec3<T> RKScaleInner(tvec3<T> R, tmat3x3<T> loadForceMatrix, T radius, T stiffness, T compressibility)
+{
+    T a = 1 / (4 * T(PI) * stiffness);
+    T b = a / (4 * (1 - compressibility));
+
+    T Rnorm = length(R);
+    T re = sqrt(Rnorm*Rnorm + radius * radius);
+
+    return ((2 * b - a) * (1 / (re*re*re) + 3 * radius*radius / (2 * re*re*re*re*re))) * (loadForceMatrix * R);
+}
+
+template<typename T>
+tvec3<T> RKEvaluate(T t, tvec3<T> x, const TKelvinlet<T>& kelvinlet)
+{
+    tvec3<T> R = x - (kelvinlet.origin + kelvinlet.linearVelocity * (t - kelvinlet.time));
+
+    T radius0 = kelvinlet.radius;
+    tvec3<T> Kt = RKTranslationInner(R, kelvinlet.forceVector, radius0, kelvinlet.stiffness, kelvinlet.compressibility);
+    tvec3<T> Kr = RKTwistInner(R, kelvinlet.twistForceMatrix, radius0, kelvinlet.stiffness);
+    tvec3<T> Ks = RKScaleInner(R, kelvinlet.scaleForceMatrix, radius0, kelvinlet.stiffness, T(0));
+#if BISCALE_FALLOFF
+    T radius1 = kelvinlet.radius * T(BISCALE_RADIUS);
+    Kt = Kt - RKTranslationInner(R, kelvinlet.forceVector, radius1, kelvinlet.stiffness, kelvinlet.compressibility);
+    Kr = Kr - RKTwistInner(R, kelvinlet.twistForceMatrix, radius1, kelvinlet.stiffness);
+    Ks = Ks - RKScaleInner(R, kelvinlet.scaleForceMatrix, radius1, kelvinlet.stiffness, T(0));
+#endif
+    return Kt + Kr + Ks;
+}
+
+template<typename T>
+tvec3<T> RKEvaluateTwoDeformers(T t, tvec3<T> x, const TKelvinlet<T>& kelvinlet0, const TKelvinlet<T>& kelvinlet1)
+{
+    // like KEvaluateTwoDeformers(), both origins are advected from kelvinlet0's time
+    TKelvinlet<T> k1 = kelvinlet1;
+    k1.time = kelvinlet0.time;
+    return RKEvaluate(t, x, kelvinlet0) + RKEvaluate(t, x, k1);
+}
+
+template<typename T>
+tvec3<T> RNonElasticEvaluateODE(T t, tvec3<T> x, const TDeformation<T>& deformer)
+{
+    tvec3<T> R = x - (deformer.origin + deformer.linearVelocity * (t - deformer.time));
+    return deformer.linearVelocity + deformer.displacementGradientTensor * R;
+}
+
+template<typename T>
+tvec3<T> RNonElasticEvaluateODE_TwoDeformers(T t, tvec3<T> x, const TDeformation<T>& deformer0, const TDeformation<T>& deformer1)
+{
+    TDeformation<T> d1 = deformer1;
+    d1.time = deformer0.time;
+    return RNonElasticEvaluateODE(t, x, deformer0) + RNonElasticEvaluateODE(t, x, d1);
+}
+
+///////////////////////////////////////////////////////
+// Solvers (see odesolvers.h)
+// evaluate is any callable of the form tvec3<T> evaluate(T t, tvec3<T> x)
+///////////////////////////////////////////////////////
+
+template<typename T, typename Evaluate>
+tvec3<T> ReferenceRungeKuttaStep(T t, T dt, tvec3<T> x, const Evaluate& evaluate)
+{
+    tvec3<T> k1 = dt*evaluate(t, x);
+    tvec3<T> k2 = dt*evaluate(t + dt / 2, x + k1 / T(2));
+    tvec3<T> k3 = dt*evaluate(t + dt / 2, x + k2 / T(2));
+    tvec3<T> k4 = dt*evaluate(t + dt, x + k3);
+
+    return x + k1 / T(6) + k2 / T(3) + k3 / T(3) + k4 / T(6);
+}
+
+// A single RK4 step, like the SCOPE(_RungeKutta) solvers
+template<typename T, typename Evaluate>
+tvec3<T> ReferenceIntegrate_RungeKutta(tvec3<T> pos, T tstart, T tend, const Evaluate& evaluate)
+{
+    return ReferenceRungeKuttaStep(tstart, tend - tstart, pos, evaluate);
+}
+
+// Dormand-Prince 5(4) with local extrapolation, with the error of each step
+// (not per unit of time) kept under tolerance
+template<typename T, typename Evaluate>
+tvec3<T> ReferenceIntegrate_AdaptiveDP54(tvec3<T> pos, T tstart, T tend, T tolerance, const Evaluate& evaluate)
+{
+    const T b21 = T(1) / 5;
+    const T b31 = T(3) / 40, b32 = T(9) / 40;
+    const T b41 = T(44) / 45, b42 = T(-56) / 15, b43 = T(32) / 9;
+    const T b51 = T(19372) / 6561, b52 = T(-25360) / 2187, b53 = T(64448) / 6561, b54 = T(-212) / 729;
+    const T b61 = T(9017) / 3168, b62 = T(-355) / 33, b63 = T(46732) / 5247, b64 = T(49) / 176, b65 = T(-5103) / 18656;
+    const T c1 = T(35) / 384, c3 = T(500) / 1113, c4 = T(125) / 192, c5 = T(-2187) / 6784, c6 = T(11) / 84;
+    const T d1 = T(5179) / 57600, d3 = T(7571) / 16695, d4 = T(393) / 640, d5 = T(-92097) / 339200, d6 = T(187) / 2100, d7 = T(1) / 40;
+
+    T span = tend - tstart;
+    T minimumdt = span * T(1e-9);
+    T t = tstart;
+    T dt = span * T(ADAPTIVE_INTEGRATOR_INITIAL_DT);
+    while (t < tend)
+    {
+        dt = rmin(dt, tend - t);
+
+        tvec3<T> k1 = dt*evaluate(t, pos);
+        tvec3<T> k2 = dt*evaluate(t + dt / 5, pos + k1*b21);
+        tvec3<T> k3 = dt*evaluate(t + dt * T(3) / 10, pos + k1*b31 + k2*b32);
+        tvec3<T> k4 = dt*evaluate(t + dt * T(4) / 5, pos + k1*b41 + k2*b42 + k3*b43);
+        tvec3<T> k5 = dt*evaluate(t + dt * T(8) / 9, pos + k1*b51 + k2*b52 + k3*b53 + k4*b54);
+        tvec3<T> k6 = dt*evaluate(t + dt, pos + k1*b61 + k2*b62 + k3*b63 + k4*b64 + k5*b65);
+        tvec3<T> fifthorder = pos + k1*c1 + k3*c3 + k4*c4 + k5*c5 + k6*c6;
+        tvec3<T> k7 = dt*evaluate(t + dt, fifthorder);
+        tvec3<T> fourthorder = pos + k1*d1 + k3*d3 + k4*d4 + k5*d5 + k6*d6 + k7*d7;
+
+        T error = length(fifthorder - fourthorder);
+        T newdt = error > 0 ? dt * T(0.9) * pow(tolerance / error, T(0.2)) : dt * 5;
+        newdt = rmin(rmax(newdt, dt / 5), dt * 5);
+
+        if (error <= tolerance || dt <= minimumdt)
+        {
+            pos = fifthorder;    // local extrapolation
+            t += dt;
+            dt = newdt;
+        }
+        else
+        {
+            dt = rmax(newdt, minimumdt);
+        }
+    }
+
+    return pos;
+}
+
+// The ground truth: Dormand-Prince in double precision, with a tolerance far
+// below the float solvers' maxerror
+#define REFERENCE_TOLERANCE 1e-12
+
+INLINE tvec3<double> ReferenceIntegrateKelvinlet(tvec3<double> pos, double tstart, double tend, const TKelvinlet<double>& kelvinlet)
+{
+    return ReferenceIntegrate_AdaptiveDP54(pos, tstart, tend, REFERENCE_TOLERANCE,
+        [&](double t, tvec3<double> x) { return RKEvaluate(t, x, kelvinlet); });
+}
+
+INLINE tvec3<double> ReferenceIntegrateKelvinletTwoDeformers(tvec3<double> pos, double tstart, double tend, const TKelvinlet<double>& kelvinlet0, const TKelvinlet<double>& kelvinlet1)
+{
+    return ReferenceIntegrate_AdaptiveDP54(pos, tstart, tend, REFERENCE_TOLERANCE,
+        [&](double t, tvec3<double> x) { return RKEvaluateTwoDeformers(t, x, kelvinlet0, kelvinlet1); });
+}
+
+INLINE tvec3<double> ReferenceIntegrateNonElastic(tvec3<double> pos, double tstart, double tend, const TDeformation<double>& deformer)
+{
+    return ReferenceIntegrate_AdaptiveDP54(pos, tstart, tend, REFERENCE_TOLERANCE,
+        [&](double t, tvec3<double> x) { return RNonElasticEvaluateODE(t, x, deformer); });
+}
+
+INLINE tvec3<double> ReferenceIntegrateNonElasticTwoDeformers(tvec3<double> pos, double tstart, double tend, const TDeformation<double>& deformer0, const TDeformation<double>& deformer1)
+{
+    return ReferenceIntegrate_AdaptiveDP54(pos, tstart, tend, REFERENCE_TOLERANCE,
+        [&](double t, tvec3<double> x) { return RNonElasticEvaluateODE_TwoDeformers(t, x, deformer0, deformer1); });
+}
+
+///////////////////////////////////////////////////////
+// Comparing results against the reference
+///////////////////////////////////////////////////////
+
+struct EquivalenceStats
+{
+    double       maxError;   // world space distance
+    double       rmsError;
+    unsigned int maxUlps;    // per component, against the reference rounded to float
+    double       meanUlps;
+    unsigned int count;
+};
+
+// distance between two floats in units in the last place
+INLINE unsigned int ulpDistance(float a, float b)
+{
+    int ia, ib;
+    memcpy(&ia, &a, 4);
+    memcpy(&ib, &b, 4);
+    // map the sign-magnitude bit patterns onto a monotonic integer line
+    long long la = ia < 0 ? (long long)0x80000000 - (long long)(ia & 0x7fffffff) : (long long)0x80000000 + ia;
+    long long lb = ib < 0 ? (long long)0x80000000 - (long long)(ib & 0x7fffffff) : (long long)0x80000000 + ib;
+    long long d = la > lb ? la - lb : lb - la;
+    return d > 0xffffffffLL ? 0xffffffffu : (unsigned int)d;
+}
+
+INLINE EquivalenceStats compareToReference(const vec3* results, const tvec3<double>* reference, unsigned int count)
+{
+    EquivalenceStats stats;
+    stats.maxError = 0;
+    stats.rmsError = 0;
+    stats.maxUlps = 0;
+    stats.meanUlps = 0;
+    stats.count = count;
+
+    double sumsquared = 0;
+    double sumulps = 0;
+    for (unsigned int i = 0; i < count; i++)
+    {
+        tvec3<double> r = reference[i];
+        double error = length(tvec3<double>(results[i]) - r);
+        stats.maxError = rmax(stats.maxError, error);
+        sumsquared += error * error;
+
+        vec3 rounded = r.toVec3();
+        unsigned int ulps[3] = { ulpDistance(results[i].x, rounded.x), ulpDistance(results[i].y, rounded.y), ulpDistance(results[i].z, rounded.z) };
+        for (int j = 0; j < 3; j++)
+        {
+            stats.maxUlps = ulps[j] > stats.maxUlps ? ulps[j] : stats.maxUlps;
+            sumulps += ulps[j];
+        }
+    }
+
+    if (count > 0)
+    {
+        stats.rmsError = sqrt(sumsquared / count);
+        stats.meanUlps = sumulps / (3.0 * count);
+    }
+    return stats;
+}
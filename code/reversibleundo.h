@@ -0,0 +1,187 @@
+// Copyright(c) Facebook, Inc. and its affiliates.
+// All rights reserved.
+//
+// This source code is licensed under the BSD - style license found in the
+// LICENSE file in the root directory of this source tree.
+
+#pragma once
+
+///////////////////////////////////////////////////////
+// Undoing strokes by integrating them backward
+//
+// Kelvinlets are invertible: integrating a stroke backward, from the end
+// of its last frame to the start of its first frame, returns the vertices
+// to where they were before the stroke, up to the error of the solver.
+// So undoing a stroke only needs its Kelvinlets, not a copy of the mesh.
+//
+// ReversibleUndo applies strokes of Kelvinlets with a single RK4 step per
+// frame, like test 6, and checks the round trip of every stroke on a
+// sample of the vertices: evenly spaced vertices, and the vertex that the
+// stroke moved the most in every tile. When the round trip is within the
+// tolerance, only the Kelvinlets are kept; otherwise, the positions from
+// before the stroke are kept, and undo restores them exactly.
+//
+// Include threadpool.h and meshdeformer.h first.
+///////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <vector>
+
+// The number of evenly spaced vertices whose round trip is checked
+#define REVERSIBLEUNDO_SAMPLES 256
+
+// The number of vertices in a tile. The vertex that moves the most in every tile is checked too.
+#define REVERSIBLEUNDO_TILE_VERTICES 256
+
+// Undoes a single RK4 step for each frame in [firstFrame, endFrame), last frame first
+INLINE vec3
+IntegrateKelvinletStroke_RungeKuttaBackward(vec3 pos, const Kelvinlet* kelvinlets, unsigned int firstFrame, unsigned int endFrame)
+{
+    for (unsigned int frame = endFrame; frame > firstFrame; frame--)
+    {
+        pos = IntegrateKelvinlets_RungeKuttaBackward(pos, kelvinlets[frame - 1].time, kelvinlets[frame - 1].time + kelvinlets[frame - 1].dt, kelvinlets[frame - 1]);
+    }
+    return pos;
+}
+
+class ReversibleUndo
+{
+public:
+    // tolerance is the largest round trip error of a vertex that undo can leave
+    explicit ReversibleUndo(float tolerance)
+        : tolerance(tolerance)
+    {
+    }
+
+    // Deforms positions with every Kelvinlet of a stroke, in order, and remembers how to undo it.
+    // Returns whether the stroke can be undone by integrating it backward.
+    bool apply(ThreadPool& pool, vec3* positions, unsigned int vertexCount, const Kelvinlet* kelvinlets, unsigned int kelvinletCount)
+    {
+        // integrate every vertex, and find the one that moves the most in every tile
+        unsigned int tileCount = (vertexCount + REVERSIBLEUNDO_TILE_VERTICES - 1) / REVERSIBLEUNDO_TILE_VERTICES;
+        moved.resize(vertexCount);
+        farthest.resize(tileCount);
+        pool.parallelFor(0, tileCount, [&](unsigned int tile)
+        {
+            unsigned int first = tile * REVERSIBLEUNDO_TILE_VERTICES;
+            unsigned int last = min((int)(first + REVERSIBLEUNDO_TILE_VERTICES), (int)vertexCount);
+            float farthestDistance = -1.0f;
+            for (unsigned int i = first; i < last; i++)
+            {
+                vec3 p = positions[i];
+                for (unsigned int frame = 0; frame < kelvinletCount; frame++)
+                {
+                    p = IntegrateKelvinlets_RungeKutta(p, kelvinlets[frame].time, kelvinlets[frame].time + kelvinlets[frame].dt, kelvinlets[frame]);
+                }
+                moved[i] = p;
+
+                float distance = dot(p - positions[i], p - positions[i]);
+                if (distance > farthestDistance)
+                {
+                    farthestDistance = distance;
+                    farthest[tile] = i;
+                }
+            }
+        });
+
+        // check the round trip of the samples
+        samples.assign(farthest.begin(), farthest.end());
+        unsigned int evenCount = min((int)REVERSIBLEUNDO_SAMPLES, (int)vertexCount);
+        for (unsigned int s = 0; s < evenCount; s++)
+        {
+            samples.push_back((unsigned int)((unsigned long long)s * vertexCount / evenCount));
+        }
+        errors.resize(samples.size());
+        pool.parallelFor(0, (unsigned int)samples.size(), [&](unsigned int s)
+        {
+            vec3 p = IntegrateKelvinletStroke_RungeKuttaBackward(moved[samples[s]], kelvinlets, 0, kelvinletCount);
+            errors[s] = length(p - positions[samples[s]]);
+        });
+        lastError = 0.0f;
+        for (float error : errors)
+        {
+            lastError = max(lastError, error);
+        }
+
+        Stroke stroke;
+        if (lastError <= tolerance)
+        {
+            stroke.kelvinlets.assign(kelvinlets, kelvinlets + kelvinletCount);
+        }
+        else
+        {
+            stroke.snapshot.assign(positions, positions + vertexCount);
+        }
+        strokes.push_back(std::move(stroke));
+
+        std::copy(moved.begin(), moved.end(), positions);
+        return lastError <= tolerance;
+    }
+
+    // Undoes the last stroke that is applied. Returns false if there isn't one.
+    bool undo(ThreadPool& pool, vec3* positions, unsigned int vertexCount)
+    {
+        if (strokes.empty())
+        {
+            return false;
+        }
+
+        const Stroke& stroke = strokes.back();
+        if (!stroke.snapshot.empty())
+        {
+            std::copy(stroke.snapshot.begin(), stroke.snapshot.end(), positions);
+        }
+        else
+        {
+            deformMesh(pool, positions, vertexCount, [&](vec3 position)
+            {
+                return IntegrateKelvinletStroke_RungeKuttaBackward(position, stroke.kelvinlets.data(), 0, (unsigned int)stroke.kelvinlets.size());
+            });
+        }
+        strokes.pop_back();
+        return true;
+    }
+
+    // The largest round trip error of the samples of the last stroke
+    float lastRoundTripError() const { return lastError; }
+
+    unsigned int strokeCount() const { return (unsigned int)strokes.size(); }
+
+    // The strokes that keep a copy of the positions
+    unsigned int snapshotCount() const
+    {
+        unsigned int count = 0;
+        for (const Stroke& stroke : strokes)
+        {
+            count += stroke.snapshot.empty() ? 0 : 1;
+        }
+        return count;
+    }
+
+    // The memory the undo history uses
+    size_t historyBytes() const
+    {
+        size_t bytes = 0;
+        for (const Stroke& stroke : strokes)
+        {
+            bytes += stroke.kelvinlets.size() * sizeof(Kelvinlet) + stroke.snapshot.size() * sizeof(vec3);
+        }
+        return bytes;
+    }
+
+private:
+    // A stroke keeps its Kelvinlets, or the positions from before it
+    struct Stroke
+    {
+        std::vector<Kelvinlet> kelvinlets;
+        std::vector<vec3>      snapshot;
+    };
+
+    float                     tolerance;
+    float                     lastError = 0.0f;
+    std::vector<Stroke>       strokes;
+    std::vector<vec3>         moved;
+    std::vector<unsigned int> farthest;  // the vertex that moves the most in every tile
+    std::vector<unsigned int> samples;
+    std::vector<float>        errors;
+};
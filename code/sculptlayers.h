@@ -0,0 +1,166 @@
+// Copyright(c) Facebook, Inc. and its affiliates.
+// All rights reserved.
+//
+// This source code is licensed under the BSD - style license found in the
+// LICENSE file in the root directory of this source tree.
+
+#pragma once
+
+///////////////////////////////////////////////////////
+// Sculpt layers with cached displacements
+//
+// Artists toggle and re-weight layers all the time, and replaying every
+// stroke of every layer from the base mesh each time takes seconds.
+// SculptLayerStack integrates the strokes of a layer once, and keeps
+// the result as a sparse displacement: the vertices it moved by more
+// than a threshold, and how much. Composing the layers is then a
+// weighted sparse add of the displacements to the base mesh.
+//
+// The strokes of a layer are integrated on top of the layers below it,
+// at full weight, so that weights and toggles never need integrating
+// again. A layer is integrated again only when its own strokes change,
+// or the strokes of a layer below it do.
+//
+// Layers are composed with deformMesh(): include threadpool.h and
+// meshdeformer.h first.
+///////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+class SculptLayerStack
+{
+public:
+    // Vertices that a layer moves by threshold or less aren't stored, so every layer adds
+    // up to threshold of error. maxerror (see README.md) keeps it invisible.
+    SculptLayerStack(const vec3* base, unsigned int vertexCount, float threshold)
+        : base(base, base + vertexCount), threshold(threshold)
+    {
+    }
+
+    // Adds a layer on top of the others, and returns its index
+    unsigned int addLayer(float weight = 1.0f)
+    {
+        layers.push_back(Layer());
+        layers.back().weight = weight;
+        return (unsigned int)layers.size() - 1;
+    }
+
+    // Adds a stroke on top of a layer, and returns its index in the layer
+    unsigned int addStroke(unsigned int layer, const MeshSolver& solver)
+    {
+        layers[layer].strokes.push_back(solver);
+        invalidate(layer);
+        return (unsigned int)layers[layer].strokes.size() - 1;
+    }
+
+    void removeStroke(unsigned int layer, unsigned int stroke)
+    {
+        layers[layer].strokes.erase(layers[layer].strokes.begin() + stroke);
+        invalidate(layer);
+    }
+
+    // Weights and toggles only change how the layers are composed
+    void setWeight(unsigned int layer, float weight) { layers[layer].weight = weight; }
+    void setEnabled(unsigned int layer, bool enabled) { layers[layer].enabled = enabled; }
+
+    // Integrates the layers that changed, and writes the base mesh plus the weighted
+    // displacements of the enabled layers to positions. Returns the number of layers
+    // that were integrated.
+    unsigned int compose(ThreadPool& pool, vec3* positions)
+    {
+        unsigned int integrated = 0;
+        if (firstDirty < layers.size())
+        {
+            // the layers below the first one that changed, at full weight
+            below = base;
+            for (unsigned int l = 0; l < firstDirty; l++)
+            {
+                addDisplacement(layers[l], 1.0f, below.data());
+            }
+
+            for (unsigned int l = firstDirty; l < layers.size(); l++)
+            {
+                integrate(pool, layers[l]);
+                addDisplacement(layers[l], 1.0f, below.data());
+                integrated++;
+            }
+            firstDirty = ~0u;
+        }
+
+        std::copy(base.begin(), base.end(), positions);
+        for (const Layer& layer : layers)
+        {
+            if (layer.enabled && layer.weight != 0.0f)
+            {
+                addDisplacement(layer, layer.weight, positions);
+            }
+        }
+        return integrated;
+    }
+
+    unsigned int layerCount() const { return (unsigned int)layers.size(); }
+
+    // The number of vertices a layer moves
+    unsigned int layerVertexCount(unsigned int layer) const { return (unsigned int)layers[layer].indices.size(); }
+
+private:
+    struct Layer
+    {
+        std::vector<MeshSolver>   strokes;
+        float                     weight = 1.0f;
+        bool                      enabled = true;
+        std::vector<unsigned int> indices;        // the vertices the layer moves
+        std::vector<vec3>         displacements;  // and how much
+    };
+
+    void invalidate(unsigned int layer)
+    {
+        if (layer < firstDirty)
+        {
+            firstDirty = layer;
+        }
+    }
+
+    // Integrates the strokes of a layer on top of the layers below it
+    void integrate(ThreadPool& pool, Layer& layer)
+    {
+        moved.resize(below.size());
+        deformMesh(pool, below.data(), moved.data(), (unsigned int)below.size(), [&](vec3 p)
+        {
+            for (const MeshSolver& stroke : layer.strokes)
+            {
+                p = stroke(p);
+            }
+            return p;
+        });
+
+        layer.indices.clear();
+        layer.displacements.clear();
+        for (unsigned int i = 0; i < below.size(); i++)
+        {
+            vec3 displacement = moved[i] - below[i];
+            if (dot(displacement, displacement) > threshold * threshold)
+            {
+                layer.indices.push_back(i);
+                layer.displacements.push_back(displacement);
+            }
+        }
+    }
+
+    static void addDisplacement(const Layer& layer, float weight, vec3* positions)
+    {
+        for (unsigned int k = 0; k < layer.indices.size(); k++)
+        {
+            positions[layer.indices[k]] = positions[layer.indices[k]] + layer.displacements[k] * weight;
+        }
+    }
+
+    std::vector<vec3>  base;
+    float              threshold;
+    std::vector<Layer> layers;
+    unsigned int       firstDirty = ~0u;  // the lowest layer that has to be integrated again
+    std::vector<vec3>  below;             // the layers below the one being integrated
+    std::vector<vec3>  moved;
+};
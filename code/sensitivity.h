@@ -0,0 +1,345 @@
+// Copyright(c) Facebook, Inc. and its affiliates.
+// All rights reserved.
+//
+// This source code is licensed under the BSD - style license found in the
+// LICENSE file in the root directory of this source tree.
+
+#pragma once
+
+///////////////////////////////////////////////////////
+// Forward sensitivity integration for the move tool
+//
+// While the user drags the second keyframe of a move, the end pose
+// changes by a tiny amount each frame, and every vertex is integrated
+// again from scratch. Here we integrate, alongside x(tend), the
+// derivative of x(tend) with respect to the motion parameters
+// (linear velocity, angular velocity and scale rate). On the next
+// frame, a vertex can then be moved with a first order update (a 3x7
+// matrix-vector multiply), and only the vertices whose predicted
+// linearization error is too large need to be integrated again.
+//
+// Include tolerance.h first.
+///////////////////////////////////////////////////////
+
+#include <vector>
+
+// 0-2 are the linear velocity, 3-5 are the angular velocity, and
+// 6 is the scale rate (the log of the scale factor per unit of time)
+#define SENSITIVITY_PARAMETERS 7
+
+struct MotionParameters
+{
+    float p[SENSITIVITY_PARAMETERS];
+};
+
+// dx/dp, stored as one column per motion parameter
+struct SensitivityMatrix
+{
+    vec3 column[SENSITIVITY_PARAMETERS];
+};
+
+struct KelvinletSensitivity
+{
+    vec3              position;
+    SensitivityMatrix dxdp;
+};
+
+INLINE SensitivityMatrix operator*(SensitivityMatrix s, float b)
+{
+    for (int i = 0; i < SENSITIVITY_PARAMETERS; i++)
+    {
+        s.column[i] = s.column[i] * b;
+    }
+    return s;
+}
+
+INLINE SensitivityMatrix operator+(SensitivityMatrix a, SensitivityMatrix b)
+{
+    for (int i = 0; i < SENSITIVITY_PARAMETERS; i++)
+    {
+        a.column[i] = a.column[i] + b.column[i];
+    }
+    return a;
+}
+
+INLINE vec3 operator*(SensitivityMatrix s, MotionParameters dp)
+{
+    vec3 result(0.0f);
+    for (int i = 0; i < SENSITIVITY_PARAMETERS; i++)
+    {
+        result = result + s.column[i] * dp.p[i];
+    }
+    return result;
+}
+
+INLINE SensitivityMatrix zeroSensitivityMatrix()
+{
+    SensitivityMatrix s;
+    for (int i = 0; i < SENSITIVITY_PARAMETERS; i++)
+    {
+        s.column[i] = vec3(0.0f);
+    }
+    return s;
+}
+
+// Recovers the motion parameters from a Kelvinlet by undoing the calibration
+// that buildKelvinlet() applied. The twist force matrix is skew symmetric, and
+// the scale force matrix is a uniform scale (see buildDeformation()).
+INLINE MotionParameters kelvinletMotionParameters(Kelvinlet kelvinlet)
+{
+    float twistCalibration = KTwistCalibrationFactor(kelvinlet.radius, kelvinlet.compressibility);
+    float scaleCalibration = KScaleCalibrationFactor(kelvinlet.radius, 0.0f);
+
+    MotionParameters parameters;
+    parameters.p[0] = kelvinlet.linearVelocity.x;
+    parameters.p[1] = kelvinlet.linearVelocity.y;
+    parameters.p[2] = kelvinlet.linearVelocity.z;
+    parameters.p[3] = kelvinlet.twistForceMatrix.cy.z / twistCalibration;
+    parameters.p[4] = kelvinlet.twistForceMatrix.cz.x / twistCalibration;
+    parameters.p[5] = kelvinlet.twistForceMatrix.cx.y / twistCalibration;
+    parameters.p[6] = kelvinlet.scaleForceMatrix.cx.x / scaleCalibration;
+    return parameters;
+}
+
+// Returns a copy of the Kelvinlet with its motion replaced by the given parameters.
+// The origin, time interval, and material are kept.
+INLINE Kelvinlet kelvinletWithMotionParameters(Kelvinlet kelvinlet, MotionParameters parameters)
+{
+    vec3 linearVelocity(parameters.p[0], parameters.p[1], parameters.p[2]);
+    vec3 angularVelocity(parameters.p[3], parameters.p[4], parameters.p[5]);
+
+    kelvinlet.linearVelocity = linearVelocity;
+    kelvinlet.forceVector = linearVelocity * KTranslationCalibrationFactor(kelvinlet.radius, kelvinlet.compressibility);
+    kelvinlet.twistForceMatrix = skewSymmetric(angularVelocity) * KTwistCalibrationFactor(kelvinlet.radius, kelvinlet.compressibility);
+    kelvinlet.scaleForceMatrix = identityMat3x3() * (parameters.p[6] * KScaleCalibrationFactor(kelvinlet.radius, 0.0f));
+    return kelvinlet;
+}
+
+// The deformation only depends on the motion integrated over the Kelvinlet's
+// time interval, so a Kelvinlet over [time, time+dt] is the same as a Kelvinlet
+// over the reference interval with its velocities scaled by dt/reference.dt.
+// This returns the parameters of kelvinlet, expressed on reference's interval.
+INLINE MotionParameters kelvinletMotionParametersOnInterval(Kelvinlet kelvinlet, Kelvinlet reference)
+{
+    MotionParameters parameters = kelvinletMotionParameters(kelvinlet);
+    float scale = kelvinlet.dt / reference.dt;
+    for (int i = 0; i < SENSITIVITY_PARAMETERS; i++)
+    {
+        parameters.p[i] *= scale;
+    }
+    return parameters;
+}
+
+// Returns ds/dt = (df/dx) s + df/dp for the Kelvinlet ODE.
+// KEvaluate() is linear in the force vector and matrices, so df/dp is evaluated
+// exactly with unit loads. The only nonlinear dependency on the parameters is
+// the advected origin, which moves with the linear velocity. df/dx is computed
+// with central differences, which is accurate because the Kelvinlet field is
+// smooth at the scale of its radius.
+INLINE SensitivityMatrix
+KEvaluateSensitivity(float t, vec3 x, SensitivityMatrix s, Kelvinlet kelvinlet)
+{
+    float translationCalibration = KTranslationCalibrationFactor(kelvinlet.radius, kelvinlet.compressibility);
+    float twistCalibration = KTwistCalibrationFactor(kelvinlet.radius, kelvinlet.compressibility);
+    float scaleCalibration = KScaleCalibrationFactor(kelvinlet.radius, 0.0f);
+
+    float h = kelvinlet.radius * 0.001f;
+    vec3 axes[3] = { vec3(1, 0, 0), vec3(0, 1, 0), vec3(0, 0, 1) };
+    mat3x3 jacobian;
+    vec3* jacobianColumns[3] = { &jacobian.cx, &jacobian.cy, &jacobian.cz };
+    for (int i = 0; i < 3; i++)
+    {
+        vec3 forward = KEvaluate(t, x + axes[i] * h, kelvinlet);
+        vec3 backward = KEvaluate(t, x - axes[i] * h, kelvinlet);
+        *jacobianColumns[i] = (forward - backward) / (2 * h);
+    }
+
+    float originLerp = t - kelvinlet.time;
+    vec3 R = x - (kelvinlet.origin + kelvinlet.linearVelocity * originLerp);
+
+    SensitivityMatrix ds;
+    for (int i = 0; i < SENSITIVITY_PARAMETERS; i++)
+    {
+        ds.column[i] = jacobian * s.column[i];
+    }
+    for (int i = 0; i < 3; i++)
+    {
+        // translation load, plus the advected origin: dR/dv = -originLerp * I
+        ds.column[i] = ds.column[i] + KTranslation(R, axes[i] * translationCalibration, kelvinlet.radius, kelvinlet.stiffness, kelvinlet.compressibility);
+        ds.column[i] = ds.column[i] - (jacobian * axes[i]) * originLerp;
+
+        // twist load
+        ds.column[3 + i] = ds.column[3 + i] + KTwist(R, skewSymmetric(axes[i]) * twistCalibration, kelvinlet.radius, kelvinlet.stiffness, kelvinlet.compressibility);
+    }
+    ds.column[6] = ds.column[6] + KScale(R, identityMat3x3() * scaleCalibration, kelvinlet.radius, kelvinlet.stiffness, 0.0f);
+
+    return ds;
+}
+
+// Same as IntegrateKelvinlets_AdaptiveBS32(), but also integrates dx/dp.
+// The step size is controlled by the error of the position only, and the
+// position is computed with the same arithmetic as IntegrateKelvinlets_AdaptiveBS32(),
+// so result.position is identical to what that function returns.
+INLINE KelvinletSensitivity
+IntegrateKelvinletsSensitivity_AdaptiveBS32(vec3 pos, float tstart, float tend, float maxerror, Kelvinlet kelvinlet)
+{
+    float a2 = 1 / 2.0f;
+    float a3 = 3 / 4.0f;
+    float a4 = 1.0f;
+
+    float b21 = 1 / 2.0f;
+    float b31 = 0;
+    float b32 = 3 / 4.0f;
+    float b41 = 2 / 9.0f;
+    float b42 = 1 / 3.0f;
+    float b43 = 4 / 9.0f;
+
+    float c1 = 2 / 9.0f;    // third order answer
+    float c2 = 1 / 3.0f;
+    float c3 = 4 / 9.0f;
+
+    float d1 = 7 / 24.0f;    // second order answer
+    float d2 = 1 / 4.0f;
+    float d3 = 1 / 3.0f;
+    float d4 = 1 / 8.0f;
+
+    SensitivityMatrix sensitivity = zeroSensitivityMatrix();
+
+    float t = tstart;
+    float dt = (tend - tstart) * ADAPTIVE_INTEGRATOR_INITIAL_DT;
+    while (t < tend)
+    {
+        dt = min(dt, tend - t);
+
+        vec3 x2 = pos;
+        vec3 k1 = dt*KEvaluate(t, pos, kelvinlet);
+        vec3 x3 = pos + k1*b21;
+        vec3 k2 = dt*KEvaluate(t + dt*a2, x3, kelvinlet);
+        vec3 x4 = pos + k1*b31 + k2*b32;
+        vec3 k3 = dt*KEvaluate(t + dt*a3, x4, kelvinlet);
+        vec3 thirdorder = pos + k1*c1 + k2*c2 + k3*c3;
+        vec3 x5 = pos + k1*b41 + k2*b42 + k3*b43;
+        vec3 k4 = dt*KEvaluate(t + dt*a4, x5, kelvinlet);
+        vec3 secondorder = pos + k1*d1 + k2*d2 + k3*d3 + k4*d4;
+
+        float error = length(thirdorder - secondorder) / dt;
+
+        float safety = 0.9f;
+        float newdt = dt * safety * pow(maxerror / error, 1/3.0f);
+        newdt = min(newdt, dt * ADAPTIVE_INTEGRATOR_MAXIMUM_GROWTH);
+
+        if (error <= maxerror || dt <= ADAPTIVE_INTEGRATOR_MINIMUM_DT)
+        {
+            // the third order answer doesn't use the fourth stage, so neither does the sensitivity
+            SensitivityMatrix s1 = KEvaluateSensitivity(t, x2, sensitivity, kelvinlet) * dt;
+            SensitivityMatrix s2 = KEvaluateSensitivity(t + dt*a2, x3, sensitivity + s1*b21, kelvinlet) * dt;
+            SensitivityMatrix s3 = KEvaluateSensitivity(t + dt*a3, x4, sensitivity + s1*b31 + s2*b32, kelvinlet) * dt;
+            sensitivity = sensitivity + s1*c1 + s2*c2 + s3*c3;
+
+            pos = thirdorder;    // local extrapolation
+            t += dt;
+            dt = max(newdt, ADAPTIVE_INTEGRATOR_MINIMUM_DT);
+        }
+        else
+        {
+            // we have a lot of error. if the new dt is (nearly) the same as our current dt,
+            // then use half our step size to prevent an infinite loop
+            dt = (fabs(newdt - dt) < 0.00001f) ? dt / 2.f : newdt;
+            dt = max(dt, ADAPTIVE_INTEGRATOR_MINIMUM_DT);
+        }
+    }
+
+    KelvinletSensitivity result;
+    result.position = pos;
+    result.dxdp = sensitivity;
+    return result;
+}
+
+///////////////////////////////////////////////////////
+// Sensitivity cache for incremental move tool updates
+///////////////////////////////////////////////////////
+
+struct KelvinletSensitivityCache
+{
+    Kelvinlet                         reference;      // the Kelvinlet the cache was built with
+    std::vector<float>                maxerrors;      // the solver's maxerror for each vertex
+    std::vector<vec3>                 restPositions;  // positions at the start of the move
+    std::vector<KelvinletSensitivity> linearizations; // x(tend) and dx/dp of each vertex
+    std::vector<MotionParameters>     parameters;     // the parameters each vertex was linearized at
+};
+
+// Integrates every vertex once with sensitivities. This costs more than a
+// regular adaptive solve, and should be done when the move starts.
+INLINE void buildSensitivityCache(KelvinletSensitivityCache& cache, const vec3* restPositions, unsigned int count, ToleranceField maxerror, Kelvinlet kelvinlet)
+{
+    cache.reference = kelvinlet;
+    cache.maxerrors.resize(count);
+    cache.restPositions.assign(restPositions, restPositions + count);
+    cache.linearizations.resize(count);
+    cache.parameters.assign(count, kelvinletMotionParameters(kelvinlet));
+
+    for (unsigned int i = 0; i < count; i++)
+    {
+        cache.maxerrors[i] = toleranceForVertex(maxerror, i);
+        cache.linearizations[i] = IntegrateKelvinletsSensitivity_AdaptiveBS32(restPositions[i], kelvinlet.time, kelvinlet.time + kelvinlet.dt, cache.maxerrors[i], kelvinlet);
+    }
+}
+
+INLINE void buildSensitivityCache(KelvinletSensitivityCache& cache, const vec3* restPositions, unsigned int count, float maxerror, Kelvinlet kelvinlet)
+{
+    buildSensitivityCache(cache, restPositions, count, uniformToleranceField(maxerror), kelvinlet);
+}
+
+// Writes the deformed positions for a new end pose into positions.
+// kelvinlet must have the same origin, start time, and material as the Kelvinlet
+// the cache was built with (only the end pose may change); otherwise rebuild the cache.
+//
+// The Kelvinlet field varies at the scale of its radius, so the second order
+// remainder of a first order update is estimated as the first order change
+// times the change of the parameters (in units of displacement) relative to
+// the radius. When that estimate is larger than the vertex's tolerance, the
+// vertex is integrated again and re-linearized at the new parameters.
+// Returns the number of vertices that were integrated again.
+INLINE unsigned int updateFromSensitivityCache(KelvinletSensitivityCache& cache, Kelvinlet kelvinlet, ToleranceField tolerance, vec3* positions)
+{
+    Kelvinlet reference = cache.reference;
+    MotionParameters target = kelvinletMotionParametersOnInterval(kelvinlet, reference);
+    Kelvinlet onReferenceInterval = kelvinletWithMotionParameters(reference, target);
+
+    unsigned int reintegrated = 0;
+    for (unsigned int i = 0; i < cache.linearizations.size(); i++)
+    {
+        MotionParameters dp;
+        for (int j = 0; j < SENSITIVITY_PARAMETERS; j++)
+        {
+            dp.p[j] = target.p[j] - cache.parameters[i].p[j];
+        }
+
+        // the parameter change, as a displacement over the Kelvinlet's time interval
+        vec3 dv(dp.p[0], dp.p[1], dp.p[2]);
+        vec3 dw(dp.p[3], dp.p[4], dp.p[5]);
+        float displacement = sqrt(dot(dv, dv) + (dot(dw, dw) + dp.p[6] * dp.p[6]) * reference.radius * reference.radius) * reference.dt;
+
+        vec3 firstorder = cache.linearizations[i].dxdp * dp;
+        float predictederror = length(firstorder) * displacement / reference.radius;
+
+        if (predictederror <= toleranceForVertex(tolerance, i))
+        {
+            positions[i] = cache.linearizations[i].position + firstorder;
+        }
+        else
+        {
+            cache.linearizations[i] = IntegrateKelvinletsSensitivity_AdaptiveBS32(cache.restPositions[i], reference.time, reference.time + reference.dt, cache.maxerrors[i], onReferenceInterval);
+            cache.parameters[i] = target;
+            positions[i] = cache.linearizations[i].position;
+            reintegrated++;
+        }
+    }
+
+    return reintegrated;
+}
+
+INLINE unsigned int updateFromSensitivityCache(KelvinletSensitivityCache& cache, Kelvinlet kelvinlet, float tolerance, vec3* positions)
+{
+    return updateFromSensitivityCache(cache, kelvinlet, uniformToleranceField(tolerance), positions);
+}
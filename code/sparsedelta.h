@@ -0,0 +1,182 @@
+// Copyright(c) Facebook, Inc. and its affiliates.
+// All rights reserved.
+//
+// This source code is licensed under the BSD - style license found in the
+// LICENSE file in the root directory of this source tree.
+
+#pragma once
+
+///////////////////////////////////////////////////////
+// Sending only the vertices that moved
+//
+// The solvers overwrite the positions in place, so whatever consumes
+// them every frame (the vertex buffer on the GPU, a remote copy of the
+// sculpt, the undo history) has to diff them or take the whole mesh. A
+// brush only moves a small part of the mesh every frame, though.
+// SparseDeltaEncoder keeps a copy of the positions as the consumer has
+// them, and every frame only sends the vertices that are now more than
+// a threshold away from that copy, as (vertex index, delta) pairs. The
+// deltas can be quantized to 16 bit integers in units of a quantization
+// step, which halves their size again.
+//
+// The deltas are measured from what the consumer has, not from the last
+// frame, so the small moves that aren't sent add up until they are, and
+// the rounding of the quantized deltas is corrected in later frames.
+// After every frame, the consumer is within the threshold of the
+// positions, or half a quantization step in every axis if that's more,
+// except for the vertices that moved by more than 32767 quantization
+// steps in an axis since they were last sent: their deltas are clamped,
+// and they catch up by up to 32767 steps per axis every frame.
+//
+// Every chunk of forEachMeshChunk() is encoded on its own thread, so this
+// needs threadpool.h and meshdeformer.h.
+///////////////////////////////////////////////////////
+
+#include <functional>
+#include <vector>
+
+// The vertices that moved during a frame, and how much
+struct SparseDeltas
+{
+    float                     quantization = 0.0f;  // the unit of quantized, or 0 when deltas are used
+    std::vector<unsigned int> indices;
+    std::vector<vec3>         deltas;     // one per index, when they aren't quantized
+    std::vector<short>        quantized;  // three per index, when they are
+
+    unsigned int count() const { return (unsigned int)indices.size(); }
+
+    // The size of the deltas when they are sent
+    size_t bytes() const
+    {
+        return indices.size() * sizeof(unsigned int) + deltas.size() * sizeof(vec3) + quantized.size() * sizeof(short);
+    }
+
+    // The k-th delta, as the consumer adds it
+    vec3 delta(unsigned int k) const
+    {
+        if (quantization > 0.0f)
+        {
+            return vec3(quantized[k * 3 + 0], quantized[k * 3 + 1], quantized[k * 3 + 2]) * quantization;
+        }
+        return deltas[k];
+    }
+};
+
+// Adds the deltas to the positions of the consumer
+INLINE void applySparseDeltas(const SparseDeltas& deltas, vec3* positions)
+{
+    for (unsigned int k = 0; k < deltas.count(); k++)
+    {
+        positions[deltas.indices[k]] = positions[deltas.indices[k]] + deltas.delta(k);
+    }
+}
+
+class SparseDeltaEncoder
+{
+public:
+    // positions are what the consumer has now. A quantization of 0 sends the deltas as floats.
+    SparseDeltaEncoder(const vec3* positions, unsigned int vertexCount, float threshold, float quantization = 0.0f)
+        : sent(positions, positions + vertexCount), threshold(threshold), quantization(quantization)
+    {
+    }
+
+    // Writes the vertices of positions that are more than threshold away from what the consumer has
+    void encode(ThreadPool& pool, const vec3* positions, SparseDeltas& out)
+    {
+        run(pool, positions, nullptr, nullptr, out);
+    }
+
+    // Deforms positions in place, and writes the vertices that are now more than threshold away
+    // from what the consumer has, in the same pass
+    void deform(ThreadPool& pool, vec3* positions, const MeshSolver& solver, SparseDeltas& out)
+    {
+        run(pool, positions, positions, &solver, out);
+    }
+
+    // What the consumer has, once it applies the deltas
+    const vec3* sentPositions() const { return sent.data(); }
+
+private:
+    struct Chunk
+    {
+        std::vector<unsigned int> indices;
+        std::vector<vec3>         deltas;
+        std::vector<short>        quantized;
+    };
+
+    short quantize(float delta) const
+    {
+        float steps = floor(delta / quantization + 0.5f);
+        return (short)(steps < -32767.0f ? -32767.0f : steps > 32767.0f ? 32767.0f : steps);
+    }
+
+    // Deforms positions into deformed, if there's a solver, and writes the deltas
+    void run(ThreadPool& pool, const vec3* positions, vec3* deformed, const MeshSolver* solver, SparseDeltas& out)
+    {
+        unsigned int vertexCount = (unsigned int)sent.size();
+        chunks.resize(meshChunkCount(vertexCount));
+        forEachMeshChunk(pool, vertexCount, [&](unsigned int c, unsigned int first, unsigned int last)
+        {
+            Chunk& chunk = chunks[c];
+            chunk.indices.clear();
+            chunk.deltas.clear();
+            chunk.quantized.clear();
+
+            for (unsigned int i = first; i < last; i++)
+            {
+                vec3 position = positions[i];
+                if (solver)
+                {
+                    position = (*solver)(position);
+                    deformed[i] = position;
+                }
+
+                vec3 delta = position - sent[i];
+                if (dot(delta, delta) <= threshold * threshold)
+                {
+                    continue;
+                }
+
+                if (quantization > 0.0f)
+                {
+                    // deltas that don't fit are clamped, and the rest is sent in later frames.
+                    // Deltas that round to zero (a threshold under half a step) aren't sent.
+                    short x = quantize(delta.x);
+                    short y = quantize(delta.y);
+                    short z = quantize(delta.z);
+                    if (x == 0 && y == 0 && z == 0)
+                    {
+                        continue;
+                    }
+                    chunk.indices.push_back(i);
+                    chunk.quantized.push_back(x);
+                    chunk.quantized.push_back(y);
+                    chunk.quantized.push_back(z);
+                    sent[i] = sent[i] + vec3(x, y, z) * quantization;
+                }
+                else
+                {
+                    chunk.indices.push_back(i);
+                    chunk.deltas.push_back(delta);
+                    sent[i] = sent[i] + delta;
+                }
+            }
+        });
+
+        out.quantization = quantization;
+        out.indices.clear();
+        out.deltas.clear();
+        out.quantized.clear();
+        for (const Chunk& chunk : chunks)
+        {
+            out.indices.insert(out.indices.end(), chunk.indices.begin(), chunk.indices.end());
+            out.deltas.insert(out.deltas.end(), chunk.deltas.begin(), chunk.deltas.end());
+            out.quantized.insert(out.quantized.end(), chunk.quantized.begin(), chunk.quantized.end());
+        }
+    }
+
+    std::vector<vec3>  sent;  // the positions the consumer has
+    float              threshold;
+    float              quantization;
+    std::vector<Chunk> chunks;
+};
@@ -0,0 +1,221 @@
+// Copyright(c) Facebook, Inc. and its affiliates.
+// All rights reserved.
+//
+// This source code is licensed under the BSD - style license found in the
+// LICENSE file in the root directory of this source tree.
+
+#pragma once
+
+///////////////////////////////////////////////////////
+// Finding the vertices near a brush
+//
+// The nonelastic deformers only move the vertices within the outer
+// radius of the tool, but the examples in test.cpp compute the falloff
+// of every vertex to find them. SpatialHash puts the vertices in the
+// cells of a uniform grid, and returns the vertices of the cells that a
+// sphere, or the capsule that the tool sweeps during a frame, touches.
+// The results are ranges of vertex indices, so the drivers only loop
+// over the vertices that can be moved.
+//
+// The grid is loose: a vertex stays in its cell until it moves more than
+// SPATIALHASH_LOOSENESS of a cell out of it, and the queries grow by as
+// much. refit() only checks the vertices that the brush could have
+// moved, and only moves the few that left their cells, so the grid stays
+// valid frame after frame without being rebuilt.
+//
+// The cells are keyed with gridKey() from meshdeformer.h; include it (and
+// threadpool.h) first.
+///////////////////////////////////////////////////////
+
+#include <unordered_map>
+#include <vector>
+
+// How far a vertex can leave its cell before it moves to another cell, as a fraction of the cell size
+#define SPATIALHASH_LOOSENESS 0.5f
+
+// The vertex indices [begin, end)
+struct SpatialHashRange
+{
+    const unsigned int* begin;
+    const unsigned int* end;
+};
+
+// The result of a query. The ranges are valid until the next refit().
+struct SpatialHashQuery
+{
+    std::vector<SpatialHashRange> ranges;
+    std::vector<unsigned int>     cells;
+    unsigned int                  stamp = 0;
+
+    unsigned int vertexCount() const
+    {
+        unsigned int count = 0;
+        for (const SpatialHashRange& range : ranges)
+        {
+            count += (unsigned int)(range.end - range.begin);
+        }
+        return count;
+    }
+};
+
+class SpatialHash
+{
+public:
+    // cellSize is usually the outer radius of the brush
+    SpatialHash(float cellSize, const vec3* positions, unsigned int vertexCount)
+        : cellSize(cellSize), vertexCells(vertexCount), vertexSlots(vertexCount)
+    {
+        for (unsigned int i = 0; i < vertexCount; i++)
+        {
+            insert(i, positions[i]);
+        }
+    }
+
+    // Starts a new query. The shapes that are added to it are merged: every vertex is in
+    // one range at most.
+    void beginQuery(SpatialHashQuery& query)
+    {
+        query.ranges.clear();
+        query.cells.clear();
+        query.stamp = ++stamp;
+    }
+
+    // Adds the vertices that may be within radius of center
+    void addSphere(SpatialHashQuery& query, vec3 center, float radius)
+    {
+        addCapsule(query, center, center, radius);
+    }
+
+    // Adds the vertices that may be within radius of the segment from p0 to p1
+    void addCapsule(SpatialHashQuery& query, vec3 p0, vec3 p1, float radius)
+    {
+        // the cells whose loose bounds overlap the bounds of the capsule
+        float lomargin = radius + (1 + SPATIALHASH_LOOSENESS) * cellSize;
+        float himargin = radius + SPATIALHASH_LOOSENESS * cellSize;
+        int x0 = (int)floor((min(p0.x, p1.x) - lomargin) / cellSize);
+        int y0 = (int)floor((min(p0.y, p1.y) - lomargin) / cellSize);
+        int z0 = (int)floor((min(p0.z, p1.z) - lomargin) / cellSize);
+        int x1 = (int)floor((max(p0.x, p1.x) + himargin) / cellSize);
+        int y1 = (int)floor((max(p0.y, p1.y) + himargin) / cellSize);
+        int z1 = (int)floor((max(p0.z, p1.z) + himargin) / cellSize);
+
+        // the distance from the center of a cell to the farthest point of its loose bounds
+        float reach = radius + (0.5f + SPATIALHASH_LOOSENESS) * cellSize * sqrt(3.0f);
+
+        vec3 segment = p1 - p0;
+        float lengthSquared = dot(segment, segment);
+        for (int z = z0; z <= z1; z++)
+        {
+            for (int y = y0; y <= y1; y++)
+            {
+                for (int x = x0; x <= x1; x++)
+                {
+                    auto cell = cells.find(gridKey(x, y, z));
+                    if (cell == cells.end() || cellStamps[cell->second] == query.stamp || cellVertices[cell->second].empty())
+                    {
+                        continue;
+                    }
+
+                    vec3 center = vec3(x + 0.5f, y + 0.5f, z + 0.5f) * cellSize;
+                    float s = lengthSquared > 0.0f ? saturate(dot(center - p0, segment) / lengthSquared) : 0.0f;
+                    vec3 closest = p0 + segment * s;
+                    if (dot(center - closest, center - closest) > reach * reach)
+                    {
+                        continue;
+                    }
+
+                    const std::vector<unsigned int>& vertices = cellVertices[cell->second];
+                    SpatialHashRange range = { vertices.data(), vertices.data() + vertices.size() };
+                    query.ranges.push_back(range);
+                    query.cells.push_back(cell->second);
+                    cellStamps[cell->second] = query.stamp;
+                }
+            }
+        }
+    }
+
+    // Moves the vertices of the query that left their cells. Call this after deforming them,
+    // before the next query. Returns the number of vertices that moved to another cell.
+    unsigned int refit(const vec3* positions, const SpatialHashQuery& query)
+    {
+        refitVertices.clear();
+        for (unsigned int c : query.cells)
+        {
+            refitVertices.insert(refitVertices.end(), cellVertices[c].begin(), cellVertices[c].end());
+        }
+
+        unsigned int moved = 0;
+        for (unsigned int i : refitVertices)
+        {
+            if (!inside(vertexCells[i], positions[i]))
+            {
+                remove(i);
+                insert(i, positions[i]);
+                moved++;
+            }
+        }
+        return moved;
+    }
+
+    // Moves every vertex that left its cell
+    unsigned int refit(const vec3* positions)
+    {
+        unsigned int moved = 0;
+        for (unsigned int i = 0; i < vertexCells.size(); i++)
+        {
+            if (!inside(vertexCells[i], positions[i]))
+            {
+                remove(i);
+                insert(i, positions[i]);
+                moved++;
+            }
+        }
+        return moved;
+    }
+
+private:
+    // Whether position is within the loose bounds of the cell
+    bool inside(unsigned int cell, vec3 position) const
+    {
+        vec3 lo = (cellCoordinates[cell] - vec3(SPATIALHASH_LOOSENESS, SPATIALHASH_LOOSENESS, SPATIALHASH_LOOSENESS)) * cellSize;
+        vec3 hi = (cellCoordinates[cell] + vec3(1 + SPATIALHASH_LOOSENESS, 1 + SPATIALHASH_LOOSENESS, 1 + SPATIALHASH_LOOSENESS)) * cellSize;
+        return position.x >= lo.x && position.y >= lo.y && position.z >= lo.z && position.x <= hi.x && position.y <= hi.y && position.z <= hi.z;
+    }
+
+    void insert(unsigned int i, vec3 position)
+    {
+        int x = (int)floor(position.x / cellSize);
+        int y = (int)floor(position.y / cellSize);
+        int z = (int)floor(position.z / cellSize);
+        auto cell = cells.find(gridKey(x, y, z));
+        if (cell == cells.end())
+        {
+            cell = cells.emplace(gridKey(x, y, z), (unsigned int)cellVertices.size()).first;
+            cellVertices.push_back(std::vector<unsigned int>());
+            cellCoordinates.push_back(vec3((float)x, (float)y, (float)z));
+            cellStamps.push_back(0);
+        }
+        vertexCells[i] = cell->second;
+        vertexSlots[i] = (unsigned int)cellVertices[cell->second].size();
+        cellVertices[cell->second].push_back(i);
+    }
+
+    void remove(unsigned int i)
+    {
+        std::vector<unsigned int>& vertices = cellVertices[vertexCells[i]];
+        unsigned int last = vertices.back();
+        vertices[vertexSlots[i]] = last;
+        vertexSlots[last] = vertexSlots[i];
+        vertices.pop_back();
+    }
+
+    float                                                cellSize;
+    unsigned int                                         stamp = 0;
+    std::unordered_map<unsigned long long, unsigned int> cells;  // grid coordinates to cell index
+    std::vector<std::vector<unsigned int>>               cellVertices;
+    std::vector<vec3>                                    cellCoordinates;
+    std::vector<unsigned int>                            cellStamps;   // the last query that returned the cell
+    std::vector<unsigned int>                            vertexCells;
+    std::vector<unsigned int>                            vertexSlots;  // where the vertex is in its cell
+    std::vector<unsigned int>                            refitVertices;
+};
@@ -0,0 +1,191 @@
+// Copyright(c) Facebook, Inc. and its affiliates.
+// All rights reserved.
+//
+// This source code is licensed under the BSD - style license found in the
+// LICENSE file in the root directory of this source tree.
+
+#pragma once
+
+///////////////////////////////////////////////////////
+// Deforming ahead of the tool
+//
+// The time between a new pose of the controller and the frame that shows
+// it is mostly spent deforming the mesh. SpeculativeDeformer predicts the
+// next pose from the last motion of the tool, and deforms a copy of the
+// mesh for it on background threads while the application waits for the
+// real pose. When the real pose arrives, and it is within the tolerance
+// of the prediction, the copy is the new mesh, and nothing is left to do
+// on the critical path. Otherwise, the copy is thrown away, and the mesh
+// is deformed for the real pose.
+//
+// When a prediction is used, the mesh is where the predicted pose took
+// it, and the next motion starts from the predicted pose, not the real
+// one. So the mesh is never further than the tolerance from where the
+// tool is, and the differences don't add up from frame to frame.
+//
+// Include threadpool.h, meshdeformer.h and strokesimplify.h (for
+// poseDistance()) first.
+///////////////////////////////////////////////////////
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+
+struct SpeculativeStats
+{
+    unsigned int hits;           // the poses that were within the tolerance of the prediction
+    unsigned int misses;         // the poses that weren't, and were deformed on the critical path
+    double       waitSeconds;    // the time update() took, added up
+
+    float hitRate() const { return hits + misses > 0 ? (float)hits / (hits + misses) : 0.0f; }
+};
+
+// Extrapolates the pose at time from the last pose, moving on with the velocities of motion
+INLINE Pose predictPose(Pose last, const Motion& motion, float time)
+{
+    float dt = time - last.time;
+
+    vec3 rotation = motion.angularVelocity * dt;
+    float angle = length(rotation);
+    quat q = quat(1, 0, 0, 0);
+    if (angle > 0.0f)
+    {
+        vec3 axis = rotation / angle;
+        q = quat(cos(angle / 2), axis.x * sin(angle / 2), axis.y * sin(angle / 2), axis.z * sin(angle / 2));
+    }
+
+    Pose pose;
+    pose.position = last.position + motion.linearVelocity * dt;
+    pose.orientation = q * last.orientation;
+    pose.scale = last.scale * pow(motion.scaleFactor, dt / motion.dt);
+    pose.time = time;
+    return pose;
+}
+
+class SpeculativeDeformer
+{
+public:
+    // solverFor(motion) returns the solver of a motion
+    typedef std::function<MeshSolver(const Motion&)> SolverForMotion;
+
+    // A prediction is used when poseDistance() from the real pose, at radius (the outer radius of
+    // the tool), is tolerance or less. speculateThreads of 0 uses
+    // backgroundThreadCount().
+    SpeculativeDeformer(const vec3* positions, unsigned int vertexCount, float tolerance, float radius, const SolverForMotion& solverFor, unsigned int speculateThreads = 0)
+        : positions(positions, positions + vertexCount), speculative(vertexCount), tolerance(tolerance), radius(radius), solverFor(solverFor)
+    {
+        if (speculateThreads == 0)
+        {
+            speculateThreads = backgroundThreadCount();
+        }
+        speculatePool.reset(new ThreadPool(speculateThreads));
+    }
+
+    ~SpeculativeDeformer()
+    {
+        cancelled = true;
+        wait();
+    }
+
+    SpeculativeDeformer(const SpeculativeDeformer&) = delete;
+    SpeculativeDeformer& operator=(const SpeculativeDeformer&) = delete;
+
+    // Takes the real pose of this frame: uses the prediction if it is close enough, or deforms the
+    // mesh for it, and then starts deforming for the prediction of the next frame in the background
+    const vec3* update(ThreadPool& pool, Pose pose)
+    {
+        auto start = std::chrono::steady_clock::now();
+        if (!started)
+        {
+            started = true;
+            applied = pose;
+            last = pose;
+            return positions.data();
+        }
+        if (pose.time <= last.time)
+        {
+            return positions.data();
+        }
+
+        // a prediction that missed doesn't need to finish
+        bool hit = speculating && poseDistance(predicted, pose, radius) <= tolerance;
+        cancelled = !hit;
+        wait();
+        cancelled = false;
+        if (hit)
+        {
+            positions.swap(speculative);
+            applied = predicted;
+            applied.time = pose.time;
+            stats.hits++;
+        }
+        else
+        {
+            deform(pool, positions.data(), positions.data(), buildMotion(applied, pose));
+            applied = pose;
+            stats.misses++;
+        }
+
+        // predict the next pose, one frame later, with the motion of this frame
+        Motion motion = buildMotion(last, pose);
+        last = pose;
+        predicted = predictPose(pose, motion, pose.time + motion.dt);
+        Motion speculativeMotion = buildMotion(applied, predicted);
+        speculating = true;
+        speculator = std::thread([this, speculativeMotion]()
+        {
+            deform(*speculatePool, positions.data(), speculative.data(), speculativeMotion);
+        });
+
+        stats.waitSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return positions.data();
+    }
+
+    // The positions of the mesh. They don't change until the next update().
+    const vec3* currentPositions() const { return positions.data(); }
+
+    SpeculativeStats getStats() const { return stats; }
+
+private:
+    void wait()
+    {
+        if (speculator.joinable())
+        {
+            speculator.join();
+        }
+    }
+
+    void deform(ThreadPool& tasks, const vec3* in, vec3* out, const Motion& motion)
+    {
+        MeshSolver solver = solverFor(motion);
+        forEachMeshChunk(tasks, (unsigned int)positions.size(), [&](unsigned int, unsigned int first, unsigned int last)
+        {
+            if (cancelled)
+            {
+                return;
+            }
+            for (unsigned int i = first; i < last; i++)
+            {
+                out[i] = solver(in[i]);
+            }
+        });
+    }
+
+    std::vector<vec3>           positions;
+    std::vector<vec3>           speculative;  // the positions for the predicted pose
+    float                       tolerance;
+    float                       radius;
+    SolverForMotion             solverFor;
+    std::unique_ptr<ThreadPool> speculatePool;
+    std::thread                 speculator;
+    std::atomic<bool>           cancelled{ false };
+    bool                        started = false;
+    bool                        speculating = false;
+    Pose                        applied;      // the pose the mesh is deformed for
+    Pose                        last;         // the last real pose
+    Pose                        predicted;
+    SpeculativeStats            stats = {};
+};
@@ -0,0 +1,366 @@
+// Copyright(c) Facebook, Inc. and its affiliates.
+// All rights reserved.
+//
+// This source code is licensed under the BSD - style license found in the
+// LICENSE file in the root directory of this source tree.
+
+#pragma once
+
+///////////////////////////////////////////////////////
+// Smooth motion through a stroke
+//
+// buildMotion() moves the tool with constant linear and angular velocity
+// between two poses, so a recorded stroke is a velocity field that jumps
+// at every pose, and the solvers have to restart at every frame (see
+// tests 4 to 7 in test.cpp). SplineMotion instead moves the tool along
+// smooth curves through all of the poses of a stroke:
+// - the position is a cubic Hermite spline, with tangents from the
+//   neighboring poses (Catmull-Rom, weighted for uneven frame times)
+// - the orientation is a cubic Hermite spline of the rotation vector
+//   from the pose at the start of each segment, with the angular
+//   velocity at every pose also from the neighboring poses
+// - the log of the scale is a cubic Hermite spline
+//
+// The velocity, angular velocity and rate of scaling of the tool are
+// exact derivatives of these curves, and are continuous through the
+// poses, so the Kelvinlet or non-elastic deformation is a velocity field
+// that is smooth in time. IntegrateSplineKelvinlets_* and
+// IntegrateSplineNonElastic_* are the solvers of odesolvers.h for these
+// fields: the adaptive solvers can take steps that are longer than a
+// frame, across a whole stroke.
+//
+// The times of a SplineMotion are seconds since the first pose, from 0 to
+// splineDuration(). Recorded poses have the time since the app started,
+// where a float only has a few hundredths of a millisecond of precision,
+// and an adaptive solver adds up its steps to that time, so integrating
+// in those times moves the tool by several maxerror over a stroke.
+//
+// Only the velocity of the tool and its first derivative are continuous
+// at the poses, so the error estimates of the fourth and fifth order
+// solvers are wrong for steps across a pose. Use the BS32 solver across
+// a whole stroke, or the others one segment at a time.
+///////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <vector>
+
+// One segment between two poses, as polynomials of u = (t - time) / duration
+struct SplineMotionSegment
+{
+    float time;
+    float duration;
+    vec3  position[4];   // position(u) = position[0] + position[1] u + position[2] u^2 + position[3] u^3
+    vec3  rotation[4];   // the rotation vector from orientation, in world space
+    float logScale[4];
+    quat  orientation;   // the orientation at u = 0
+};
+
+struct SplineMotion
+{
+    float                            startTime; // the time of the first pose; the other times are relative to it
+    std::vector<float>               times;     // the time of every pose, to find the segments
+    std::vector<SplineMotionSegment> segments;
+};
+
+// Everything a Kelvinlet needs besides the motion of the tool
+struct SplineKelvinletStroke
+{
+    const SplineMotion* motion;
+    float translationCalibration;
+    float twistCalibration;
+    float scaleCalibration;
+    float radius;
+    float stiffness;
+    float compressibility;
+};
+
+// exp() and log() of unit quaternions, with v as half the rotation vector
+INLINE quat quatExp(vec3 v)
+{
+    float angle = length(v);
+    if (angle < 1e-12f)
+    {
+        return quat(1, v.x, v.y, v.z);
+    }
+    vec3 axis = v * (sin(angle) / angle);
+    return quat(cos(angle), axis.x, axis.y, axis.z);
+}
+
+INLINE vec3 quatLog(quat q)
+{
+    vec3 v = q.v();
+    float s = length(v);
+    if (s < 1e-12f)
+    {
+        return v;
+    }
+    return v * (atan2(s, q.r) / s);
+}
+
+// The world space angular velocity of the rotation by the rotation vector r, when r changes by dr:
+// the left Jacobian of the rotation group. The inverse turns an angular velocity back into dr.
+INLINE vec3 rotationVectorAngularVelocity(vec3 r, vec3 dr)
+{
+    float angle2 = dot(r, r);
+    float angle = sqrt(angle2);
+    float a = angle < 1e-3f ? 0.5f - angle2 / 24 : (1 - cos(angle)) / angle2;
+    float b = angle < 1e-3f ? 1.0f / 6 - angle2 / 120 : (angle - sin(angle)) / (angle2 * angle);
+    vec3 rxdr = cross(r, dr);
+    return dr + rxdr * a + cross(r, rxdr) * b;
+}
+
+INLINE vec3 angularVelocityRotationVector(vec3 r, vec3 w)
+{
+    float angle2 = dot(r, r);
+    float angle = sqrt(angle2);
+    float c = angle < 1e-3f ? 1.0f / 12 + angle2 / 720 : 1 / angle2 - (1 + cos(angle)) / (2 * angle * sin(angle));
+    vec3 rxw = cross(r, w);
+    return w - rxw * 0.5f + cross(r, rxw) * c;
+}
+
+// The polynomial of the cubic Hermite curve from p0 to p1, with tangents m0 and m1 (per unit of u)
+INLINE void hermiteCoefficients(vec3 p0, vec3 m0, vec3 p1, vec3 m1, vec3 c[4])
+{
+    c[0] = p0;
+    c[1] = m0;
+    c[2] = (p1 - p0) * 3 - m0 * 2 - m1;
+    c[3] = (p0 - p1) * 2 + m0 + m1;
+}
+
+// The weighted average of the slopes of the segments before and after a pose, or the
+// slope of the only segment at the ends of the stroke
+INLINE vec3 splineKnotTangent(vec3 slopeprevious, float dtprevious, vec3 slopenext, float dtnext)
+{
+    if (dtprevious <= 0.0f)
+    {
+        return slopenext;
+    }
+    if (dtnext <= 0.0f)
+    {
+        return slopeprevious;
+    }
+    return (slopeprevious * dtnext + slopenext * dtprevious) / (dtprevious + dtnext);
+}
+
+// The poses must be in order of time with no two at the same time (see simplifyStroke()),
+// and without flips (see fixFlips() in test.cpp)
+INLINE void buildSplineMotion(const Pose* poses, unsigned int count, SplineMotion& spline)
+{
+    spline.startTime = count ? poses[0].time : 0.0f;
+    spline.times.resize(count);
+    spline.segments.resize(count > 1 ? count - 1 : 1);
+
+    for (unsigned int i = 0; i < count; i++)
+    {
+        spline.times[i] = poses[i].time - spline.startTime;
+    }
+
+    if (count < 2)
+    {
+        SplineMotionSegment& segment = spline.segments[0];
+        segment.time = 0.0f;
+        segment.duration = 1.0f;
+        for (int k = 0; k < 4; k++)
+        {
+            segment.position[k] = vec3(0.0f);
+            segment.rotation[k] = vec3(0.0f);
+            segment.logScale[k] = 0.0f;
+        }
+        segment.position[0] = count ? poses[0].position : vec3(0.0f);
+        segment.logScale[0] = count ? log(poses[0].scale) : 0.0f;
+        segment.orientation = count ? poses[0].orientation : quat(1, 0, 0, 0);
+        return;
+    }
+
+    // the average velocities of every segment
+    std::vector<vec3> velocities(count - 1);
+    std::vector<vec3> angularVelocities(count - 1);
+    std::vector<vec3> rotations(count - 1);
+    std::vector<vec3> scaleRates(count - 1);
+    std::vector<quat> orientations(count);
+    for (unsigned int i = 0; i < count; i++)
+    {
+        quat q = poses[i].orientation;
+        orientations[i] = q * (1 / sqrt(dot(q, q)));
+        if (i > 0 && dot(orientations[i - 1], orientations[i]) < 0.0f)
+        {
+            orientations[i] *= -1;
+        }
+    }
+    for (unsigned int i = 0; i + 1 < count; i++)
+    {
+        float dt = poses[i + 1].time - poses[i].time;
+        rotations[i] = quatLog(orientations[i + 1] * inverse(orientations[i])) * 2;
+        velocities[i] = (poses[i + 1].position - poses[i].position) / dt;
+        angularVelocities[i] = rotations[i] / dt;
+        scaleRates[i] = vec3(log(poses[i + 1].scale / poses[i].scale) / dt);
+    }
+
+    // the velocities at every pose
+    std::vector<vec3> velocity(count);
+    std::vector<vec3> angularVelocity(count);
+    std::vector<vec3> scaleRate(count);
+    for (unsigned int i = 0; i < count; i++)
+    {
+        float dtprevious = i > 0 ? poses[i].time - poses[i - 1].time : 0.0f;
+        float dtnext = i + 1 < count ? poses[i + 1].time - poses[i].time : 0.0f;
+        unsigned int previous = i > 0 ? i - 1 : 0;
+        unsigned int next = i + 1 < count ? i : count - 2;
+        velocity[i] = splineKnotTangent(velocities[previous], dtprevious, velocities[next], dtnext);
+        angularVelocity[i] = splineKnotTangent(angularVelocities[previous], dtprevious, angularVelocities[next], dtnext);
+        scaleRate[i] = splineKnotTangent(scaleRates[previous], dtprevious, scaleRates[next], dtnext);
+    }
+
+    for (unsigned int i = 0; i + 1 < count; i++)
+    {
+        SplineMotionSegment& segment = spline.segments[i];
+        float dt = poses[i + 1].time - poses[i].time;
+        segment.time = spline.times[i];
+        segment.duration = dt;
+        segment.orientation = orientations[i];
+
+        hermiteCoefficients(poses[i].position, velocity[i] * dt, poses[i + 1].position, velocity[i + 1] * dt, segment.position);
+
+        // at u = 0 the rotation vector is 0, so its derivative is the angular velocity
+        vec3 dr0 = angularVelocity[i] * dt;
+        vec3 dr1 = angularVelocityRotationVector(rotations[i], angularVelocity[i + 1] * dt);
+        hermiteCoefficients(vec3(0.0f), dr0, rotations[i], dr1, segment.rotation);
+
+        vec3 logScale[4];
+        hermiteCoefficients(vec3(log(poses[i].scale)), scaleRate[i] * dt, vec3(log(poses[i + 1].scale)), scaleRate[i + 1] * dt, logScale);
+        for (int k = 0; k < 4; k++)
+        {
+            segment.logScale[k] = logScale[k].x;
+        }
+    }
+}
+
+// The time from the first pose to the last one
+INLINE float splineDuration(const SplineMotion& spline)
+{
+    return spline.times.empty() ? 0.0f : spline.times.back();
+}
+
+// The segment at time t, and the fraction u of the way through it.
+// Times before the first pose or after the last pose are clamped.
+INLINE const SplineMotionSegment& splineSegment(const SplineMotion& spline, float t, float& u)
+{
+    unsigned int segment = (unsigned int)(std::upper_bound(spline.times.begin(), spline.times.end(), t) - spline.times.begin());
+    segment = (unsigned int)max(min((int)segment - 1, (int)spline.segments.size() - 1), 0);
+    u = saturate((t - spline.segments[segment].time) / spline.segments[segment].duration);
+    return spline.segments[segment];
+}
+
+INLINE vec3 polynomial(const vec3 c[4], float u)
+{
+    return c[0] + (c[1] + (c[2] + c[3] * u) * u) * u;
+}
+
+INLINE vec3 polynomialDerivative(const vec3 c[4], float u)
+{
+    return c[1] + (c[2] * 2 + c[3] * (3 * u)) * u;
+}
+
+// The pose of the tool at time t. The pose has the time of the poses the spline was built from.
+INLINE Pose splinePose(const SplineMotion& spline, float t)
+{
+    float u;
+    const SplineMotionSegment& segment = splineSegment(spline, t, u);
+
+    Pose pose;
+    pose.position = polynomial(segment.position, u);
+    pose.orientation = quatExp(polynomial(segment.rotation, u) * 0.5f) * segment.orientation;
+    pose.scale = exp(segment.logScale[0] + (segment.logScale[1] + (segment.logScale[2] + segment.logScale[3] * u) * u) * u);
+    pose.time = spline.startTime + t;
+    return pose;
+}
+
+// The position, velocity, angular velocity (world space, radians per second) and the rate
+// of scaling (d log(scale) / dt) of the tool at time t
+INLINE void splineMotionAt(const SplineMotion& spline, float t, vec3& position, vec3& velocity, vec3& angularVelocity, float& scaleRate)
+{
+    float u;
+    const SplineMotionSegment& segment = splineSegment(spline, t, u);
+    float rcpduration = 1 / segment.duration;
+
+    position = polynomial(segment.position, u);
+    velocity = polynomialDerivative(segment.position, u) * rcpduration;
+    angularVelocity = rotationVectorAngularVelocity(polynomial(segment.rotation, u), polynomialDerivative(segment.rotation, u) * rcpduration);
+    scaleRate = (segment.logScale[1] + (segment.logScale[2] * 2 + segment.logScale[3] * (3 * u)) * u) * rcpduration;
+}
+
+INLINE SplineKelvinletStroke buildSplineKelvinletStroke(const SplineMotion& motion, float stiffness, float compressibility, float radius)
+{
+    SplineKelvinletStroke stroke;
+    stroke.motion = &motion;
+    stroke.translationCalibration = KTranslationCalibrationFactor(radius, compressibility);
+    stroke.twistCalibration = KTwistCalibrationFactor(radius, compressibility);
+    stroke.scaleCalibration = KScaleCalibrationFactor(radius, 0.0f);  // see buildKelvinlet()
+    stroke.radius = radius;
+    stroke.stiffness = stiffness;
+    stroke.compressibility = compressibility;
+    return stroke;
+}
+
+// The Kelvinlet of the tool at time t. This is what buildKelvinlet() would build for
+// an infinitely short motion at time t.
+INLINE Kelvinlet splineKelvinlet(SplineKelvinletStroke stroke, float t)
+{
+    vec3 position;
+    vec3 velocity;
+    vec3 angularVelocity;
+    float scaleRate;
+    splineMotionAt(*stroke.motion, t, position, velocity, angularVelocity, scaleRate);
+
+    Kelvinlet kelvinlet;
+    kelvinlet.origin = position;
+    kelvinlet.linearVelocity = velocity;
+    kelvinlet.forceVector = velocity * stroke.translationCalibration;
+    kelvinlet.twistForceMatrix = skewSymmetric(angularVelocity) * stroke.twistCalibration;
+    kelvinlet.scaleForceMatrix = identityMat3x3() * (scaleRate * stroke.scaleCalibration);
+    kelvinlet.time = t;
+    kelvinlet.dt = 0.0f;
+    kelvinlet.radius = stroke.radius;
+    kelvinlet.stiffness = stroke.stiffness;
+    kelvinlet.compressibility = stroke.compressibility;
+    return kelvinlet;
+}
+
+INLINE vec3
+SplineKEvaluate(float t, vec3 x, SplineKelvinletStroke stroke)
+{
+    return KEvaluate(t, x, splineKelvinlet(stroke, t));
+}
+
+INLINE vec3
+SplineNonElasticEvaluateODE(float t, vec3 x, const SplineMotion& motion)
+{
+    vec3 position;
+    vec3 velocity;
+    vec3 angularVelocity;
+    float scaleRate;
+    splineMotionAt(motion, t, position, velocity, angularVelocity, scaleRate);
+
+    mat3x3 displacementGradientTensor = skewSymmetric(angularVelocity) + identityMat3x3() * scaleRate;
+    return velocity + displacementGradientTensor * (x - position);
+}
+
+#define SCOPE(suffix) IntegrateSplineKelvinlets##suffix
+#define EVALUATE SplineKEvaluate
+#define PARAMETERLIST SplineKelvinletStroke stroke
+#define PARAMETERS stroke
+#include "odesolvers.h"
+#undef PARAMETERS
+#undef PARAMETERLIST
+#undef EVALUATE
+#undef SCOPE
+
+#define SCOPE(suffix) IntegrateSplineNonElastic##suffix
+#define EVALUATE SplineNonElasticEvaluateODE
+#define PARAMETERLIST const SplineMotion& motion
+#define PARAMETERS motion
+#include "odesolvers.h"
+#undef PARAMETERS
+#undef PARAMETERLIST
+#undef EVALUATE
+#undef SCOPE
@@ -0,0 +1,164 @@
+// Copyright(c) Facebook, Inc. and its affiliates.
+// All rights reserved.
+//
+// This source code is licensed under the BSD - style license found in the
+// LICENSE file in the root directory of this source tree.
+
+#pragma once
+
+///////////////////////////////////////////////////////
+// Building a stroke while it is recorded
+//
+// buildDataFromPoses() in test.cpp builds the motions, deformations and
+// Kelvinlets of a whole stroke at once, into vectors that grow. On the
+// tool thread, poses arrive one per frame, and the allocations and
+// copies show up as jitter. StrokeBuffer takes the poses one at a time,
+// and builds only the representations that were asked for, into arrays
+// that are allocated once:
+// - each representation is its own array, so the solvers only touch
+//   the data they use. Within an array, the segments are whole structs:
+//   the solvers take a Motion, Deformation or Kelvinlet (the same as the
+//   shaders), and read all of its fields every step, so splitting the
+//   fields into arrays would only gather them back for every vertex.
+// - the arrays are ring buffers that keep the last capacity segments.
+//   Every segment is written twice, capacity elements apart, so that
+//   the last capacity segments are always contiguous, and a span of
+//   them stays valid until capacity more poses arrive.
+// - flips are fixed as the poses arrive (see fixFlips() in test.cpp),
+//   and the first pose is kept for the move tool
+//   (see buildStartEndPoses() in test.cpp)
+///////////////////////////////////////////////////////
+
+#include <vector>
+
+// The representations a StrokeBuffer builds
+#define STROKEBUFFER_MOTIONS      1
+#define STROKEBUFFER_DEFORMATIONS 2
+#define STROKEBUFFER_KELVINLETS   4
+
+// Poses closer in time than this to the previous pose are dropped
+#define STROKEBUFFER_MIN_DT 1e-5f
+
+class StrokeBuffer
+{
+public:
+    // flags is a combination of STROKEBUFFER_*. The Kelvinlet parameters are only used
+    // with STROKEBUFFER_KELVINLETS.
+    StrokeBuffer(unsigned int flags, unsigned int capacity, float stiffness = 0.0f, float compressibility = 0.0f, float radius = 0.0f)
+        : flags(flags), capacity(max((int)capacity, 1)), stiffness(stiffness), compressibility(compressibility), radius(radius)
+    {
+        if (flags & STROKEBUFFER_MOTIONS)
+        {
+            motionBuffer.resize(2 * this->capacity);
+        }
+        if (flags & STROKEBUFFER_DEFORMATIONS)
+        {
+            deformationBuffer.resize(2 * this->capacity);
+        }
+        if (flags & STROKEBUFFER_KELVINLETS)
+        {
+            kelvinletBuffer.resize(2 * this->capacity);
+        }
+    }
+
+    // Starts a new stroke. This doesn't allocate.
+    void reset()
+    {
+        poseCount = 0;
+        segments = 0;
+    }
+
+    // Adds the next pose of the stroke, and builds the segment from the previous pose.
+    // Returns false if the pose was dropped, because it is at the same time as the previous one.
+    bool addPose(Pose pose)
+    {
+        if (poseCount == 0)
+        {
+            first = pose;
+            last = pose;
+            poseCount = 1;
+            return true;
+        }
+
+        if (pose.time - last.time <= STROKEBUFFER_MIN_DT)
+        {
+            return false;
+        }
+
+        if (dot(last.orientation, pose.orientation) < 0)
+        {
+            pose.orientation *= -1;
+        }
+
+        unsigned int slot = segments % capacity;
+        Motion motion = buildMotion(last, pose);
+        if (flags & STROKEBUFFER_MOTIONS)
+        {
+            motionBuffer[slot] = motion;
+            motionBuffer[slot + capacity] = motion;
+        }
+        if (flags & (STROKEBUFFER_DEFORMATIONS | STROKEBUFFER_KELVINLETS))
+        {
+            Deformation deformation = buildDeformation(motion);
+            if (flags & STROKEBUFFER_DEFORMATIONS)
+            {
+                deformationBuffer[slot] = deformation;
+                deformationBuffer[slot + capacity] = deformation;
+            }
+            if (flags & STROKEBUFFER_KELVINLETS)
+            {
+                Kelvinlet kelvinlet = buildKelvinlet(deformation, stiffness, compressibility, radius);
+                kelvinletBuffer[slot] = kelvinlet;
+                kelvinletBuffer[slot + capacity] = kelvinlet;
+            }
+        }
+
+        last = pose;
+        poseCount++;
+        segments++;
+        return true;
+    }
+
+    // The number of poses and segments since reset(). Segment i goes from pose i to pose i + 1
+    // (of the poses that weren't dropped).
+    unsigned int poses() const { return poseCount; }
+    unsigned int segmentCount() const { return segments; }
+
+    // The oldest segment that is still in the buffer
+    unsigned int firstAvailableSegment() const { return segments > capacity ? segments - capacity : 0; }
+
+    // The first and the latest pose of the stroke, e.g. for the move tool
+    Pose firstPose() const { return first; }
+    Pose lastPose() const { return last; }
+
+    // Returns segments [firstSegment, firstSegment + count) as a contiguous array, or null if
+    // they weren't built or aren't in the buffer any more. The array stays valid until
+    // capacity - (segmentCount() - firstSegment) more poses are added.
+    const Motion* motions(unsigned int firstSegment, unsigned int count) const { return span(motionBuffer, firstSegment, count); }
+    const Deformation* deformations(unsigned int firstSegment, unsigned int count) const { return span(deformationBuffer, firstSegment, count); }
+    const Kelvinlet* kelvinlets(unsigned int firstSegment, unsigned int count) const { return span(kelvinletBuffer, firstSegment, count); }
+
+private:
+    template <typename T>
+    const T* span(const std::vector<T>& buffer, unsigned int firstSegment, unsigned int count) const
+    {
+        if (buffer.empty() || firstSegment < firstAvailableSegment() || firstSegment + count > segments)
+        {
+            return nullptr;
+        }
+        return buffer.data() + firstSegment % capacity;
+    }
+
+    unsigned int             flags;
+    unsigned int             capacity;
+    float                    stiffness;
+    float                    compressibility;
+    float                    radius;
+    std::vector<Motion>      motionBuffer;
+    std::vector<Deformation> deformationBuffer;
+    std::vector<Kelvinlet>   kelvinletBuffer;
+    Pose                     first;
+    Pose                     last;
+    unsigned int             poseCount = 0;
+    unsigned int             segments = 0;
+};
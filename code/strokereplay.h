@@ -0,0 +1,214 @@
+// Copyright(c) Facebook, Inc. and its affiliates.
+// All rights reserved.
+//
+// This source code is licensed under the BSD - style license found in the
+// LICENSE file in the root directory of this source tree.
+
+#pragma once
+
+///////////////////////////////////////////////////////
+// Cache friendly replay of recorded strokes
+//
+// Tests 4 to 7 in test.cpp loop over the vertices, and for every vertex
+// over every frame of the stroke, so every Kelvinlet or Deformation is
+// loaded from memory once per vertex. These functions split the vertices
+// into tiles that fit in the L1 cache, and loop over the frames for a
+// whole tile before moving on to the next tile. The tile stays in the
+// cache, and the frame's constants stay in registers for the whole tile.
+//
+// Kelvinlets fall off quickly away from the tool, so a tile that is far
+// from the path of the tool during a frame doesn't have to be integrated
+// for that frame at all. KelvinletSpeedBound() bounds the speed of the
+// Kelvinlet at a distance, and a tile skips a frame when the largest
+// displacement it could have, added to the frames the tile already
+// skipped, stays under STROKEREPLAY_SKIP_FRACTION of maxerror.
+//
+// Every vertex takes the same steps as the per-vertex loops in the tests
+// for every frame that isn't skipped, so without skipping the results are
+// bit-identical.
+//
+// Needs threadpool.h, and meshBounds() from meshdeformer.h.
+///////////////////////////////////////////////////////
+
+// The number of vertices in a tile: 6KB of positions, which leaves room
+// in a 32KB L1 cache for the frame's constants and the solver's stack
+#define STROKEREPLAY_TILE_VERTICES 512
+
+// The fraction of maxerror that the frames a tile skips may add up to
+#define STROKEREPLAY_SKIP_FRACTION 0.25f
+
+struct StrokeReplayStats
+{
+    unsigned int       tiles;
+    unsigned long long tileFrames;         // the number of (tile, frame) pairs
+    unsigned long long skippedTileFrames;  // the pairs that weren't integrated
+};
+
+// Returns an upper bound of the speed of every point that is at least distance
+// away from the origin of the Kelvinlet. The biscale Kelvinlets are the difference of
+// two Kelvinlets that only differ in radius, so they are bounded by the derivative
+// with respect to the radius, which falls off with the cube of the distance for
+// translation and the sixth power for twist and scale.
+INLINE float KelvinletSpeedBound(const Kelvinlet& kelvinlet, float distance)
+{
+    float a = 1 / (4 * PI * kelvinlet.stiffness);
+    float b = a / (4 * (1 - kelvinlet.compressibility));
+    float bscale = a / 4;  // KScale() uses a compressibility of 0
+
+    float radius0 = kelvinlet.radius;
+#if BISCALE_FALLOFF
+    float radius1 = kelvinlet.radius * BISCALE_RADIUS;
+    float dradius = radius1 - radius0;
+#endif
+
+    float re = sqrt(distance * distance + radius0 * radius0);
+    float re3 = re * re * re;
+    float re6 = re3 * re3;
+
+    float force = length(kelvinlet.forceVector);
+    float twist = sqrt(dot(kelvinlet.twistForceMatrix.cx, kelvinlet.twistForceMatrix.cx) + dot(kelvinlet.twistForceMatrix.cy, kelvinlet.twistForceMatrix.cy) + dot(kelvinlet.twistForceMatrix.cz, kelvinlet.twistForceMatrix.cz));
+    float scale = sqrt(dot(kelvinlet.scaleForceMatrix.cx, kelvinlet.scaleForceMatrix.cx) + dot(kelvinlet.scaleForceMatrix.cy, kelvinlet.scaleForceMatrix.cy) + dot(kelvinlet.scaleForceMatrix.cz, kelvinlet.scaleForceMatrix.cz));
+
+#if BISCALE_FALLOFF
+    float translation = force * dradius * radius1 * (fabs(a - b) + 3 * fabs(b) + a + 1.5f * a * radius1 * radius1 / (re * re)) / re3;
+    float affine = (a * twist + fabs(2 * bscale - a) * scale) * dradius * 7.5f * radius1 * radius1 * radius1 / re6;
+#else
+    float translation = force * (fabs(a - b) + fabs(b) + a * radius0 * radius0 / (2 * re * re)) / re;
+    float affine = (a * twist + fabs(2 * bscale - a) * scale) * 2.5f / (re * re);
+#endif
+    return translation + affine;
+}
+
+// The distance from a point to the segment from p0 to p1
+INLINE float strokeReplaySegmentDistance(vec3 point, vec3 p0, vec3 p1)
+{
+    vec3 segment = p1 - p0;
+    float lengthSquared = dot(segment, segment);
+    float s = lengthSquared > 0.0f ? saturate(dot(point - p0, segment) / lengthSquared) : 0.0f;
+    return length(point - (p0 + segment * s));
+}
+
+// Deforms positions with every Kelvinlet of a stroke, in order, with a single RK4 step per
+// frame, like test 6. Tiles skip the frames that can't move them by more than their share
+// of maxerror.
+INLINE StrokeReplayStats
+IntegrateKelvinletStrokeTiled_RungeKutta(ThreadPool& pool, vec3* positions, unsigned int vertexCount, float maxerror,
+                                         const Kelvinlet* kelvinlets, unsigned int frameCount)
+{
+    unsigned int tileCount = (vertexCount + STROKEREPLAY_TILE_VERTICES - 1) / STROKEREPLAY_TILE_VERTICES;
+    std::vector<unsigned int> skipped(tileCount);
+
+    pool.parallelFor(0, tileCount, [&](unsigned int tile)
+    {
+        unsigned int first = tile * STROKEREPLAY_TILE_VERTICES;
+        unsigned int last = min((int)(first + STROKEREPLAY_TILE_VERTICES), (int)vertexCount);
+
+        vec3 center;
+        float radius;
+        meshBounds(positions, first, last, center, radius);
+
+        float budget = STROKEREPLAY_SKIP_FRACTION * maxerror;
+        for (unsigned int frame = 0; frame < frameCount; frame++)
+        {
+            const Kelvinlet kelvinlet = kelvinlets[frame];
+
+            // the swept volume of the tool during the frame, against the tile's bounds
+            vec3 start = kelvinlet.origin;
+            vec3 end = kelvinlet.origin + kelvinlet.linearVelocity * kelvinlet.dt;
+            float distance = max(strokeReplaySegmentDistance(center, start, end) - radius, 0.0f);
+            float displacement = KelvinletSpeedBound(kelvinlet, distance) * kelvinlet.dt;
+            if (displacement <= budget)
+            {
+                budget -= displacement;
+                skipped[tile]++;
+                continue;
+            }
+
+            for (unsigned int i = first; i < last; i++)
+            {
+                positions[i] = IntegrateKelvinlets_RungeKutta(positions[i], kelvinlet.time, kelvinlet.time + kelvinlet.dt, kelvinlet);
+            }
+            meshBounds(positions, first, last, center, radius);
+        }
+    });
+
+    StrokeReplayStats stats;
+    stats.tiles = tileCount;
+    stats.tileFrames = (unsigned long long)tileCount * frameCount;
+    stats.skippedTileFrames = 0;
+    for (unsigned int tile = 0; tile < tileCount; tile++)
+    {
+        stats.skippedTileFrames += skipped[tile];
+    }
+    return stats;
+}
+
+// Deforms positions with every Deformation of a stroke, in order, like test 4: vertex i
+// follows the stroke for falloffs[i] of its duration, with a single RK4 step per frame.
+// A tile stops at the frame where its last vertex stops, and tiles where every falloff
+// is 0 are skipped entirely. The results are bit-identical to test 4.
+INLINE StrokeReplayStats
+IntegrateNonElasticStrokeTiled_RungeKutta(ThreadPool& pool, vec3* positions, const float* falloffs, unsigned int vertexCount,
+                                          const Deformation* deformations, unsigned int frameCount)
+{
+    unsigned int tileCount = (vertexCount + STROKEREPLAY_TILE_VERTICES - 1) / STROKEREPLAY_TILE_VERTICES;
+    std::vector<unsigned int> skipped(tileCount);
+
+    if (frameCount == 0)
+    {
+        StrokeReplayStats stats = { tileCount, 0, 0 };
+        return stats;
+    }
+
+    float starttime = deformations[0].time;
+    float endtime = deformations[frameCount - 1].time + deformations[frameCount - 1].dt;
+
+    pool.parallelFor(0, tileCount, [&](unsigned int tile)
+    {
+        unsigned int first = tile * STROKEREPLAY_TILE_VERTICES;
+        unsigned int last = min((int)(first + STROKEREPLAY_TILE_VERTICES), (int)vertexCount);
+
+        // every vertex keeps its own time, so that it takes exactly the steps of test 4
+        float t[STROKEREPLAY_TILE_VERTICES];
+        float maxt[STROKEREPLAY_TILE_VERTICES];
+        for (unsigned int i = first; i < last; i++)
+        {
+            t[i - first] = starttime;
+            maxt[i - first] = falloffs[i] > 0.0f ? lerp(starttime, endtime, falloffs[i]) : starttime;
+        }
+
+        unsigned int frame = 0;
+        for (; frame < frameCount; frame++)
+        {
+            const Deformation deformation = deformations[frame];
+
+            bool active = false;
+            for (unsigned int i = first; i < last; i++)
+            {
+                unsigned int v = i - first;
+                if (t[v] < maxt[v])
+                {
+                    float dt = min(maxt[v] - t[v], deformation.dt);
+                    positions[i] = IntegrateNonElastic_RungeKutta(positions[i], t[v], t[v] + dt, deformation);
+                    t[v] += dt;
+                    active = true;
+                }
+            }
+            if (!active)
+            {
+                break;
+            }
+        }
+        skipped[tile] = frameCount - frame;
+    });
+
+    StrokeReplayStats stats;
+    stats.tiles = tileCount;
+    stats.tileFrames = (unsigned long long)tileCount * frameCount;
+    stats.skippedTileFrames = 0;
+    for (unsigned int tile = 0; tile < tileCount; tile++)
+    {
+        stats.skippedTileFrames += skipped[tile];
+    }
+    return stats;
+}
@@ -0,0 +1,140 @@
+// Copyright(c) Facebook, Inc. and its affiliates.
+// All rights reserved.
+//
+// This source code is licensed under the BSD - style license found in the
+// LICENSE file in the root directory of this source tree.
+
+#pragma once
+
+///////////////////////////////////////////////////////
+// Simplifying recorded strokes
+//
+// A recorded stroke has a pose for every frame of the controller, so
+// replaying it integrates hundreds of nearly identical Kelvinlets a
+// second. buildMotion() moves the tool with constant velocity between
+// two poses, so poses that are already (nearly) on that path add
+// nothing. simplifyStroke() merges consecutive segments of a stroke
+// while every pose it removes is within a tolerance of where the merged
+// motion puts the tool at the same time, measured at the radius of the
+// brush, which is where the deformation follows the tool.
+//
+// It also drops the segments that can't be integrated, or don't need
+// to be: two poses at the same time (buildMotion() divides by the time
+// between them), and segments where the tool doesn't move.
+///////////////////////////////////////////////////////
+
+#include <vector>
+
+// Poses closer in time than this are treated as the same time
+#define STROKESIMPLIFY_MIN_DT 1e-5f
+
+// A segment that moves the tool by less than this fraction of the tolerance is dropped
+#define STROKESIMPLIFY_ZERO_MOTION_FRACTION 0.01f
+
+// The motion from poses[first] to poses[last] of the original stroke
+struct StrokeSegment
+{
+    unsigned int first;
+    unsigned int last;
+};
+
+struct StrokeSimplification
+{
+    unsigned int inputSegments;    // the number of pairs of consecutive poses
+    unsigned int outputSegments;
+    unsigned int droppedSegments;  // merged segments that were dropped for not moving, and poses at the same time
+    float        reductionRatio;   // inputSegments / outputSegments
+};
+
+// The pose that buildMotion(start, end) moves the tool to at time t
+INLINE Pose interpolateMotionPose(Pose start, Pose end, float t)
+{
+    float f = (t - start.time) / (end.time - start.time);
+
+    quat rotation = end.orientation * inverse(start.orientation);
+    vec3 axis;
+    float angle;
+    rotation.toAxisAngle(axis, angle);
+
+    Pose pose;
+    pose.position = start.position + (end.position - start.position) * f;
+    if (angle == 0.0f)
+    {
+        pose.orientation = start.orientation;
+    }
+    else
+    {
+        float halfangle = angle * f * 0.5f;
+        vec3 v = axis * sin(halfangle);
+        pose.orientation = quat(cos(halfangle), v.x, v.y, v.z) * start.orientation;
+    }
+    pose.scale = start.scale * pow(end.scale / start.scale, f);
+    pose.time = t;
+    return pose;
+}
+
+// How far apart a and b put the points at radius from the tool's origin
+INLINE float poseDistance(Pose a, Pose b, float radius)
+{
+    float d = dot(a.orientation, b.orientation) / sqrt(dot(a.orientation, a.orientation) * dot(b.orientation, b.orientation));
+    float angle = 2 * acos(min(fabs(d), 1.0f));
+    return length(a.position - b.position) + radius * (angle + fabs(log(a.scale / b.scale)));
+}
+
+// Writes the segments of the simplified stroke. Use buildMotion(poses[segment.first], poses[segment.last]).
+// Every pose that a segment skips is within tolerance of where that segment puts the tool;
+// a tolerance of maxerror (see README.md) keeps the simplification invisible.
+// The poses should not have flips (see fixFlips() in test.cpp).
+INLINE StrokeSimplification simplifyStroke(const Pose* poses, unsigned int count, float radius, float tolerance, std::vector<StrokeSegment>& segments)
+{
+    StrokeSimplification result;
+    result.inputSegments = count > 1 ? count - 1 : 0;
+    result.droppedSegments = 0;
+
+    segments.clear();
+
+    unsigned int anchor = 0;
+    while (anchor + 1 < count)
+    {
+        // a pose at the same time as the anchor replaces it
+        if (poses[anchor + 1].time - poses[anchor].time <= STROKESIMPLIFY_MIN_DT)
+        {
+            result.droppedSegments++;
+            anchor++;
+            continue;
+        }
+
+        // extend the segment while every pose it skips stays within tolerance
+        unsigned int end = anchor + 1;
+        while (end + 1 < count)
+        {
+            unsigned int candidate = end + 1;
+            bool fits = poses[candidate].time - poses[end].time > STROKESIMPLIFY_MIN_DT;
+            for (unsigned int k = anchor + 1; fits && k < candidate; k++)
+            {
+                Pose expected = interpolateMotionPose(poses[anchor], poses[candidate], poses[k].time);
+                fits = poseDistance(expected, poses[k], radius) <= tolerance;
+            }
+            if (!fits)
+            {
+                break;
+            }
+            end = candidate;
+        }
+
+        if (poseDistance(poses[anchor], poses[end], radius) < tolerance * STROKESIMPLIFY_ZERO_MOTION_FRACTION)
+        {
+            result.droppedSegments++;
+        }
+        else
+        {
+            StrokeSegment segment = { anchor, end };
+            segments.push_back(segment);
+        }
+        anchor = end;
+    }
+
+    result.outputSegments = (unsigned int)segments.size();
+    result.reductionRatio = result.outputSegments > 0 ? (float)result.inputSegments / result.outputSegments : 0.0f;
+    return result;
+}
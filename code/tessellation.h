@@ -0,0 +1,218 @@
+// Copyright(c) Facebook, Inc. and its affiliates.
+// All rights reserved.
+//
+// This source code is licensed under the BSD - style license found in the
+// LICENSE file in the root directory of this source tree.
+
+#pragma once
+
+///////////////////////////////////////////////////////
+// Splitting the triangles that a stroke stretches
+//
+// A large drag stretches the triangles near the tool, so sculpts are
+// usually tessellated finely everywhere, in case a stroke reaches them,
+// and every stroke integrates all those vertices. AdaptiveTessellator
+// refines the mesh after every stroke instead, only where the stroke
+// stretched it: an edge is split when it is longer than the largest edge
+// length, and the stroke made it longer by more than the largest stretch.
+// A triangle with one, two or three split edges is split in two, three
+// or four, so the mesh stays watertight.
+//
+// The new vertex of an edge isn't put at the middle of the deformed edge,
+// which is a chord of the curve the stroke bent the edge into. It is put
+// at the middle of the edge from before the stroke, and moved with the
+// flow of the stroke, so it lands where the stroke would have moved a
+// vertex that was there. The edges are split again, with the new
+// vertices, until none is stretched, or TESSELLATION_MAX_PASSES.
+//
+// Splits and deforms the new vertices with meshdeformer.h; include it and
+// threadpool.h first.
+///////////////////////////////////////////////////////
+
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+// The most times an edge and the edges it is split into can be split after a stroke
+#define TESSELLATION_MAX_PASSES 4
+
+struct TessellationStats
+{
+    unsigned int passes;           // the passes that split edges
+    unsigned int splitEdges;
+    unsigned int addedVertices;
+    unsigned int addedTriangles;
+    unsigned int stretchedEdges;   // the edges that are still stretched, after TESSELLATION_MAX_PASSES
+};
+
+class AdaptiveTessellator
+{
+public:
+    // An edge is split when it is longer than maxEdgeLength after the stroke, and maxStretch
+    // times longer than before it
+    AdaptiveTessellator(float maxEdgeLength, float maxStretch)
+        : maxEdgeLength(maxEdgeLength), maxStretch(maxStretch)
+    {
+    }
+
+    // Splits the edges that the stroke stretched. before are the positions from before the stroke,
+    // after are the positions it moved them to, and stroke is its flow, from before to after. The
+    // new vertices are added to both.
+    TessellationStats refine(ThreadPool& pool, std::vector<vec3>& before, std::vector<vec3>& after, std::vector<unsigned int>& indices, const MeshSolver& stroke)
+    {
+        TessellationStats stats = {};
+        for (unsigned int pass = 0; pass < TESSELLATION_MAX_PASSES; pass++)
+        {
+            unsigned int splitEdges = findStretchedEdges(pool, before, after, indices);
+            if (splitEdges == 0)
+            {
+                middles.clear();
+                return stats;
+            }
+
+            // the new vertices, at the middle of their edges before the stroke
+            unsigned int firstNew = (unsigned int)before.size();
+            before.resize(firstNew + splitEdges);
+            after.resize(firstNew + splitEdges);
+            for (const auto& edge : middles)
+            {
+                unsigned int a = (unsigned int)(edge.first >> 32);
+                unsigned int b = (unsigned int)(edge.first & 0xffffffff);
+                before[edge.second] = (before[a] + before[b]) * 0.5f;
+            }
+            deformMesh(pool, before.data() + firstNew, after.data() + firstNew, splitEdges, stroke);
+
+            unsigned int triangleCount = (unsigned int)indices.size() / 3;
+            splitTriangles(indices);
+            stats.passes++;
+            stats.splitEdges += splitEdges;
+            stats.addedVertices += splitEdges;
+            stats.addedTriangles += (unsigned int)indices.size() / 3 - triangleCount;
+        }
+
+        stats.stretchedEdges = findStretchedEdges(pool, before, after, indices);
+        middles.clear();
+        return stats;
+    }
+
+private:
+    static unsigned long long edgeKey(unsigned int a, unsigned int b)
+    {
+        return a < b ? ((unsigned long long)a << 32) | b : ((unsigned long long)b << 32) | a;
+    }
+
+    bool stretched(const std::vector<vec3>& before, const std::vector<vec3>& after, unsigned int a, unsigned int b) const
+    {
+        float length = distance(after[a], after[b]);
+        return length > maxEdgeLength && length > maxStretch * distance(before[a], before[b]);
+    }
+
+    // Finds the edges to split, and gives each the index of its new vertex. Returns how many.
+    unsigned int findStretchedEdges(ThreadPool& pool, const std::vector<vec3>& before, const std::vector<vec3>& after, const std::vector<unsigned int>& indices)
+    {
+        // every triangle checks its edges, and the edges are numbered in order of triangle
+        unsigned int triangleCount = (unsigned int)indices.size() / 3;
+        splits.resize(triangleCount);
+        forEachMeshChunk(pool, triangleCount, [&](unsigned int, unsigned int first, unsigned int last)
+        {
+            for (unsigned int t = first; t < last; t++)
+            {
+                splits[t] = 0;
+                for (unsigned int e = 0; e < 3; e++)
+                {
+                    if (stretched(before, after, indices[t * 3 + e], indices[t * 3 + (e + 1) % 3]))
+                    {
+                        splits[t] |= 1 << e;
+                    }
+                }
+            }
+        });
+
+        middles.clear();
+        unsigned int next = (unsigned int)before.size();
+        for (unsigned int t = 0; t < triangleCount; t++)
+        {
+            for (unsigned int e = 0; e < 3; e++)
+            {
+                if (splits[t] & (1 << e))
+                {
+                    unsigned long long key = edgeKey(indices[t * 3 + e], indices[t * 3 + (e + 1) % 3]);
+                    if (middles.find(key) == middles.end())
+                    {
+                        middles[key] = next++;
+                    }
+                }
+            }
+        }
+        return next - (unsigned int)before.size();
+    }
+
+    // Splits every triangle with split edges in two, three or four
+    void splitTriangles(std::vector<unsigned int>& indices)
+    {
+        unsigned int triangleCount = (unsigned int)indices.size() / 3;
+        for (unsigned int t = 0; t < triangleCount; t++)
+        {
+            if (splits[t] == 0)
+            {
+                continue;
+            }
+
+            unsigned int v[3] = { indices[t * 3 + 0], indices[t * 3 + 1], indices[t * 3 + 2] };
+            unsigned int m[3];
+            unsigned int count = 0;
+            for (unsigned int e = 0; e < 3; e++)
+            {
+                m[e] = (splits[t] & (1 << e)) ? middles[edgeKey(v[e], v[(e + 1) % 3])] : ~0u;
+                count += (splits[t] & (1 << e)) ? 1 : 0;
+            }
+
+            // the triangle is rotated so that its split edges come first, and the edge after them isn't split
+            unsigned int r = 0;
+            while (count < 3 && (m[r] == ~0u || m[(r + count) % 3] != ~0u))
+            {
+                r++;
+            }
+            unsigned int a = v[r], b = v[(r + 1) % 3], c = v[(r + 2) % 3];
+            unsigned int mab = m[r], mbc = m[(r + 1) % 3], mca = m[(r + 2) % 3];
+
+            if (count == 1)
+            {
+                setTriangle(indices, t, a, mab, c);
+                addTriangle(indices, mab, b, c);
+            }
+            else if (count == 2)
+            {
+                setTriangle(indices, t, mab, b, mbc);
+                addTriangle(indices, a, mab, mbc);
+                addTriangle(indices, a, mbc, c);
+            }
+            else
+            {
+                setTriangle(indices, t, mab, mbc, mca);
+                addTriangle(indices, a, mab, mca);
+                addTriangle(indices, mab, b, mbc);
+                addTriangle(indices, mca, mbc, c);
+            }
+        }
+    }
+
+    static void setTriangle(std::vector<unsigned int>& indices, unsigned int t, unsigned int a, unsigned int b, unsigned int c)
+    {
+        indices[t * 3 + 0] = a;
+        indices[t * 3 + 1] = b;
+        indices[t * 3 + 2] = c;
+    }
+
+    static void addTriangle(std::vector<unsigned int>& indices, unsigned int a, unsigned int b, unsigned int c)
+    {
+        indices.push_back(a);
+        indices.push_back(b);
+        indices.push_back(c);
+    }
+
+    float                                                maxEdgeLength;
+    float                                                maxStretch;
+    std::vector<unsigned char>                           splits;    // the stretched edges of every triangle, one bit each
+    std::unordered_map<unsigned long long, unsigned int> middles;   // the new vertex of every split edge
+};
@@ -0,0 +1,312 @@
+// Copyright(c) Facebook, Inc. and its affiliates.
+// All rights reserved.
+//
+// This source code is licensed under the BSD - style license found in the
+// LICENSE file in the root directory of this source tree.
+
+#pragma once
+
+///////////////////////////////////////////////////////
+// A small work-stealing thread pool for running the solvers on the CPU
+//
+// Every worker has its own queue of tasks. A worker runs the newest
+// task of its own queue, and when that is empty, steals the oldest
+// task of another worker's queue.
+//
+// parallelFor() gives every thread that helps a contiguous range of
+// the indices. A thread that finishes its range steals the back half
+// of another thread's range, so the work stays balanced even when the
+// cost of the indices varies a lot (the adaptive solvers can take 100x
+// longer near the tool than far away from it), and the indices a
+// thread runs stay mostly contiguous.
+///////////////////////////////////////////////////////
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// The number of threads for work that runs beside the application's own thread: one per
+// hardware thread, less one for the application
+INLINE unsigned int backgroundThreadCount()
+{
+    return max((int)std::thread::hardware_concurrency() - 1, 1);
+}
+
+class ThreadPool
+{
+public:
+    // threadCount of 0 uses one thread per hardware thread
+    explicit ThreadPool(unsigned int threadCount = 0)
+    {
+        if (threadCount == 0)
+        {
+            threadCount = max((int)std::thread::hardware_concurrency(), 1);
+        }
+
+        for (unsigned int i = 0; i < threadCount; i++)
+        {
+            queues.emplace_back(new Queue());
+        }
+        for (unsigned int i = 0; i < threadCount; i++)
+        {
+            workers.emplace_back([this, i]() { workerLoop(i); });
+        }
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            stopping = true;
+        }
+        wakeup.notify_all();
+        for (std::thread& worker : workers)
+        {
+            worker.join();
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // the queues are all created before the first worker starts, so workers can use this too
+    unsigned int threadCount() const { return (unsigned int)queues.size(); }
+
+    // Calls fn(i) for every i in [begin, end), and returns when all calls are done.
+    // The calling thread helps, so this may be called from inside a task.
+    void parallelFor(unsigned int begin, unsigned int end, const std::function<void(unsigned int)>& fn)
+    {
+        if (begin >= end)
+        {
+            return;
+        }
+
+        // the caller is participant 0, and every helper task is one more
+        unsigned int participants = min((int)(end - begin), (int)threadCount() + 1);
+        std::vector<Range> ranges(participants);
+        for (unsigned int p = 0; p < participants; p++)
+        {
+            unsigned int first = begin + (unsigned int)((unsigned long long)(end - begin) * p / participants);
+            unsigned int last = begin + (unsigned int)((unsigned long long)(end - begin) * (p + 1) / participants);
+            ranges[p].bounds = packRange(first, last);
+        }
+
+        auto work = [&](unsigned int p)
+        {
+            for (;;)
+            {
+                unsigned int i;
+                if (popFront(ranges[p], i))
+                {
+                    fn(i);
+                }
+                else if (!stealHalf(ranges.data(), participants, p))
+                {
+                    return;
+                }
+            }
+        };
+
+        // the helpers reference our locals, so we can't return until all of them are done
+        unsigned int helpers = participants - 1;
+        std::atomic<unsigned int> pending(helpers);
+        for (unsigned int p = 1; p <= helpers; p++)
+        {
+            submit([&, p]()
+            {
+                work(p);
+                pending--;
+            });
+        }
+        work(0);
+
+        while (pending > 0)
+        {
+            if (!runOne(currentWorker()))
+            {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+private:
+    struct Queue
+    {
+        std::mutex                        mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    // [first, last) packed into one word, so that the owner taking from the front
+    // and a thief taking the back half can't both take the same index
+    struct Range
+    {
+        std::atomic<unsigned long long> bounds;
+        char padding[64 - sizeof(std::atomic<unsigned long long>)];  // one cache line per range
+    };
+
+    static unsigned long long packRange(unsigned int first, unsigned int last)
+    {
+        return ((unsigned long long)first << 32) | last;
+    }
+
+    static bool popFront(Range& range, unsigned int& index)
+    {
+        unsigned long long bounds = range.bounds;
+        for (;;)
+        {
+            unsigned int first = (unsigned int)(bounds >> 32);
+            unsigned int last = (unsigned int)bounds;
+            if (first >= last)
+            {
+                return false;
+            }
+            if (range.bounds.compare_exchange_weak(bounds, packRange(first + 1, last)))
+            {
+                index = first;
+                return true;
+            }
+        }
+    }
+
+    // Moves the back half of the largest other range into ranges[thief], which is empty.
+    // Returns false when there is nothing left to steal.
+    static bool stealHalf(Range* ranges, unsigned int count, unsigned int thief)
+    {
+        for (;;)
+        {
+            unsigned int victim = count;
+            unsigned long long victimBounds = 0;
+            unsigned int largest = 0;
+            for (unsigned int n = 1; n < count; n++)
+            {
+                unsigned int p = (thief + n) % count;
+                unsigned long long bounds = ranges[p].bounds;
+                unsigned int size = (unsigned int)bounds - (unsigned int)(bounds >> 32);
+                if ((unsigned int)(bounds >> 32) < (unsigned int)bounds && size > largest)
+                {
+                    victim = p;
+                    victimBounds = bounds;
+                    largest = size;
+                }
+            }
+            if (victim == count)
+            {
+                return false;
+            }
+
+            unsigned int first = (unsigned int)(victimBounds >> 32);
+            unsigned int last = (unsigned int)victimBounds;
+            unsigned int middle = first + (last - first) / 2;
+            if (ranges[victim].bounds.compare_exchange_strong(victimBounds, packRange(first, middle)))
+            {
+                ranges[thief].bounds = packRange(middle, last);
+                return true;
+            }
+        }
+    }
+
+    // the index of the pool's worker that is running on this thread, or threadCount() on any other thread
+    unsigned int currentWorker() const
+    {
+        return currentPool() == this ? currentIndex() : threadCount();
+    }
+
+    static const ThreadPool*& currentPool()
+    {
+        static thread_local const ThreadPool* pool = nullptr;
+        return pool;
+    }
+
+    static unsigned int& currentIndex()
+    {
+        static thread_local unsigned int index = 0;
+        return index;
+    }
+
+    // Tasks submitted by a worker go to its own queue, so they are likely to run on the
+    // same core. Tasks submitted by any other thread are spread over the queues.
+    void submit(std::function<void()> task)
+    {
+        unsigned int home = currentWorker();
+        if (home == threadCount())
+        {
+            home = nextQueue++ % threadCount();
+        }
+        queued++;
+        {
+            std::lock_guard<std::mutex> lock(queues[home]->mutex);
+            queues[home]->tasks.push_back(std::move(task));
+        }
+        {
+            // a worker checks queued while holding sleepMutex, so this can't be missed
+            std::lock_guard<std::mutex> lock(sleepMutex);
+        }
+        wakeup.notify_one();
+    }
+
+    // Runs the newest task of queue home, or else the oldest task of any other queue,
+    // on the calling thread. home may be threadCount(), which only steals.
+    bool runOne(unsigned int home)
+    {
+        std::function<void()> task;
+        if (home < threadCount())
+        {
+            std::lock_guard<std::mutex> lock(queues[home]->mutex);
+            if (!queues[home]->tasks.empty())
+            {
+                task = std::move(queues[home]->tasks.back());
+                queues[home]->tasks.pop_back();
+            }
+        }
+        for (unsigned int n = 1; !task && n <= threadCount(); n++)
+        {
+            unsigned int victim = (home + n) % threadCount();
+            std::lock_guard<std::mutex> lock(queues[victim]->mutex);
+            if (!queues[victim]->tasks.empty())
+            {
+                task = std::move(queues[victim]->tasks.front());
+                queues[victim]->tasks.pop_front();
+            }
+        }
+        if (!task)
+        {
+            return false;
+        }
+        queued--;
+        task();
+        return true;
+    }
+
+    void workerLoop(unsigned int index)
+    {
+        currentPool() = this;
+        currentIndex() = index;
+        for (;;)
+        {
+            if (runOne(index))
+            {
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(sleepMutex);
+            wakeup.wait(lock, [this]() { return stopping || queued > 0; });
+            if (stopping && queued == 0)
+            {
+                return;
+            }
+        }
+    }
+
+    std::vector<std::thread>            workers;
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::atomic<unsigned int>           queued{0};
+    std::atomic<unsigned int>           nextQueue{0};
+    std::mutex                          sleepMutex;
+    std::condition_variable             wakeup;
+    bool                                stopping = false;
+};
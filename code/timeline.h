@@ -0,0 +1,211 @@
+// Copyright(c) Facebook, Inc. and its affiliates.
+// All rights reserved.
+//
+// This source code is licensed under the BSD - style license found in the
+// LICENSE file in the root directory of this source tree.
+
+#pragma once
+
+///////////////////////////////////////////////////////
+// Scrubbing through the replay of a recorded stroke
+//
+// Seeking to a frame of a recorded stroke by replaying every Kelvinlet
+// from the first frame, like tests 6 and 7, takes longer the longer the
+// session is. ReplayTimeline keeps checkpoints of the mesh as it plays
+// forward, compressed against the rest positions (see vertexcodec.h). A
+// seek restores the nearest checkpoint before the frame, and only
+// replays the frames after it; playing continues forward from there.
+//
+// The checkpoints are spaced by the time it takes to replay the frames
+// between them, not by a number of frames. Every checkpoint is taken
+// once the frames since the last one took the checkpoint interval to
+// replay. When the checkpoints don't fit in the memory budget anymore,
+// every other checkpoint is forgotten, which about doubles the interval.
+// So a seek replays for about the interval at most, whatever the length
+// of the session, and the interval is as short as the budget allows.
+//
+// Every frame is a single RK4 step per vertex, like test 6, so the
+// positions at every frame are bit-identical to replaying from the
+// first frame.
+//
+// Include threadpool.h, meshdeformer.h and vertexcodec.h (for
+// vertexDeltaBits()) first.
+///////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+struct TimelineStats
+{
+    unsigned int checkpoints;
+    size_t       checkpointBytes;
+    double       intervalSeconds;   // the replay time between checkpoints
+    unsigned int lastSeekFrames;    // the frames that the last seek replayed
+    double       lastSeekSeconds;
+};
+
+class ReplayTimeline
+{
+public:
+    // rest and kelvinlets must stay valid. budgetBytes is the memory the checkpoints can use.
+    ReplayTimeline(const vec3* rest, unsigned int vertexCount, const Kelvinlet* kelvinlets, unsigned int frameCount, size_t budgetBytes)
+        : rest(rest), kelvinlets(kelvinlets), frameCount(frameCount), budget(budgetBytes), positions(rest, rest + vertexCount)
+    {
+    }
+
+    // Moves to frame, after the first frame Kelvinlets are applied, and returns the positions
+    const vec3* seek(ThreadPool& pool, unsigned int frame)
+    {
+        auto start = std::chrono::steady_clock::now();
+        frame = min((int)frame, (int)frameCount);
+
+        // restore the last checkpoint before frame, unless playing forward from here is closer
+        unsigned int restored = 0;
+        const Checkpoint* checkpoint = nullptr;
+        for (const Checkpoint& c : checkpoints)
+        {
+            if (c.frame <= frame)
+            {
+                restored = c.frame;
+                checkpoint = &c;
+            }
+        }
+        if (current > frame || current < restored)
+        {
+            if (checkpoint)
+            {
+                bits.resize(positions.size() * 3);
+                decodeVertexBits(checkpoint->compressed.data(), (unsigned int)bits.size(), bits.data());
+                vertexFromDeltaBits(bits.data(), rest, (unsigned int)positions.size(), positions.data());
+            }
+            else
+            {
+                std::copy(rest, rest + positions.size(), positions.begin());
+            }
+            current = restored;
+        }
+
+        lastSeekFrames = frame - current;
+        while (current < frame)
+        {
+            step(pool);
+        }
+        lastSeekSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return positions.data();
+    }
+
+    // Plays the next frame, and returns the positions
+    const vec3* play(ThreadPool& pool)
+    {
+        if (current < frameCount)
+        {
+            step(pool);
+        }
+        return positions.data();
+    }
+
+    const vec3* currentPositions() const { return positions.data(); }
+    unsigned int currentFrame() const { return current; }
+
+    TimelineStats stats() const
+    {
+        TimelineStats stats = {};
+        stats.checkpoints = (unsigned int)checkpoints.size();
+        stats.checkpointBytes = checkpointBytes();
+        stats.intervalSeconds = interval;
+        stats.lastSeekFrames = lastSeekFrames;
+        stats.lastSeekSeconds = lastSeekSeconds;
+        return stats;
+    }
+
+private:
+    struct Checkpoint
+    {
+        unsigned int               frame;
+        double                     seconds;     // the replay time from the first frame
+        std::vector<unsigned char> compressed;
+    };
+
+    // Replays the current frame, and takes a checkpoint after it if it's time to
+    void step(ThreadPool& pool)
+    {
+        auto start = std::chrono::steady_clock::now();
+        const Kelvinlet& kelvinlet = kelvinlets[current];
+        deformMesh(pool, positions.data(), (unsigned int)positions.size(), [&](vec3 position)
+        {
+            return IntegrateKelvinlets_RungeKutta(position, kelvinlet.time, kelvinlet.time + kelvinlet.dt, kelvinlet);
+        });
+        current++;
+
+        // the checkpoints are taken the first time the frames are played
+        if (current <= frontier)
+        {
+            return;
+        }
+        frontier = current;
+        frontierSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        double last = checkpoints.empty() ? 0.0 : checkpoints.back().seconds;
+        if (frontierSeconds - last >= interval && current < frameCount)
+        {
+            addCheckpoint();
+        }
+    }
+
+    void addCheckpoint()
+    {
+        Checkpoint checkpoint;
+        checkpoint.frame = current;
+        checkpoint.seconds = frontierSeconds;
+        bits.resize(positions.size() * 3);
+        vertexDeltaBits(positions.data(), rest, (unsigned int)positions.size(), bits.data());
+        encodeVertexBits(bits.data(), (unsigned int)bits.size(), checkpoint.compressed);
+        checkpoint.compressed.shrink_to_fit();
+        checkpoints.push_back(std::move(checkpoint));
+
+        while (checkpointBytes() > budget && !checkpoints.empty())
+        {
+            // forget every other checkpoint, and take them as far apart as the ones that are left
+            std::vector<Checkpoint> kept;
+            for (unsigned int c = 1; c < checkpoints.size(); c += 2)
+            {
+                kept.push_back(std::move(checkpoints[c]));
+            }
+            checkpoints.swap(kept);
+
+            double previous = 0.0;
+            for (const Checkpoint& c : checkpoints)
+            {
+                if (c.seconds - previous > interval)
+                {
+                    interval = c.seconds - previous;
+                }
+                previous = c.seconds;
+            }
+        }
+    }
+
+    size_t checkpointBytes() const
+    {
+        size_t bytes = 0;
+        for (const Checkpoint& checkpoint : checkpoints)
+        {
+            bytes += checkpoint.compressed.size();
+        }
+        return bytes;
+    }
+
+    const vec3*               rest;
+    const Kelvinlet*          kelvinlets;
+    unsigned int              frameCount;
+    size_t                    budget;
+    std::vector<vec3>         positions;
+    unsigned int              current = 0;      // the frames applied to positions
+    std::vector<Checkpoint>   checkpoints;      // in order of frame
+    double                    interval = 0.0;   // the replay time between checkpoints
+    unsigned int              frontier = 0;     // the last frame that was played
+    double                    frontierSeconds = 0.0;  // the replay time from the first frame to frontier
+    std::vector<unsigned int> bits;
+    unsigned int              lastSeekFrames = 0;
+    double                    lastSeekSeconds = 0.0;
+};
@@ -0,0 +1,150 @@
+// Copyright(c) Facebook, Inc. and its affiliates.
+// All rights reserved.
+//
+// This source code is licensed under the BSD - style license found in the
+// LICENSE file in the root directory of this source tree.
+
+#pragma once
+
+///////////////////////////////////////////////////////
+// Spatially varying error tolerance
+//
+// maxerror is one world space value for the whole mesh, so the
+// adaptive solvers spend as much effort on vertices behind the camera,
+// or far away from the tool, as on the vertices the user is looking
+// at. These helpers build a tolerance per vertex (or per tile of
+// vertices) that is loosened where the error can't be seen:
+// - where a pixel covers more world space than maxerror, error that is
+//   smaller than a fraction of a pixel is invisible
+// - off screen and behind the camera
+// - far away from the tool, where the deformation itself is small
+///////////////////////////////////////////////////////
+
+struct ToleranceSettings
+{
+    float maxerror;       // the tolerance where error is the most visible (see README.md)
+    float maxScale;       // the tolerance is never loosened by more than this factor
+    float pixelFraction;  // error smaller than this fraction of a pixel is invisible
+};
+
+// A camera, as seen by the tolerance helpers.
+// For the sample's simple_interactive_camera, linalg's float4x4 is also column major:
+//     float4x4 viewProj = cam.get_viewproj_matrix(aspect);
+//     ToleranceView view = makeToleranceView(&viewProj.x.x, cam.yfov, (float)windowHeight);
+struct ToleranceView
+{
+    float viewProjection[16];  // column major, the same as GLSL
+    float pixelScale;          // world space size of a pixel at a view depth of 1
+};
+
+// A tolerance per tile of vertices. Vertex i uses values[i / tileSize].
+// When values is null, every vertex uses uniform.
+struct ToleranceField
+{
+    const float* values;
+    unsigned int tileSize;
+    float        uniform;
+};
+
+INLINE ToleranceSettings defaultToleranceSettings(float maxerror)
+{
+    ToleranceSettings settings;
+    settings.maxerror = maxerror;
+    settings.maxScale = 16.0f;
+    settings.pixelFraction = 0.25f;
+    return settings;
+}
+
+INLINE ToleranceView makeToleranceView(const float* viewProjectionColumnMajor, float yfov, float viewportHeight)
+{
+    ToleranceView view;
+    for (int i = 0; i < 16; i++)
+    {
+        view.viewProjection[i] = viewProjectionColumnMajor[i];
+    }
+    view.pixelScale = 2 * tan(yfov / 2) / viewportHeight;
+    return view;
+}
+
+INLINE ToleranceField uniformToleranceField(float maxerror)
+{
+    ToleranceField field;
+    field.values = 0;
+    field.tileSize = 1;
+    field.uniform = maxerror;
+    return field;
+}
+
+// tileSize of 1 makes a tolerance per vertex
+INLINE ToleranceField toleranceField(const float* values, unsigned int tileSize)
+{
+    ToleranceField field;
+    field.values = values;
+    field.tileSize = tileSize;
+    field.uniform = 0.0f;
+    return field;
+}
+
+INLINE float toleranceForVertex(ToleranceField field, unsigned int vertex)
+{
+    return field.values ? field.values[vertex / field.tileSize] : field.uniform;
+}
+
+// Loosens the tolerance with the square of the distance outside of the tool's radius
+INLINE float toolDistanceTolerance(vec3 position, vec3 toolOrigin, float radius, ToleranceSettings settings)
+{
+    float d = distance(position, toolOrigin) / radius;
+    float scale = d > 1.0f ? d * d : 1.0f;
+    return settings.maxerror * min(scale, settings.maxScale);
+}
+
+// Loosens the tolerance to a fraction of the size of a pixel, and as much as
+// possible off screen or behind the camera
+INLINE float screenSpaceTolerance(vec3 position, ToleranceView view, ToleranceSettings settings)
+{
+    const float* m = view.viewProjection;
+    float x = m[0] * position.x + m[4] * position.y + m[8] * position.z + m[12];
+    float y = m[1] * position.x + m[5] * position.y + m[9] * position.z + m[13];
+    float w = m[3] * position.x + m[7] * position.y + m[11] * position.z + m[15];
+
+    float loosest = settings.maxerror * settings.maxScale;
+    if (w <= 0.0f || fabs(x) > w || fabs(y) > w)
+    {
+        return loosest;
+    }
+
+    float pixel = w * view.pixelScale;
+    return min(max(settings.maxerror, pixel * settings.pixelFraction), loosest);
+}
+
+// Writes a tolerance per vertex. Either reason is enough to loosen the
+// tolerance, so this is the looser of the two. view may be null.
+INLINE void buildToleranceField(const vec3* positions, unsigned int count, const ToleranceView* view,
+                                vec3 toolOrigin, float radius, ToleranceSettings settings, float* tolerances)
+{
+    for (unsigned int i = 0; i < count; i++)
+    {
+        float tolerance = toolDistanceTolerance(positions[i], toolOrigin, radius, settings);
+        if (view)
+        {
+            tolerance = max(tolerance, screenSpaceTolerance(positions[i], *view, settings));
+        }
+        tolerances[i] = tolerance;
+    }
+}
+
+// Writes a tolerance per tile of tileSize consecutive vertices, which is the
+// tightest tolerance of the tile. tileTolerances needs (count + tileSize - 1) / tileSize values.
+INLINE void buildTileTolerances(const float* vertexTolerances, unsigned int count, unsigned int tileSize, float* tileTolerances)
+{
+    for (unsigned int first = 0; first < count; first += tileSize)
+    {
+        unsigned int last = min((int)(first + tileSize), (int)count);
+        float tolerance = vertexTolerances[first];
+        for (unsigned int i = first + 1; i < last; i++)
+        {
+            tolerance = min(tolerance, vertexTolerances[i]);
+        }
+        tileTolerances[first / tileSize] = tolerance;
+    }
+}
@@ -0,0 +1,133 @@
+// Copyright(c) Facebook, Inc. and its affiliates.
+// All rights reserved.
+//
+// This source code is licensed under the BSD - style license found in the
+// LICENSE file in the root directory of this source tree.
+
+#pragma once
+
+///////////////////////////////////////////////////////
+// Lossless compression of vertex positions
+//
+// A stroke only moves some of the vertices of a mesh, so the bits of a
+// deformed mesh xor'ed with the bits of another version of it (the rest
+// positions, or a newer version) are mostly zeros. Without such a
+// reference, the bits of every vertex can be xor'ed with the previous
+// vertex, which zeroes the high bytes of nearby vertices.
+// encodeVertexBits() stores those bits one byte plane at a time, with
+// runs of zeros stored as a zero and the length of the run.
+///////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+// Writes the bits of the vertices xor'ed with the bits of reference, or with the
+// previous vertex if reference is null
+INLINE void vertexDeltaBits(const vec3* vertices, const vec3* reference, unsigned int count, unsigned int* bits)
+{
+    if (count == 0)
+    {
+        return;
+    }
+    memcpy(bits, vertices, count * sizeof(vec3));
+    if (reference)
+    {
+        std::vector<unsigned int> referenceBits(count * 3);
+        memcpy(referenceBits.data(), reference, count * sizeof(vec3));
+        for (unsigned int i = 0; i < count * 3; i++)
+        {
+            bits[i] ^= referenceBits[i];
+        }
+    }
+    else
+    {
+        for (unsigned int i = count * 3 - 1; i >= 3; i--)
+        {
+            bits[i] ^= bits[i - 3];
+        }
+    }
+}
+
+// Undoes vertexDeltaBits() in place, and writes the vertices
+INLINE void vertexFromDeltaBits(unsigned int* bits, const vec3* reference, unsigned int count, vec3* vertices)
+{
+    if (reference)
+    {
+        std::vector<unsigned int> referenceBits(count * 3);
+        memcpy(referenceBits.data(), reference, count * sizeof(vec3));
+        for (unsigned int i = 0; i < count * 3; i++)
+        {
+            bits[i] ^= referenceBits[i];
+        }
+    }
+    else
+    {
+        for (unsigned int i = 3; i < count * 3; i++)
+        {
+            bits[i] ^= bits[i - 3];
+        }
+    }
+    memcpy((float*)vertices, bits, count * sizeof(vec3));
+}
+
+// Appends wordCount words of bits to out, one byte plane at a time, with runs of zeros
+// stored as a zero and the length of the run
+INLINE void encodeVertexBits(const unsigned int* bits, unsigned int wordCount, std::vector<unsigned char>& out)
+{
+    for (unsigned int plane = 0; plane < 4; plane++)
+    {
+        unsigned int run = 0;
+        for (unsigned int i = 0; i < wordCount; i++)
+        {
+            unsigned char byte = (unsigned char)(bits[i] >> (plane * 8));
+            if (byte == 0 && run < 255)
+            {
+                run++;
+                continue;
+            }
+            if (run > 0)
+            {
+                out.push_back(0);
+                out.push_back((unsigned char)run);
+                run = 0;
+            }
+            if (byte == 0)
+            {
+                run = 1;
+            }
+            else
+            {
+                out.push_back(byte);
+            }
+        }
+        if (run > 0)
+        {
+            out.push_back(0);
+            out.push_back((unsigned char)run);
+        }
+    }
+}
+
+// Reads wordCount words of bits that encodeVertexBits() wrote. Returns the number of bytes read.
+INLINE size_t decodeVertexBits(const unsigned char* in, unsigned int wordCount, unsigned int* bits)
+{
+    std::fill(bits, bits + wordCount, 0u);
+    size_t k = 0;
+    for (unsigned int plane = 0; plane < 4; plane++)
+    {
+        for (unsigned int i = 0; i < wordCount;)
+        {
+            unsigned char byte = in[k++];
+            if (byte == 0)
+            {
+                i += in[k++];
+            }
+            else
+            {
+                bits[i++] |= (unsigned int)byte << (plane * 8);
+            }
+        }
+    }
+    return k;
+}
@@ -5,12 +5,74 @@
 // LICENSE file in the root directory of this source tree.
 
 #include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 namespace deformation
 {
     #include "../code/deformation.h"
+    #include "../code/tolerance.h"
+    #include "../code/sensitivity.h"
+    #include "../code/threadpool.h"
+    #include "../code/parareal.h"
+    #include "../code/meshdeformer.h"
+    #include "../code/pipeline.h"
+    #include "../code/strokereplay.h"
+    #include "../code/strokesimplify.h"
+    #include "../code/splinemotion.h"
+    #include "../code/strokebuffer.h"
+    #include "../code/flowmap.h"
+    #include "../code/spatialhash.h"
+    #include "../code/framescheduler.h"
+    #include "../code/progressive.h"
+    #include "../code/lazymesh.h"
+    #include "../code/sculptlayers.h"
+    #include "../code/vertexcodec.h"
+    #include "../code/pagedvertices.h"
+    #include "../code/reversibleundo.h"
+    #include "../code/timeline.h"
+    #include "../code/sparsedelta.h"
+    #include "../code/speculative.h"
+    #include "../code/posering.h"
+    #include "../code/epochvertices.h"
+    #include "../code/proxymesh.h"
+    #include "../code/tessellation.h"
+    #include "../code/reference.h"
+
+    // A variant of the solvers for x' = x * rate, which records the times it is evaluated at,
+    // to see the size of the steps the adaptive solvers take
+    struct RecordedFlow
+    {
+        float               rate;
+        std::vector<float>* times;
+    };
+
+    INLINE vec3 RecordedFlowEvaluate(float t, vec3 x, RecordedFlow flow)
+    {
+        flow.times->push_back(t);
+        return x * flow.rate;
+    }
+
+    #define SCOPE(suffix) IntegrateRecordedFlow##suffix
+    #define EVALUATE RecordedFlowEvaluate
+    #define PARAMETERLIST RecordedFlow flow
+    #define PARAMETERS flow
+    #include "../code/odesolvers.h"
+    #undef PARAMETERS
+    #undef PARAMETERLIST
+    #undef EVALUATE
+    #undef SCOPE
 };
 
-#include <vector>
 #include "assert.h"
 
 using namespace std;
@@ -112,13 +174,8 @@ Stroke readstroke(const char* filename)
     return stroke;
 }
 
-void writeobj(const char* filename, Mesh mesh)
+vector<vec3> calcVertexNormals(const Mesh& mesh)
 {
-    FILE* file;
-    fopen_s(&file, filename, "wt");
-    assert(file);
-
-    // calculate vertex normals
     vector<vec3> vn;
     vn.resize(mesh.vertices.size());
     memset(vn.data(), 0, sizeof(vec3)*mesh.vertices.size());
@@ -137,6 +194,15 @@ void writeobj(const char* filename, Mesh mesh)
         vn[i] = normalize(vn[i]);
     }
 
+    return vn;
+}
+
+void writeobj(const char* filename, const Mesh& mesh, const vector<vec3>& vn)
+{
+    FILE* file;
+    fopen_s(&file, filename, "wt");
+    assert(file);
+
     // write out .obj
     for (uint i = 0; i < mesh.vertices.size(); i++)
     {
@@ -159,6 +225,46 @@ void writeobj(const char* filename, Mesh mesh)
     fclose(file);
 }
 
+void writeobj(const char* filename, Mesh mesh)
+{
+    writeobj(filename, mesh, calcVertexNormals(mesh));
+}
+
+// split every triangle in four, at the middle of its edges
+Mesh subdivide(const Mesh& mesh)
+{
+    Mesh result;
+    result.vertices = mesh.vertices;
+    unordered_map<unsigned long long, uint> middles;
+    auto middle = [&](uint a, uint b)
+    {
+        unsigned long long key = a < b ? ((unsigned long long)a << 32) | b : ((unsigned long long)b << 32) | a;
+        auto found = middles.find(key);
+        if (found != middles.end())
+        {
+            return found->second;
+        }
+        uint m = (uint)result.vertices.size();
+        result.vertices.push_back((mesh.vertices[a] + mesh.vertices[b]) * 0.5f);
+        middles[key] = m;
+        return m;
+    };
+
+    for (uint i = 0; i < mesh.indices.size(); i += 3)
+    {
+        uint v0 = mesh.indices[i + 0];
+        uint v1 = mesh.indices[i + 1];
+        uint v2 = mesh.indices[i + 2];
+        uint m01 = middle(v0, v1);
+        uint m12 = middle(v1, v2);
+        uint m20 = middle(v2, v0);
+        uint triangles[] = { v0, m01, m20, m01, v1, m12, m20, m12, v2, m01, m12, m20 };
+        result.indices.insert(result.indices.end(), triangles, triangles + 12);
+    }
+
+    return result;
+}
+
 // fix any flips caused by quaternion double cover
 vector<deformation::Pose> fixFlips(vector<deformation::Pose> poses)
 {
@@ -208,6 +314,50 @@ DataFromPoses buildDataFromPoses(Stroke stroke)
     return d;
 }
 
+// read a recorded stroke, fix its flips, and build its data, like test 6
+DataFromPoses readStrokeData(const char* filename, Stroke& stroke)
+{
+    stroke = readstroke(filename);
+    stroke.poses = fixFlips(stroke.poses);
+    return buildDataFromPoses(stroke);
+}
+
+// replay one frame of a recorded stroke with a single RK4 step, like test 6
+vec3 replayKelvinlet(vec3 position, const deformation::Kelvinlet& kelvinlet)
+{
+    return IntegrateKelvinlets_RungeKutta(position, kelvinlet.time, kelvinlet.time + kelvinlet.dt, kelvinlet);
+}
+
+// replay every frame of a recorded stroke, like test 6
+vec3 replayKelvinlets(vec3 position, const vector<deformation::Kelvinlet>& kelvinlets)
+{
+    for (const deformation::Kelvinlet& kelvinlet : kelvinlets)
+    {
+        position = replayKelvinlet(position, kelvinlet);
+    }
+    return position;
+}
+
+vector<vec3> replayKelvinlets(ThreadPool& pool, vector<vec3> positions, const vector<deformation::Kelvinlet>& kelvinlets)
+{
+    deformMesh(pool, positions.data(), (uint)positions.size(), [&](vec3 position)
+    {
+        return replayKelvinlets(position, kelvinlets);
+    });
+    return positions;
+}
+
+// the solver of the Kelvinlet of a motion of the tool, for the deformers that build them
+// as the poses arrive
+std::function<vec3(vec3)> kelvinletMotionSolver(const deformation::Motion& motion, const Stroke& stroke)
+{
+    deformation::Kelvinlet kelvinlet = buildKelvinlet(buildDeformation(motion), stroke.stiffness, stroke.compressibility, stroke.outerRadius);
+    return [kelvinlet](vec3 position)
+    {
+        return replayKelvinlet(position, kelvinlet);
+    };
+}
+
 // Calculate falloff. When the position is inside the inner radius, the falloff is 1;
 // when the position is outside the outer radius, the falloff is 0. In between, the
 // falloff smoothly falls off from 1 to 0.
@@ -223,6 +373,312 @@ float calcFalloff(vec3 position, vec3 origin, float innerRadius, float outerRadi
 	return falloff;
 }
 
+// a brush: the non-elastic deformation of a frame, with the falloff around the path of the
+// tool during the frame
+vec3 brushFrame(vec3 position, const deformation::Deformation& deformation, const Stroke& stroke)
+{
+    vec3 path = deformation.linearVelocity * deformation.dt;
+    float lengthSquared = dot(path, path);
+    float s = lengthSquared > 0.0f ? saturate(dot(position - deformation.origin, path) / lengthSquared) : 0.0f;
+    float falloff = calcFalloff(position, deformation.origin + path * s, stroke.innerRadius, stroke.outerRadius);
+    if (falloff > 0.0f)
+    {
+        position = IntegrateNonElastic_RungeKutta(position, deformation.time, deformation.time + deformation.dt * falloff, deformation);
+    }
+    return position;
+}
+
+// Medium's elastic move tool, like test 2, with an adaptive solver
+vec3 elasticMove(vec3 position, const deformation::Deformation& move, const Stroke& stroke, float maxerror)
+{
+    float falloff = calcFalloff(position, move.origin, stroke.innerRadius, stroke.outerRadius);
+    if (falloff > 0.0f)
+    {
+        position = IntegrateNonElastic_AdaptiveBS32(position, move.time, lerp(move.time, move.time + move.dt, falloff), maxerror, move);
+    }
+    return position;
+}
+
+// --------------------
+// Numerical equivalence harness
+// This runs the recorded strokes through every fast path, and compares the results
+// with the double precision reference solvers in reference.h. A path fails when its
+// largest error is more than its limit, a multiple of maxerror. The limit of a path is its
+// largest error over the recorded strokes, with half as much again as headroom (and at
+// least a quarter of maxerror), so that a change that makes a path noticeably less
+// accurate fails. The limits are multiples and not fractions of maxerror because the
+// adaptive solvers keep their estimate of the error per unit of time under maxerror, not
+// the error after a whole move, and the estimate is only as good as the lower order
+// answer: the move tool paths end up a few times maxerror away. The fixed step replays
+// and Parareal stay under maxerror. Update the limits when a change is meant to make a
+// path more accurate.
+// The points are a lattice around the start of the stroke, so no mesh is needed.
+
+struct EquivalenceLimit
+{
+    const char* pathname;
+    float       limit;
+};
+
+const EquivalenceLimit equivalenceLimits[] =
+{
+    { "IntegrateKelvinlets_AdaptiveRK",                   16.0f },
+    { "IntegrateKelvinlets_AdaptiveRKF45",                8.0f },
+    { "IntegrateKelvinlets_AdaptiveDP54",                 6.5f },
+    { "IntegrateKelvinlets_AdaptiveBS32",                 1.0f },
+    { "IntegrateKelvinlets_AdaptiveRKF45 round trip",     15.0f },
+    { "IntegrateKelvinlets_AdaptiveDP54 round trip",      22.0f },
+    { "IntegrateKelvinlets_AdaptiveBS32 round trip",      2.5f },
+    { "updateFromSensitivityCache",                       1.5f },
+    { "IntegrateNonElastic_AdaptiveRK",                   9.0f },
+    { "IntegrateNonElastic_AdaptiveRKF45",                0.75f },
+    { "IntegrateNonElastic_AdaptiveDP54",                 0.75f },
+    { "IntegrateNonElastic_AdaptiveBS32",                 1.5f },
+    { "IntegrateNonElastic_AdaptiveRKF45 round trip",     1.25f },
+    { "IntegrateNonElastic_AdaptiveDP54 round trip",      1.0f },
+    { "IntegrateNonElastic_AdaptiveBS32 round trip",      2.25f },
+    { "IntegrateKelvinlets_RungeKutta replay",            1.0f },
+    { "IntegrateKelvinletStroke_Parareal",                0.25f },
+    { "IntegrateNonElastic_RungeKutta replay",            0.25f },
+    { "IntegrateKelvinletsTwoDeformers_AdaptiveBS32",     1.25f },
+    { "IntegrateNonElasticTwoDeformers_AdaptiveBS32",     0.5f },
+};
+
+// The limit of a path, as a multiple of maxerror. A path without a limit always fails.
+float equivalenceLimit(const char* pathname)
+{
+    for (const EquivalenceLimit& limit : equivalenceLimits)
+    {
+        if (strcmp(limit.pathname, pathname) == 0)
+        {
+            return limit.limit;
+        }
+    }
+    return 0.0f;
+}
+
+vector<vec3> equivalenceSamplePoints(const Stroke& stroke)
+{
+    vector<vec3> points;
+    const int n = 8;
+    float extent = stroke.outerRadius * 1.5f;
+    vec3 center = stroke.poses[0].position;
+    for (int i = 0; i < n; i++)
+    {
+        for (int j = 0; j < n; j++)
+        {
+            for (int k = 0; k < n; k++)
+            {
+                vec3 offset = vec3((float)i, (float)j, (float)k) * (2 * extent / (n - 1)) - vec3(extent);
+                points.push_back(center + offset);
+            }
+        }
+    }
+    return points;
+}
+
+bool checkEquivalence(const char* strokename, const char* pathname, const vector<vec3>& results, const vector<tvec3<double>>& reference, float maxerror)
+{
+    EquivalenceStats stats = compareToReference(results.data(), reference.data(), (uint)results.size());
+    float limit = equivalenceLimit(pathname);
+    bool pass = stats.maxError <= limit * maxerror;
+    printf("  %-48s %-46s max %.3e rms %.3e (%5.2f of maxerror, limit %.2f) ulps max %u mean %.1f %s\n",
+        strokename, pathname, stats.maxError, stats.rmsError, stats.maxError / maxerror, limit, stats.maxUlps, stats.meanUlps, pass ? "" : "FAILED");
+    return pass;
+}
+
+// The move tool: the first and last pose of a stroke
+bool checkMoveToolEquivalence(const char* strokename, Stroke stroke, float maxerror)
+{
+    bool pass = true;
+
+    vector<vec3> points = equivalenceSamplePoints(stroke);
+    vector<deformation::Pose> poses = buildStartEndPoses(stroke.poses);
+    deformation::Motion motion = buildMotion(poses[0], poses[1]);
+    deformation::Deformation deformation = buildDeformation(motion);
+    deformation::Kelvinlet kelvinlet = buildKelvinlet(deformation, stroke.stiffness, stroke.compressibility, stroke.outerRadius);
+
+    TKelvinlet<double> referencekelvinlet = referenceKelvinlet<double>(kelvinlet);
+    TDeformation<double> referencedeformation = referenceDeformation<double>(deformation);
+    vector<tvec3<double>> kelvinletreference(points.size());
+    vector<tvec3<double>> nonelasticreference(points.size());
+    vector<tvec3<double>> startreference(points.size());
+    for (uint i = 0; i < points.size(); i++)
+    {
+        kelvinletreference[i] = ReferenceIntegrateKelvinlet(tvec3<double>(points[i]), kelvinlet.time, (double)kelvinlet.time + kelvinlet.dt, referencekelvinlet);
+        nonelasticreference[i] = ReferenceIntegrateNonElastic(tvec3<double>(points[i]), deformation.time, (double)deformation.time + deformation.dt, referencedeformation);
+        startreference[i] = tvec3<double>(points[i]);
+    }
+
+    float tstart = kelvinlet.time;
+    float tend = kelvinlet.time + kelvinlet.dt;
+    vector<vec3> results(points.size());
+
+    for (uint i = 0; i < points.size(); i++) results[i] = IntegrateKelvinlets_AdaptiveRK(points[i], tstart, tend, maxerror, kelvinlet);
+    pass &= checkEquivalence(strokename, "IntegrateKelvinlets_AdaptiveRK", results, kelvinletreference, maxerror);
+    for (uint i = 0; i < points.size(); i++) results[i] = IntegrateKelvinlets_AdaptiveRKF45(points[i], tstart, tend, maxerror, kelvinlet);
+    pass &= checkEquivalence(strokename, "IntegrateKelvinlets_AdaptiveRKF45", results, kelvinletreference, maxerror);
+    for (uint i = 0; i < points.size(); i++) results[i] = IntegrateKelvinlets_AdaptiveDP54(points[i], tstart, tend, maxerror, kelvinlet);
+    pass &= checkEquivalence(strokename, "IntegrateKelvinlets_AdaptiveDP54", results, kelvinletreference, maxerror);
+    for (uint i = 0; i < points.size(); i++) results[i] = IntegrateKelvinlets_AdaptiveBS32(points[i], tstart, tend, maxerror, kelvinlet);
+    pass &= checkEquivalence(strokename, "IntegrateKelvinlets_AdaptiveBS32", results, kelvinletreference, maxerror);
+
+    // the backward solvers, after the forward ones with the same tolerance, bring the points back
+    // to where they started. Both ways add their error, so the limits are doubled.
+    for (uint i = 0; i < points.size(); i++) results[i] = IntegrateKelvinlets_AdaptiveRKF45Backward(IntegrateKelvinlets_AdaptiveRKF45(points[i], tstart, tend, maxerror, kelvinlet), tstart, tend, maxerror, kelvinlet);
+    pass &= checkEquivalence(strokename, "IntegrateKelvinlets_AdaptiveRKF45 round trip", results, startreference, maxerror);
+    for (uint i = 0; i < points.size(); i++) results[i] = IntegrateKelvinlets_AdaptiveDP54Backward(IntegrateKelvinlets_AdaptiveDP54(points[i], tstart, tend, maxerror, kelvinlet), tstart, tend, maxerror, kelvinlet);
+    pass &= checkEquivalence(strokename, "IntegrateKelvinlets_AdaptiveDP54 round trip", results, startreference, maxerror);
+    for (uint i = 0; i < points.size(); i++) results[i] = IntegrateKelvinlets_AdaptiveBS32Backward(IntegrateKelvinlets_AdaptiveBS32(points[i], tstart, tend, maxerror, kelvinlet), tstart, tend, maxerror, kelvinlet);
+    pass &= checkEquivalence(strokename, "IntegrateKelvinlets_AdaptiveBS32 round trip", results, startreference, maxerror);
+
+    // the sensitivity cache, linearized halfway through the stroke and updated to the last pose
+    deformation::Kelvinlet halfway = buildKelvinlet(buildDeformation(buildMotion(stroke.poses[0], stroke.poses[stroke.poses.size() / 2])), stroke.stiffness, stroke.compressibility, stroke.outerRadius);
+    KelvinletSensitivityCache cache;
+    buildSensitivityCache(cache, points.data(), (uint)points.size(), maxerror, halfway);
+    updateFromSensitivityCache(cache, kelvinlet, maxerror, results.data());
+    pass &= checkEquivalence(strokename, "updateFromSensitivityCache", results, kelvinletreference, maxerror);
+
+    tstart = deformation.time;
+    tend = deformation.time + deformation.dt;
+    for (uint i = 0; i < points.size(); i++) results[i] = IntegrateNonElastic_AdaptiveRK(points[i], tstart, tend, maxerror, deformation);
+    pass &= checkEquivalence(strokename, "IntegrateNonElastic_AdaptiveRK", results, nonelasticreference, maxerror);
+    for (uint i = 0; i < points.size(); i++) results[i] = IntegrateNonElastic_AdaptiveRKF45(points[i], tstart, tend, maxerror, deformation);
+    pass &= checkEquivalence(strokename, "IntegrateNonElastic_AdaptiveRKF45", results, nonelasticreference, maxerror);
+    for (uint i = 0; i < points.size(); i++) results[i] = IntegrateNonElastic_AdaptiveDP54(points[i], tstart, tend, maxerror, deformation);
+    pass &= checkEquivalence(strokename, "IntegrateNonElastic_AdaptiveDP54", results, nonelasticreference, maxerror);
+    for (uint i = 0; i < points.size(); i++) results[i] = IntegrateNonElastic_AdaptiveBS32(points[i], tstart, tend, maxerror, deformation);
+    pass &= checkEquivalence(strokename, "IntegrateNonElastic_AdaptiveBS32", results, nonelasticreference, maxerror);
+
+    for (uint i = 0; i < points.size(); i++) results[i] = IntegrateNonElastic_AdaptiveRKF45Backward(IntegrateNonElastic_AdaptiveRKF45(points[i], tstart, tend, maxerror, deformation), tstart, tend, maxerror, deformation);
+    pass &= checkEquivalence(strokename, "IntegrateNonElastic_AdaptiveRKF45 round trip", results, startreference, maxerror);
+    for (uint i = 0; i < points.size(); i++) results[i] = IntegrateNonElastic_AdaptiveDP54Backward(IntegrateNonElastic_AdaptiveDP54(points[i], tstart, tend, maxerror, deformation), tstart, tend, maxerror, deformation);
+    pass &= checkEquivalence(strokename, "IntegrateNonElastic_AdaptiveDP54 round trip", results, startreference, maxerror);
+    for (uint i = 0; i < points.size(); i++) results[i] = IntegrateNonElastic_AdaptiveBS32Backward(IntegrateNonElastic_AdaptiveBS32(points[i], tstart, tend, maxerror, deformation), tstart, tend, maxerror, deformation);
+    pass &= checkEquivalence(strokename, "IntegrateNonElastic_AdaptiveBS32 round trip", results, startreference, maxerror);
+
+    return pass;
+}
+
+// Replaying every pose of a stroke, one Kelvinlet/deformation per frame
+bool checkReplayEquivalence(const char* strokename, Stroke stroke, float maxerror, ThreadPool& pool)
+{
+    bool pass = true;
+
+    vector<vec3> points = equivalenceSamplePoints(stroke);
+    DataFromPoses data = buildDataFromPoses(stroke);
+
+    vector<tvec3<double>> kelvinletreference(points.size());
+    vector<tvec3<double>> nonelasticreference(points.size());
+    for (uint i = 0; i < points.size(); i++)
+    {
+        kelvinletreference[i] = tvec3<double>(points[i]);
+        nonelasticreference[i] = tvec3<double>(points[i]);
+        for (uint frame = 0; frame < data.kelvinlets.size(); frame++)
+        {
+            deformation::Kelvinlet& k = data.kelvinlets[frame];
+            deformation::Deformation& d = data.deformations[frame];
+            kelvinletreference[i] = ReferenceIntegrateKelvinlet(kelvinletreference[i], k.time, (double)k.time + k.dt, referenceKelvinlet<double>(k));
+            nonelasticreference[i] = ReferenceIntegrateNonElastic(nonelasticreference[i], d.time, (double)d.time + d.dt, referenceDeformation<double>(d));
+        }
+    }
+
+    vector<vec3> results = points;
+    for (uint i = 0; i < points.size(); i++)
+    {
+        for (uint frame = 0; frame < data.kelvinlets.size(); frame++)
+        {
+            deformation::Kelvinlet& k = data.kelvinlets[frame];
+            results[i] = IntegrateKelvinlets_RungeKutta(results[i], k.time, k.time + k.dt, k);
+        }
+    }
+    pass &= checkEquivalence(strokename, "IntegrateKelvinlets_RungeKutta replay", results, kelvinletreference, maxerror);
+
+    // with more segments than the pool may have threads, so that the corrections are checked too
+    const uint pararealSegments = 8;
+    results = points;
+    PararealResult parareal = IntegrateKelvinletStroke_Parareal(pool, results.data(), (uint)results.size(), maxerror, data.kelvinlets.data(), (uint)data.kelvinlets.size(), pararealSegments);
+    pass &= checkEquivalence(strokename, "IntegrateKelvinletStroke_Parareal", results, kelvinletreference, maxerror);
+    if (parareal.iterations >= (int)pararealSegments)
+    {
+        printf("  %-48s %-46s %d iterations for %u segments FAILED\n", strokename, "IntegrateKelvinletStroke_Parareal", parareal.iterations, pararealSegments);
+        pass = false;
+    }
+
+    results = points;
+    for (uint i = 0; i < points.size(); i++)
+    {
+        for (uint frame = 0; frame < data.deformations.size(); frame++)
+        {
+            deformation::Deformation& d = data.deformations[frame];
+            results[i] = IntegrateNonElastic_RungeKutta(results[i], d.time, d.time + d.dt, d);
+        }
+    }
+    pass &= checkEquivalence(strokename, "IntegrateNonElastic_RungeKutta replay", results, nonelasticreference, maxerror);
+
+    return pass;
+}
+
+// The move tool with two hands
+bool checkTwoDeformersEquivalence(const char* strokename, Stroke stroke0, Stroke stroke1, float maxerror)
+{
+    bool pass = true;
+
+    vector<vec3> points = equivalenceSamplePoints(stroke0);
+    vector<deformation::Pose> poses0 = buildStartEndPoses(stroke0.poses);
+    vector<deformation::Pose> poses1 = buildStartEndPoses(stroke1.poses);
+    deformation::Deformation deformation0 = buildDeformation(buildMotion(poses0[0], poses0[1]));
+    deformation::Deformation deformation1 = buildDeformation(buildMotion(poses1[0], poses1[1]));
+    deformation::Kelvinlet kelvinlet0 = buildKelvinlet(deformation0, stroke0.stiffness, stroke0.compressibility, stroke0.outerRadius);
+    deformation::Kelvinlet kelvinlet1 = buildKelvinlet(deformation1, stroke1.stiffness, stroke1.compressibility, stroke1.outerRadius);
+
+    float tstart = kelvinlet0.time;
+    float tend = kelvinlet0.time + kelvinlet0.dt;
+    vector<tvec3<double>> kelvinletreference(points.size());
+    vector<tvec3<double>> nonelasticreference(points.size());
+    vector<vec3> kelvinletresults(points.size());
+    vector<vec3> nonelasticresults(points.size());
+    for (uint i = 0; i < points.size(); i++)
+    {
+        kelvinletreference[i] = ReferenceIntegrateKelvinletTwoDeformers(tvec3<double>(points[i]), tstart, (double)kelvinlet0.time + kelvinlet0.dt, referenceKelvinlet<double>(kelvinlet0), referenceKelvinlet<double>(kelvinlet1));
+        nonelasticreference[i] = ReferenceIntegrateNonElasticTwoDeformers(tvec3<double>(points[i]), tstart, (double)kelvinlet0.time + kelvinlet0.dt, referenceDeformation<double>(deformation0), referenceDeformation<double>(deformation1));
+        kelvinletresults[i] = IntegrateKelvinletsTwoDeformers_AdaptiveBS32(points[i], tstart, tend, maxerror, kelvinlet0, kelvinlet1);
+        nonelasticresults[i] = IntegrateNonElasticTwoDeformers_AdaptiveBS32(points[i], tstart, tend, maxerror, deformation0, deformation1);
+    }
+    pass &= checkEquivalence(strokename, "IntegrateKelvinletsTwoDeformers_AdaptiveBS32", kelvinletresults, kelvinletreference, maxerror);
+    pass &= checkEquivalence(strokename, "IntegrateNonElasticTwoDeformers_AdaptiveBS32", nonelasticresults, nonelasticreference, maxerror);
+
+    return pass;
+}
+
+bool checkNumericalEquivalence(float maxerror)
+{
+    const char* strokenames[] = {
+        "data\\strokes\\test0_righthandstroke.bin",
+        "data\\strokes\\test0_righthandstroke_fucked.bin",
+        "data\\strokes\\test1_righthandstroke.bin",
+        "data\\strokes\\test1_lefthandstroke.bin",
+    };
+
+    ThreadPool pool;
+    bool pass = true;
+    for (const char* strokename : strokenames)
+    {
+        Stroke stroke = readstroke(strokename);
+        stroke.poses = fixFlips(stroke.poses);
+        pass &= checkMoveToolEquivalence(strokename, stroke, maxerror);
+        pass &= checkReplayEquivalence(strokename, stroke, maxerror, pool);
+    }
+
+    Stroke strokerighthand = readstroke("data\\strokes\\test1_righthandstroke.bin");
+    Stroke strokelefthand = readstroke("data\\strokes\\test1_lefthandstroke.bin");
+    strokerighthand.poses = fixFlips(strokerighthand.poses);
+    strokelefthand.poses = fixFlips(strokelefthand.poses);
+    pass &= checkTwoDeformersEquivalence("data\\strokes\\test1_*handstroke.bin", strokerighthand, strokelefthand, maxerror);
+
+    return pass;
+}
+
 int main()
 {
     // This is the same maxerror factor used in Medium
@@ -582,6 +1038,1661 @@ int main()
         printf("test7 success\n");
     }
 
+    // --------------------
+    // This demonstrates Medium's elastic move tool while the user drags the second keyframe.
+    // The move starts at the first pose, and every following pose is treated as a new
+    // position of the second keyframe. The first frame integrates every vertex with
+    // sensitivities; after that, vertices are moved with a first order update, and only
+    // the vertices with too much predicted error are integrated again.
+    if (true)
+    {
+        Mesh mesh = readmesh("data\\meshes\\test0_mesh.bin");
+        Stroke stroke = readstroke("data\\strokes\\test0_righthandstroke.bin");
+
+        stroke.poses = fixFlips(stroke.poses);
+
+        uint firstdrag = (uint)stroke.poses.size() / 2;
+        deformation::Motion motion = buildMotion(stroke.poses[0], stroke.poses[firstdrag]);
+        deformation::Deformation deformation = buildDeformation(motion);
+        deformation::Kelvinlet kelvinlet = buildKelvinlet(deformation, stroke.stiffness, stroke.compressibility, stroke.outerRadius);
+
+        KelvinletSensitivityCache cache;
+        buildSensitivityCache(cache, mesh.vertices.data(), (uint)mesh.vertices.size(), maxerror, kelvinlet);
+
+        vector<vec3> deformed(mesh.vertices.size());
+        uint reintegrated = 0;
+        for (uint frame = firstdrag + 1; frame < stroke.poses.size(); frame++)
+        {
+            motion = buildMotion(stroke.poses[0], stroke.poses[frame]);
+            deformation = buildDeformation(motion);
+            kelvinlet = buildKelvinlet(deformation, stroke.stiffness, stroke.compressibility, stroke.outerRadius);
+
+            reintegrated += updateFromSensitivityCache(cache, kelvinlet, maxerror, deformed.data());
+        }
+        mesh.vertices = deformed;
+
+        writeobj("data\\testresult8.obj", mesh);
+        printf("test8 success (%u vertices integrated again)\n", reintegrated);
+    }
+
+    // --------------------
+    // This demonstrates replaying a recorded stroke with Kelvinlets, like test 6, using
+    // parallel-in-time integration. The stroke is split into segments that are integrated
+    // accurately in parallel, and corrected with a cheap RK4 pass until the segment
+    // boundaries stop moving by more than maxerror. This keeps all the cores busy
+    // even when the mesh doesn't have many vertices.
+    if (true)
+    {
+        Mesh mesh = readmesh("data\\meshes\\test0_mesh.bin");
+        Stroke stroke;
+        DataFromPoses data = readStrokeData("data\\strokes\\test0_righthandstroke.bin", stroke);
+
+        ThreadPool pool;
+        PararealResult result = IntegrateKelvinletStroke_Parareal(pool, mesh.vertices.data(), (uint)mesh.vertices.size(), maxerror, data.kelvinlets.data(), (uint)data.kelvinlets.size());
+
+        writeobj("data\\testresult9.obj", mesh);
+        printf("test9 success (%d Parareal iterations for %u segments)\n", result.iterations, pool.threadCount());
+    }
+
+    // --------------------
+    // This demonstrates Medium's elastic move tool, like test 2, with a spatially varying
+    // error tolerance. The tolerance is loosened away from the tool, and then the tightest
+    // tolerance of each tile of 64 vertices is used for the whole tile.
+    // When a camera is available, pass a ToleranceView to also loosen the tolerance
+    // off screen and where a pixel is larger than maxerror.
+    if (true)
+    {
+        Mesh mesh = readmesh("data\\meshes\\test0_mesh.bin");
+        Stroke stroke = readstroke("data\\strokes\\test0_righthandstroke.bin");
+
+        stroke.poses = fixFlips(stroke.poses);
+        stroke.poses = buildStartEndPoses(stroke.poses);
+
+        deformation::Motion motion = buildMotion(stroke.poses[0], stroke.poses[1]);
+        deformation::Deformation deformation = buildDeformation(motion);
+        deformation::Kelvinlet kelvinlet = buildKelvinlet(deformation, stroke.stiffness, stroke.compressibility, stroke.outerRadius);
+
+        const uint tileSize = 64;
+        vector<float> vertextolerances(mesh.vertices.size());
+        vector<float> tiletolerances((mesh.vertices.size() + tileSize - 1) / tileSize);
+        buildToleranceField(mesh.vertices.data(), (uint)mesh.vertices.size(), nullptr, kelvinlet.origin, kelvinlet.radius, defaultToleranceSettings(maxerror), vertextolerances.data());
+        buildTileTolerances(vertextolerances.data(), (uint)mesh.vertices.size(), tileSize, tiletolerances.data());
+        ToleranceField tolerances = toleranceField(tiletolerances.data(), tileSize);
+
+        for (uint i = 0; i < mesh.vertices.size(); i++)
+        {
+            mesh.vertices[i] = IntegrateKelvinlets_AdaptiveBS32(mesh.vertices[i], kelvinlet.time, kelvinlet.time + kelvinlet.dt, toleranceForVertex(tolerances, i), kelvinlet);
+        }
+
+        writeobj("data\\testresult10.obj", mesh);
+        printf("test10 success\n");
+    }
+
+    // --------------------
+    // This checks that the fast paths give the same answers as a double precision
+    // reference solver, within the limit of each path in equivalenceLimits, a multiple
+    // of maxerror. Run this after changing the evaluators or solvers.
+    if (true)
+    {
+        printf("numerical equivalence against the double precision reference:\n");
+        if (!checkNumericalEquivalence(maxerror))
+        {
+            printf("test11 FAILED\n");
+            return 1;
+        }
+        printf("test11 success\n");
+    }
+
+    // --------------------
+    // This demonstrates Medium's elastic move tool, like test 2, deforming the whole mesh
+    // on a work-stealing thread pool. The result is the same, bit for bit, for any
+    // number of threads, which this checks against a pool with a single thread for
+    // several thread counts.
+    if (true)
+    {
+        Mesh mesh = readmesh("data\\meshes\\test0_mesh.bin");
+        Stroke stroke = readstroke("data\\strokes\\test0_righthandstroke.bin");
+
+        stroke.poses = fixFlips(stroke.poses);
+        stroke.poses = buildStartEndPoses(stroke.poses);
+
+        deformation::Motion motion = buildMotion(stroke.poses[0], stroke.poses[1]);
+        deformation::Deformation deformation = buildDeformation(motion);
+        deformation::Kelvinlet kelvinlet = buildKelvinlet(deformation, stroke.stiffness, stroke.compressibility, stroke.outerRadius);
+
+        auto solver = [&](vec3 position)
+        {
+            return IntegrateKelvinlets_AdaptiveBS32(position, kelvinlet.time, kelvinlet.time + kelvinlet.dt, maxerror, kelvinlet);
+        };
+
+        ThreadPool singlethread(1);
+        vector<vec3> reference(mesh.vertices.size());
+        deformMesh(singlethread, mesh.vertices.data(), reference.data(), (uint)mesh.vertices.size(), solver);
+
+        // explicit counts, so that the threads steal work even on a machine with one core
+        const uint threadCounts[] = { 2, 3, 8 };
+        vector<vec3> result;
+        for (uint threads : threadCounts)
+        {
+            ThreadPool pool(threads);
+            result = mesh.vertices;
+            deformMesh(pool, result.data(), (uint)result.size(), solver);
+
+            if (memcmp(reference.data(), result.data(), sizeof(vec3) * result.size()) != 0)
+            {
+                printf("test12 FAILED (the result with %u threads differs from a single thread)\n", threads);
+                return 1;
+            }
+        }
+        mesh.vertices = result;
+
+        writeobj("data\\testresult12.obj", mesh);
+        printf("test12 success (2, 3 and 8 threads)\n");
+    }
+
+    // --------------------
+    // This demonstrates applying strokes to many meshes offline, as a pipeline:
+    // loading the next job, deforming the current one, and writing the previous one
+    // happen at the same time. The deform stage is the move tool of test 2, on the
+    // thread pool. The counters show which stage limits the throughput.
+    if (true)
+    {
+        struct BatchJob
+        {
+            uint index;
+            Mesh mesh;
+            Stroke stroke;
+            deformation::Kelvinlet kelvinlet;
+            vector<vec3> normals;
+        };
+
+        const char* meshnames[] = { "data\\meshes\\test0_mesh.bin", "data\\meshes\\test1_mesh.bin" };
+        const char* strokenames[] = { "data\\strokes\\test0_righthandstroke.bin", "data\\strokes\\test1_righthandstroke.bin" };
+        const uint jobcount = 8;
+
+        ThreadPool pool;
+        uint next = 0;
+        Pipeline<BatchJob> pipeline("load", [&](BatchJob& job)
+        {
+            if (next == jobcount)
+            {
+                return false;
+            }
+            job.index = next++;
+            job.mesh = readmesh(meshnames[job.index % 2]);
+            job.stroke = readstroke(strokenames[job.index % 2]);
+            return true;
+        });
+        pipeline.addStage("build", [&](BatchJob& job)
+        {
+            job.stroke.poses = fixFlips(job.stroke.poses);
+            job.stroke.poses = buildStartEndPoses(job.stroke.poses);
+            deformation::Motion motion = buildMotion(job.stroke.poses[0], job.stroke.poses[1]);
+            deformation::Deformation deformation = buildDeformation(motion);
+            job.kelvinlet = buildKelvinlet(deformation, job.stroke.stiffness, job.stroke.compressibility, job.stroke.outerRadius);
+        });
+        pipeline.addStage("deform", [&](BatchJob& job)
+        {
+            deformation::Kelvinlet kelvinlet = job.kelvinlet;
+            deformMesh(pool, job.mesh.vertices.data(), (uint)job.mesh.vertices.size(), [&](vec3 position)
+            {
+                return IntegrateKelvinlets_AdaptiveBS32(position, kelvinlet.time, kelvinlet.time + kelvinlet.dt, maxerror, kelvinlet);
+            });
+        });
+        pipeline.addStage("normals", [&](BatchJob& job)
+        {
+            job.normals = calcVertexNormals(job.mesh);
+        });
+        pipeline.addStage("write", [&](BatchJob& job)
+        {
+            char filename[64];
+            snprintf(filename, sizeof(filename), "data\\testresult13_%u.obj", job.index);
+            writeobj(filename, job.mesh, job.normals);
+        });
+        pipeline.run();
+
+        for (uint s = 0; s < pipeline.stageCount(); s++)
+        {
+            PipelineStageStats stats = pipeline.stageStats(s);
+            printf("  %-8s %u jobs, %.2f jobs/s, busy %.3fs, waiting for input %.3fs, waiting for output %.3fs\n",
+                stats.name, stats.jobs, stats.jobs / pipeline.elapsedSeconds(), stats.busySeconds, stats.starvedSeconds, stats.blockedSeconds);
+        }
+        printf("test13 success\n");
+    }
+
+    // --------------------
+    // This demonstrates replaying recorded strokes like tests 4 and 6, one tile of vertices
+    // at a time so that the tile stays in the cache while every frame is applied to it.
+    // The Kelvinlet tiles skip the frames where the tool is too far away to move them by
+    // more than a fraction of maxerror, and the non-elastic tiles stop when their last
+    // vertex stops. This checks the results against the per-vertex loops.
+    if (true)
+    {
+        Mesh mesh = readmesh("data\\meshes\\test0_mesh.bin");
+        Stroke stroke;
+        DataFromPoses data = readStrokeData("data\\strokes\\test0_righthandstroke.bin", stroke);
+
+        vector<vec3> kelvinletreference = mesh.vertices;
+        vector<vec3> nonelasticreference = mesh.vertices;
+        vector<float> falloffs(mesh.vertices.size());
+        float starttime = data.deformations[0].time;
+        float endtime = data.deformations[data.deformations.size() - 1].time + data.deformations[data.deformations.size() - 1].dt;
+        for (uint i = 0; i < mesh.vertices.size(); i++)
+        {
+            kelvinletreference[i] = replayKelvinlets(kelvinletreference[i], data.kelvinlets);
+
+            falloffs[i] = calcFalloff(mesh.vertices[i], data.deformations[0].origin, stroke.innerRadius, stroke.outerRadius);
+            if (falloffs[i] > 0.0f)
+            {
+                float t = starttime;
+                float maxt = lerp(starttime, endtime, falloffs[i]);
+                for (uint frame = 0; t < maxt && frame < data.deformations.size(); frame++)
+                {
+                    float dt = min(maxt - t, data.deformations[frame].dt);
+                    nonelasticreference[i] = IntegrateNonElastic_RungeKutta(nonelasticreference[i], t, t + dt, data.deformations[frame]);
+                    t += dt;
+                }
+            }
+        }
+
+        ThreadPool pool;
+        vector<vec3> nonelastic = mesh.vertices;
+        StrokeReplayStats kelvinletstats = IntegrateKelvinletStrokeTiled_RungeKutta(pool, mesh.vertices.data(), (uint)mesh.vertices.size(), maxerror, data.kelvinlets.data(), (uint)data.kelvinlets.size());
+        StrokeReplayStats nonelasticstats = IntegrateNonElasticStrokeTiled_RungeKutta(pool, nonelastic.data(), falloffs.data(), (uint)nonelastic.size(), data.deformations.data(), (uint)data.deformations.size());
+
+        float kelvinleterror = 0.0f;
+        for (uint i = 0; i < mesh.vertices.size(); i++)
+        {
+            kelvinleterror = max(kelvinleterror, distance(mesh.vertices[i], kelvinletreference[i]));
+        }
+        if (kelvinleterror > STROKEREPLAY_SKIP_FRACTION * maxerror * 1.01f ||
+            memcmp(nonelastic.data(), nonelasticreference.data(), sizeof(vec3) * nonelastic.size()) != 0)
+        {
+            printf("test14 FAILED\n");
+            return 1;
+        }
+
+        writeobj("data\\testresult14.obj", mesh);
+        printf("test14 success (Kelvinlets skipped %llu of %llu tile frames, non-elastic skipped %llu of %llu)\n",
+            kelvinletstats.skippedTileFrames, kelvinletstats.tileFrames, nonelasticstats.skippedTileFrames, nonelasticstats.tileFrames);
+    }
+
+    // --------------------
+    // This demonstrates simplifying a recorded stroke before replaying it with Kelvinlets.
+    // Consecutive segments are merged while the tool stays within maxerror of the recorded
+    // poses. To show that segments which can't be integrated are dropped, the stroke gets a
+    // pose at the same time as the one before it (which would divide by 0 in buildMotion()),
+    // and a pause where the tool doesn't move. The result is checked against replaying the
+    // original stroke, within 7 times maxerror.
+    if (true)
+    {
+        Mesh mesh = readmesh("data\\meshes\\test1_mesh.bin");
+        Stroke stroke = readstroke("data\\strokes\\test1_righthandstroke.bin");
+
+        stroke.poses = fixFlips(stroke.poses);
+
+        const uint pausepose = 10;
+        const float pause = 0.1f;
+        vector<deformation::Pose> poses(stroke.poses.begin(), stroke.poses.begin() + pausepose + 1);
+        poses.push_back(stroke.poses[pausepose]);
+        poses.push_back(stroke.poses[pausepose]);
+        poses.back().time += pause;
+        for (uint i = pausepose + 1; i < stroke.poses.size(); i++)
+        {
+            poses.push_back(stroke.poses[i]);
+            poses.back().time += pause;
+        }
+
+        vector<StrokeSegment> segments;
+        StrokeSimplification simplification = simplifyStroke(poses.data(), (uint)poses.size(), stroke.outerRadius, maxerror, segments);
+
+        vector<deformation::Kelvinlet> kelvinlets;
+        for (const StrokeSegment& segment : segments)
+        {
+            deformation::Motion motion = buildMotion(poses[segment.first], poses[segment.last]);
+            deformation::Deformation deformation = buildDeformation(motion);
+            kelvinlets.push_back(buildKelvinlet(deformation, stroke.stiffness, stroke.compressibility, stroke.outerRadius));
+        }
+
+        DataFromPoses data = buildDataFromPoses(stroke);
+        vector<vec3> reference = mesh.vertices;
+
+        ThreadPool pool;
+        deformMesh(pool, mesh.vertices.data(), (uint)mesh.vertices.size(), [&](vec3 position)
+        {
+            for (const deformation::Kelvinlet& kelvinlet : kelvinlets)
+            {
+                position = IntegrateKelvinlets_AdaptiveBS32(position, kelvinlet.time, kelvinlet.time + kelvinlet.dt, maxerror, kelvinlet);
+            }
+            return position;
+        });
+        deformMesh(pool, reference.data(), (uint)reference.size(), [&](vec3 position)
+        {
+            for (const deformation::Kelvinlet& kelvinlet : data.kelvinlets)
+            {
+                position = IntegrateKelvinlets_AdaptiveBS32(position, kelvinlet.time, kelvinlet.time + kelvinlet.dt, maxerror, kelvinlet);
+            }
+            return position;
+        });
+
+        float error = 0.0f;
+        for (uint i = 0; i < mesh.vertices.size(); i++)
+        {
+            error = max(error, distance(mesh.vertices[i], reference[i]));
+        }
+        if (!(error <= 7.0f * maxerror) || simplification.droppedSegments < 2)
+        {
+            printf("test15 FAILED\n");
+            return 1;
+        }
+
+        writeobj("data\\testresult15.obj", mesh);
+        printf("test15 success (%u segments simplified to %u, %.2fx fewer, %u dropped, %.2f of maxerror)\n",
+            simplification.inputSegments, simplification.outputSegments, simplification.reductionRatio, simplification.droppedSegments, error / maxerror);
+    }
+
+    // --------------------
+    // This demonstrates replaying a recorded stroke with Kelvinlets, like test 6, but with
+    // the tool moving along smooth curves through the poses instead of with constant velocity
+    // between them. The velocity field is smooth in time, so a single adaptive solve covers
+    // the whole stroke, with steps that can be longer than a frame. It is compared with an RK4
+    // step per frame of the same field, within 2 times maxerror. The tool goes through the
+    // same poses as in test 6, and only takes a slightly different path between them, so it
+    // is also within 3.25 times maxerror of the replay of test 6.
+    if (true)
+    {
+        Mesh mesh = readmesh("data\\meshes\\test0_mesh.bin");
+        Stroke stroke = readstroke("data\\strokes\\test0_righthandstroke.bin");
+
+        stroke.poses = fixFlips(stroke.poses);
+
+        SplineMotion motion;
+        buildSplineMotion(stroke.poses.data(), (uint)stroke.poses.size(), motion);
+        SplineKelvinletStroke splinestroke = buildSplineKelvinletStroke(motion, stroke.stiffness, stroke.compressibility, stroke.outerRadius);
+
+        ThreadPool pool;
+        vector<vec3> start = mesh.vertices;
+        deformMesh(pool, mesh.vertices.data(), (uint)mesh.vertices.size(), [&](vec3 position)
+        {
+            return IntegrateSplineKelvinlets_AdaptiveBS32(position, 0.0f, splineDuration(motion), maxerror, splinestroke);
+        });
+
+        DataFromPoses data = buildDataFromPoses(stroke);
+        vector<vec3> fixedstep = start;
+        vector<vec3> replay = replayKelvinlets(pool, start, data.kelvinlets);
+        deformMesh(pool, fixedstep.data(), (uint)fixedstep.size(), [&](vec3 position)
+        {
+            for (uint p = 1; p < motion.times.size(); p++)
+            {
+                position = IntegrateSplineKelvinlets_RungeKutta(position, motion.times[p - 1], motion.times[p], splinestroke);
+            }
+            return position;
+        });
+
+        float error = 0.0f;
+        float difference = 0.0f;
+        for (uint i = 0; i < start.size(); i++)
+        {
+            error = max(error, distance(mesh.vertices[i], fixedstep[i]));
+            difference = max(difference, distance(mesh.vertices[i], replay[i]));
+        }
+        if (error > 2.0f * maxerror)
+        {
+            printf("test16 FAILED (%.2f of maxerror from an RK4 step per frame)\n", error / maxerror);
+            return 1;
+        }
+        if (difference > 3.25f * maxerror)
+        {
+            printf("test16 FAILED (%.2f of maxerror from test 6)\n", difference / maxerror);
+            return 1;
+        }
+
+        writeobj("data\\testresult16.obj", mesh);
+        printf("test16 success (%.2f of maxerror from an RK4 step per frame, %.2f from test 6)\n", error / maxerror, difference / maxerror);
+    }
+
+    // --------------------
+    // This demonstrates deforming with Kelvinlets while the stroke is recorded, like test 6,
+    // but with a single RK4 integration as each pose arrives, as suggested there. The poses
+    // go into a StrokeBuffer one at a time, which builds only the Kelvinlets, without
+    // allocating. The results are bit-identical to test 6.
+    if (true)
+    {
+        Mesh mesh = readmesh("data\\meshes\\test0_mesh.bin");
+        Stroke stroke = readstroke("data\\strokes\\test0_righthandstroke.bin");
+
+        Stroke fixedstroke = stroke;
+        fixedstroke.poses = fixFlips(fixedstroke.poses);
+        ThreadPool pool;
+        vector<vec3> reference = replayKelvinlets(pool, mesh.vertices, buildDataFromPoses(fixedstroke).kelvinlets);
+
+        const uint capacity = 8;
+        StrokeBuffer buffer(STROKEBUFFER_KELVINLETS, capacity, stroke.stiffness, stroke.compressibility, stroke.outerRadius);
+        for (uint p = 0; p < stroke.poses.size(); p++)
+        {
+            // the poses arrive one per frame, without fixed flips
+            if (!buffer.addPose(stroke.poses[p]) || buffer.segmentCount() == 0)
+            {
+                continue;
+            }
+
+            const Kelvinlet* kelvinlet = buffer.kelvinlets(buffer.segmentCount() - 1, 1);
+            deformMesh(pool, mesh.vertices.data(), (uint)mesh.vertices.size(), [&](vec3 position)
+            {
+                return replayKelvinlet(position, *kelvinlet);
+            });
+        }
+
+        if (buffer.deformations(0, 1) != nullptr || buffer.kelvinlets(0, 1) != nullptr ||
+            buffer.kelvinlets(buffer.segmentCount() - capacity, capacity) == nullptr)
+        {
+            printf("test17 FAILED (spans)\n");
+            return 1;
+        }
+        if (memcmp(mesh.vertices.data(), reference.data(), reference.size() * sizeof(vec3)) != 0)
+        {
+            printf("test17 FAILED (not identical to test 6)\n");
+            return 1;
+        }
+
+        writeobj("data\\testresult17.obj", mesh);
+        printf("test17 success (%u poses, %u segments)\n", buffer.poses(), buffer.segmentCount());
+    }
+
+    // --------------------
+    // This demonstrates replaying a recorded stroke with Kelvinlets, like test 6, on a dense
+    // mesh: every frame is only integrated at the nodes of a sparse grid, and the vertices are
+    // interpolated. The grids are kept, so a second mesh with the same stroke (the first one
+    // subdivided) reuses their nodes.
+    // The interpolation errors of the frames add up, so every frame gets a share of maxerror.
+    if (true)
+    {
+        Mesh mesh = readmesh("data\\meshes\\test0_mesh.bin");
+        Stroke stroke;
+        DataFromPoses data = readStrokeData("data\\strokes\\test0_righthandstroke.bin", stroke);
+        float tolerance = 4 * maxerror / data.kelvinlets.size();
+
+        ThreadPool pool;
+        vector<vec3> reference = mesh.vertices;
+        vector<FlowMap> flowmaps;
+        for (uint frame = 0; frame < data.kelvinlets.size(); frame++)
+        {
+            const Kelvinlet& k = data.kelvinlets[frame];
+            deformMesh(pool, reference.data(), (uint)reference.size(), [&](vec3 position)
+            {
+                return replayKelvinlet(position, k);
+            });
+
+            // the points at the tool move the most
+            vec3 lo, hi;
+            flowMapKelvinletBounds(&k, 1, tolerance, lo, hi);
+            float displacement = length(replayKelvinlet(k.origin, k) - k.origin);
+            flowmaps.push_back(FlowMap(flowMapSpacing(k.radius, tolerance, displacement), lo, hi));
+        }
+
+        vector<FlowMap> emptyflowmaps = flowmaps;
+
+        auto deform = [&](vector<FlowMap>& maps, vector<vec3>& vertices)
+        {
+            FlowMapStats total = { 0, 0, 0, 0 };
+            for (uint frame = 0; frame < data.kelvinlets.size(); frame++)
+            {
+                const Kelvinlet& k = data.kelvinlets[frame];
+                FlowMapStats stats = maps[frame].deform(pool, vertices.data(), vertices.data(), (uint)vertices.size(), [&](vec3 position)
+                {
+                    return replayKelvinlet(position, k);
+                });
+                total.vertices += stats.vertices;
+                total.interpolatedVertices += stats.interpolatedVertices;
+                total.directVertices += stats.directVertices;
+                total.integratedNodes += stats.integratedNodes;
+            }
+            return total;
+        };
+
+        vector<vec3> deformed = mesh.vertices;
+        FlowMapStats stats = deform(flowmaps, deformed);
+
+        float error = 0.0f;
+        for (uint i = 0; i < mesh.vertices.size(); i++)
+        {
+            error = max(error, length(deformed[i] - reference[i]));
+        }
+        if (error > maxerror)
+        {
+            printf("test18 FAILED (%.2f of maxerror)\n", error / maxerror);
+            return 1;
+        }
+
+        // the same stroke on another mesh, the first one subdivided, reuses the nodes, and only
+        // integrates the ones that are missing
+        Mesh subdivided = subdivide(mesh);
+        vector<vec3> secondreference = subdivided.vertices;
+        for (uint frame = 0; frame < data.kelvinlets.size(); frame++)
+        {
+            const Kelvinlet& k = data.kelvinlets[frame];
+            deformMesh(pool, secondreference.data(), (uint)secondreference.size(), [&](vec3 position)
+            {
+                return replayKelvinlet(position, k);
+            });
+        }
+        vector<vec3> second = subdivided.vertices;
+        FlowMapStats secondstats = deform(flowmaps, second);
+        float seconderror = 0.0f;
+        for (uint i = 0; i < second.size(); i++)
+        {
+            seconderror = max(seconderror, length(second[i] - secondreference[i]));
+        }
+        if (seconderror > maxerror)
+        {
+            printf("test18 FAILED (%.2f of maxerror on the subdivided mesh)\n", seconderror / maxerror);
+            return 1;
+        }
+        vector<vec3> uncached = subdivided.vertices;
+        FlowMapStats uncachedstats = deform(emptyflowmaps, uncached);
+        if (secondstats.integratedNodes >= uncachedstats.integratedNodes)
+        {
+            printf("test18 FAILED (cache: %u nodes integrated, %u without the nodes of the first mesh)\n", secondstats.integratedNodes, uncachedstats.integratedNodes);
+            return 1;
+        }
+
+        mesh.vertices = deformed;
+        writeobj("data\\testresult18.obj", mesh);
+        printf("test18 success (%u vertex frames: %u interpolated from %u nodes, %u integrated, %.2f of maxerror; subdivided: %u more nodes instead of %u, %.2f of maxerror)\n",
+            stats.vertices, stats.interpolatedVertices, stats.integratedNodes, stats.directVertices, error / maxerror, secondstats.integratedNodes, uncachedstats.integratedNodes, seconderror / maxerror);
+    }
+
+    // --------------------
+    // This demonstrates deforming with motion capture data one frame at a time, like a brush
+    // that moves the vertices near the path of the tool during each frame. The falloff of a
+    // vertex is measured from the closest point of the path of the tool during the frame.
+    // A SpatialHash returns the vertices near the path, and is refit after every frame,
+    // as the vertices move. The results are bit-identical to visiting every vertex.
+    if (true)
+    {
+        Mesh mesh = readmesh("data\\meshes\\test0_mesh.bin");
+        Stroke stroke;
+        DataFromPoses data = readStrokeData("data\\strokes\\test0_righthandstroke.bin", stroke);
+
+        vector<vec3> reference = mesh.vertices;
+        SpatialHash hash(stroke.outerRadius, mesh.vertices.data(), (uint)mesh.vertices.size());
+        SpatialHashQuery query;
+        unsigned long long visited = 0;
+        uint moved = 0;
+        for (uint frame = 0; frame < data.deformations.size(); frame++)
+        {
+            const deformation::Deformation& deformation = data.deformations[frame];
+            for (uint i = 0; i < reference.size(); i++)
+            {
+                reference[i] = brushFrame(reference[i], deformation, stroke);
+            }
+
+            hash.beginQuery(query);
+            hash.addCapsule(query, deformation.origin, deformation.origin + deformation.linearVelocity * deformation.dt, stroke.outerRadius);
+            for (const SpatialHashRange& range : query.ranges)
+            {
+                for (const uint* vertex = range.begin; vertex != range.end; vertex++)
+                {
+                    mesh.vertices[*vertex] = brushFrame(mesh.vertices[*vertex], deformation, stroke);
+                }
+            }
+            visited += query.vertexCount();
+            moved += hash.refit(mesh.vertices.data(), query);
+        }
+
+        if (memcmp(mesh.vertices.data(), reference.data(), reference.size() * sizeof(vec3)) != 0)
+        {
+            printf("test19 FAILED (a vertex near the tool wasn't visited)\n");
+            return 1;
+        }
+
+        writeobj("data\\testresult19.obj", mesh);
+        printf("test19 success (%.1f%% of the vertices visited per frame, %u moved to another cell)\n",
+            100.0 * visited / ((double)mesh.vertices.size() * data.deformations.size()), moved);
+    }
+
+    // --------------------
+    // This demonstrates replaying a recorded stroke with Kelvinlets, like test 6, one frame at a
+    // time within a time budget. The budget here is a quarter of what a whole frame takes, so
+    // most tiles fall behind; the tiles furthest behind, and then the ones nearest the tool,
+    // catch up first. Once every tile catches up, the result is bit-identical to test 6.
+    // A scheduler that gets several frames before its first run must still make progress,
+    // before it has measured how fast the tiles apply frames.
+    if (true)
+    {
+        Mesh mesh = readmesh("data\\meshes\\test0_mesh.bin");
+        Stroke stroke;
+        DataFromPoses data = readStrokeData("data\\strokes\\test0_righthandstroke.bin", stroke);
+
+        ThreadPool pool;
+        vector<vec3> original = mesh.vertices;
+        vector<vec3> reference = replayKelvinlets(pool, mesh.vertices, data.kelvinlets);
+
+        auto submitTo = [&](FrameScheduler& scheduler, uint frame)
+        {
+            const Kelvinlet& k = data.kelvinlets[frame];
+            scheduler.submit([&k](vec3 position)
+            {
+                return replayKelvinlet(position, k);
+            });
+        };
+
+        // several frames before the first run, then a frame per run, with plenty of budget
+        const uint backlogged = 3;
+        const uint runs = 5;
+        vector<vec3> early = original;
+        FrameScheduler earlyScheduler(early.data(), (uint)early.size());
+        for (uint frame = 0; frame < backlogged; frame++)
+        {
+            submitTo(earlyScheduler, frame);
+        }
+        for (uint run = 0; run < runs; run++)
+        {
+            FrameSchedulerStats stats = earlyScheduler.run(pool, 1.0, data.kelvinlets[0].origin);
+            if (stats.processedTiles == 0 || stats.maxLag > FRAMESCHEDULER_MAX_LAG)
+            {
+                printf("test20 FAILED (run %u with frames submitted before the first run processed %u tiles, and left them up to %u frames behind)\n", run, stats.processedTiles, stats.maxLag);
+                return 1;
+            }
+            submitTo(earlyScheduler, backlogged + run);
+        }
+        earlyScheduler.finish(pool);
+        vector<Kelvinlet> earlyFrames(data.kelvinlets.begin(), data.kelvinlets.begin() + backlogged + runs);
+        if (memcmp(early.data(), replayKelvinlets(pool, original, earlyFrames).data(), early.size() * sizeof(vec3)) != 0)
+        {
+            printf("test20 FAILED (frames submitted before the first run weren't applied in order)\n");
+            return 1;
+        }
+
+        FrameScheduler scheduler(mesh.vertices.data(), (uint)mesh.vertices.size());
+        auto submit = [&](uint frame)
+        {
+            submitTo(scheduler, frame);
+        };
+
+        // the first frame measures what a whole frame takes
+        auto start = std::chrono::steady_clock::now();
+        submit(0);
+        scheduler.finish(pool);
+        double budget = 0.25 * std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        // the budget can't keep up, so the tiles can't all stay within FRAMESCHEDULER_MAX_LAG, but
+        // the ones furthest behind catch up first, so none falls far behind the others
+        uint tilecount = ((uint)mesh.vertices.size() + FRAMESCHEDULER_TILE_VERTICES - 1) / FRAMESCHEDULER_TILE_VERTICES;
+        uint overruns = 0, misses = 0, maxlag = 0, maxspread = 0;
+        unsigned long long backlog = 0;
+        for (uint frame = 1; frame < data.kelvinlets.size(); frame++)
+        {
+            submit(frame);
+            FrameSchedulerStats stats = scheduler.run(pool, budget, data.kelvinlets[frame].origin);
+            overruns += stats.overran ? 1 : 0;
+            misses += stats.lateTiles;
+            maxlag = max((int)maxlag, (int)stats.maxLag);
+            backlog = max(backlog, stats.backlogTileFrames);
+            maxspread = max((int)maxspread, (int)stats.maxLag - (int)(stats.backlogTileFrames / tilecount));
+        }
+        scheduler.finish(pool);
+
+        if (memcmp(mesh.vertices.data(), reference.data(), reference.size() * sizeof(vec3)) != 0)
+        {
+            printf("test20 FAILED (not identical to test 6)\n");
+            return 1;
+        }
+        if (maxspread > FRAMESCHEDULER_MAX_LAG + 1)
+        {
+            printf("test20 FAILED (a tile fell %u frames behind the average)\n", maxspread);
+            return 1;
+        }
+
+        writeobj("data\\testresult20.obj", mesh);
+        printf("test20 success (%.3fms budget, %u overruns, largest backlog %llu tile frames, up to %u frames behind, %u more than the average, %u deadline misses)\n",
+            budget * 1000, overruns, backlog, maxlag, maxspread, misses);
+    }
+
+    // --------------------
+    // This demonstrates Medium's elastic move tool while the user drags the second keyframe,
+    // like test 8, with progressive refinement. Every new pose is shown right away with a
+    // single RK4 step, and refined with the adaptive solver in the background; each new pose
+    // cancels the refinement of the previous one. When the user holds still, the mesh
+    // settles on the adaptive result.
+    if (true)
+    {
+        Mesh mesh = readmesh("data\\meshes\\test0_mesh.bin");
+        Stroke stroke = readstroke("data\\strokes\\test0_righthandstroke.bin");
+
+        stroke.poses = fixFlips(stroke.poses);
+
+        ThreadPool pool;
+        ProgressiveDeformer progressive(mesh.vertices.data(), (uint)mesh.vertices.size());
+
+        deformation::Kelvinlet kelvinlet;
+        uint firstdrag = (uint)stroke.poses.size() / 2;
+        for (uint frame = firstdrag; frame < stroke.poses.size(); frame++)
+        {
+            deformation::Motion motion = buildMotion(stroke.poses[0], stroke.poses[frame]);
+            deformation::Deformation deformation = buildDeformation(motion);
+            kelvinlet = buildKelvinlet(deformation, stroke.stiffness, stroke.compressibility, stroke.outerRadius);
+
+            progressive.update(pool, [kelvinlet](vec3 position)
+            {
+                return replayKelvinlet(position, kelvinlet);
+            },
+            [kelvinlet, maxerror](vec3 position)
+            {
+                return IntegrateKelvinlets_AdaptiveDP54(position, kelvinlet.time, kelvinlet.time + kelvinlet.dt, maxerror, kelvinlet);
+            });
+        }
+
+        progressive.wait();
+        vector<vec3> deformed(mesh.vertices.size());
+        progressive.read(deformed.data());
+
+        for (uint i = 0; i < mesh.vertices.size(); i++)
+        {
+            vec3 expected = IntegrateKelvinlets_AdaptiveDP54(mesh.vertices[i], kelvinlet.time, kelvinlet.time + kelvinlet.dt, maxerror, kelvinlet);
+            if (memcmp(&expected, &deformed[i], sizeof(vec3)) != 0)
+            {
+                printf("test21 FAILED (vertex %u isn't refined)\n", i);
+                return 1;
+            }
+        }
+
+        mesh.vertices = deformed;
+        writeobj("data\\testresult21.obj", mesh);
+        printf("test21 success (%u poses, %u tiles cancelled, %u of %u refined)\n",
+            (uint)stroke.poses.size() - firstdrag, progressive.cancelledTiles(), progressive.refinedTiles(), progressive.tileCount());
+    }
+
+    // --------------------
+    // This demonstrates queueing deformations against a mesh, and only applying them to the
+    // parts of the mesh that are read. The Kelvinlets of a recorded stroke, like test 6, and a
+    // nonelastic move, like test 0, are queued, and then only the first quarter of the
+    // vertices is read. The rest of the mesh is only deformed when it is read at the end.
+    // The results are bit-identical to applying the deformations right away.
+    if (true)
+    {
+        Mesh mesh = readmesh("data\\meshes\\test0_mesh.bin");
+        Stroke stroke;
+        DataFromPoses data = readStrokeData("data\\strokes\\test0_righthandstroke.bin", stroke);
+
+        vector<deformation::Pose> startend = buildStartEndPoses(stroke.poses);
+        deformation::Deformation move = buildDeformation(buildMotion(startend[0], startend[1]));
+        auto movesolver = [&](vec3 position)
+        {
+            return elasticMove(position, move, stroke, maxerror);
+        };
+
+        vector<vec3> reference = mesh.vertices;
+        for (uint i = 0; i < reference.size(); i++)
+        {
+            reference[i] = movesolver(replayKelvinlets(reference[i], data.kelvinlets));
+        }
+
+        LazyMesh lazy(mesh.vertices.data(), (uint)mesh.vertices.size());
+        for (uint frame = 0; frame < data.kelvinlets.size(); frame++)
+        {
+            const Kelvinlet& k = data.kelvinlets[frame];
+            lazy.deform([&k](vec3 position)
+            {
+                return replayKelvinlet(position, k);
+            });
+        }
+        lazy.deform(movesolver, move.origin, stroke.outerRadius);
+
+        ThreadPool pool;
+        uint quarter = (uint)mesh.vertices.size() / 4;
+        const vec3* positions = lazy.positions(pool, 0, quarter);
+        uint dirty = lazy.dirtyTiles();
+        if (memcmp(positions, reference.data(), quarter * sizeof(vec3)) != 0 || dirty == 0)
+        {
+            printf("test22 FAILED (read a quarter)\n");
+            return 1;
+        }
+
+        positions = lazy.positions(pool);
+        if (memcmp(positions, reference.data(), reference.size() * sizeof(vec3)) != 0 || lazy.dirtyTiles() != 0)
+        {
+            printf("test22 FAILED (read everything)\n");
+            return 1;
+        }
+
+        mesh.vertices.assign(positions, positions + lazy.vertexCount());
+        writeobj("data\\testresult22.obj", mesh);
+        printf("test22 success (%u of %u tiles left dirty after reading a quarter, %llu vertex deformations instead of %llu)\n",
+            dirty, lazy.tileCount(), lazy.evaluatedVertexDeformations(), (unsigned long long)mesh.vertices.size() * (data.kelvinlets.size() + 1));
+    }
+
+    // --------------------
+    // This demonstrates sculpt layers. The first layer has the Kelvinlets of a recorded stroke,
+    // like test 6, and the second one a nonelastic move, like test 0. Every layer keeps the
+    // sparse displacement of its strokes, so toggling and re-weighting layers only adds them
+    // up again; changing the strokes of a layer integrates it and the layers above it again.
+    if (true)
+    {
+        Mesh mesh = readmesh("data\\meshes\\test0_mesh.bin");
+        Stroke stroke;
+        DataFromPoses data = readStrokeData("data\\strokes\\test0_righthandstroke.bin", stroke);
+
+        auto kelvinletsolver = [&](vec3 position)
+        {
+            return replayKelvinlets(position, data.kelvinlets);
+        };
+
+        vector<deformation::Pose> startend = buildStartEndPoses(stroke.poses);
+        deformation::Deformation move = buildDeformation(buildMotion(startend[0], startend[1]));
+        auto movesolver = [&](vec3 position)
+        {
+            return elasticMove(position, move, stroke, maxerror);
+        };
+
+        const float threshold = 0.1f * maxerror;
+        ThreadPool pool;
+        SculptLayerStack layers(mesh.vertices.data(), (uint)mesh.vertices.size(), threshold);
+        uint kelvinletlayer = layers.addLayer();
+        uint movelayer = layers.addLayer();
+        layers.addStroke(kelvinletlayer, kelvinletsolver);
+        layers.addStroke(movelayer, movesolver);
+
+        vector<vec3> composed(mesh.vertices.size());
+        uint integrated = layers.compose(pool, composed.data());
+
+        float error = 0.0f;
+        for (uint i = 0; i < mesh.vertices.size(); i++)
+        {
+            error = max(error, length(composed[i] - movesolver(kelvinletsolver(mesh.vertices[i]))));
+        }
+        if (integrated != 2 || error > 4 * threshold)
+        {
+            printf("test23 FAILED (%u layers integrated, %.2f of the threshold)\n", integrated, error / threshold);
+            return 1;
+        }
+
+        // toggling and re-weighting doesn't integrate anything
+        auto start = std::chrono::steady_clock::now();
+        layers.setEnabled(kelvinletlayer, false);
+        layers.setWeight(movelayer, 0.5f);
+        integrated = layers.compose(pool, composed.data());
+        double recompose = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (integrated != 0)
+        {
+            printf("test23 FAILED (a toggle integrated %u layers)\n", integrated);
+            return 1;
+        }
+
+        // without the first layer, the mesh moves by half of the displacement of the move layer,
+        // which was integrated on top of the first layer
+        float toggleerror = 0.0f;
+        for (uint i = 0; i < mesh.vertices.size(); i++)
+        {
+            vec3 below = kelvinletsolver(mesh.vertices[i]);
+            vec3 expected = mesh.vertices[i] + (movesolver(below) - below) * 0.5f;
+            toggleerror = max(toggleerror, length(composed[i] - expected));
+        }
+        if (toggleerror > 4 * threshold)
+        {
+            printf("test23 FAILED (toggled and re-weighted, %.2f of the threshold)\n", toggleerror / threshold);
+            return 1;
+        }
+
+        // a new stroke on the first layer integrates both layers again
+        layers.setEnabled(kelvinletlayer, true);
+        layers.setWeight(movelayer, 1.0f);
+        layers.addStroke(kelvinletlayer, movesolver);
+        integrated = layers.compose(pool, composed.data());
+        if (integrated != 2)
+        {
+            printf("test23 FAILED (a new stroke integrated %u layers)\n", integrated);
+            return 1;
+        }
+
+        mesh.vertices = composed;
+        writeobj("data\\testresult23.obj", mesh);
+        printf("test23 success (layers move %u and %u vertices, %.3fms to recompose, %.2f of the threshold, %.2f toggled and re-weighted)\n",
+            layers.layerVertexCount(kelvinletlayer), layers.layerVertexCount(movelayer), recompose * 1000, error / threshold, toggleerror / threshold);
+    }
+
+    // --------------------
+    // This demonstrates undo and redo with copy-on-write vertex pages. The frames of a recorded
+    // stroke are split into several strokes of a brush, like test 19, with a checkpoint before
+    // each of them. Only the pages a stroke writes are copied, so the history is much smaller
+    // than a copy of the mesh per stroke. A second store has a budget smaller than its history,
+    // so it compresses the old pages; undo is still exact.
+    if (true)
+    {
+        Mesh mesh = readmesh("data\\meshes\\test0_mesh.bin");
+        Stroke stroke;
+        DataFromPoses data = readStrokeData("data\\strokes\\test0_righthandstroke.bin", stroke);
+
+        const uint strokes = 8;
+        ThreadPool pool;
+        PagedVertexStore store(mesh.vertices.data(), (uint)mesh.vertices.size(), (size_t)1 << 30);
+        vector<vector<vec3>> expected(1, mesh.vertices);
+        vector<vec3> reference = mesh.vertices;
+        unsigned long long deformedPages = 0;
+        for (uint s = 0; s < strokes; s++)
+        {
+            store.checkpoint();
+            uint first = s * (uint)data.deformations.size() / strokes;
+            uint last = (s + 1) * (uint)data.deformations.size() / strokes;
+            for (uint frame = first; frame < last; frame++)
+            {
+                const deformation::Deformation& deformation = data.deformations[frame];
+                vec3 path = deformation.linearVelocity * deformation.dt;
+                auto solver = [&](vec3 position) { return brushFrame(position, deformation, stroke); };
+                deformedPages += store.deform(pool, solver, deformation.origin + path * 0.5f, length(path) * 0.5f + stroke.outerRadius);
+                for (uint i = 0; i < reference.size(); i++)
+                {
+                    reference[i] = brushFrame(reference[i], deformation, stroke);
+                }
+            }
+            expected.push_back(reference);
+        }
+        PagedVertexStoreStats stats = store.stats();
+
+        // the second store replays the same strokes, with a budget of a quarter of that history
+        PagedVertexStore small(mesh.vertices.data(), (uint)mesh.vertices.size(), stats.historyBytes / 4);
+        for (uint s = 0; s < strokes; s++)
+        {
+            small.checkpoint();
+            uint first = s * (uint)data.deformations.size() / strokes;
+            uint last = (s + 1) * (uint)data.deformations.size() / strokes;
+            for (uint frame = first; frame < last; frame++)
+            {
+                const deformation::Deformation& deformation = data.deformations[frame];
+                vec3 path = deformation.linearVelocity * deformation.dt;
+                auto solver = [&](vec3 position) { return brushFrame(position, deformation, stroke); };
+                small.deform(pool, solver, deformation.origin + path * 0.5f, length(path) * 0.5f + stroke.outerRadius);
+            }
+        }
+        PagedVertexStoreStats smallStats = small.stats();
+
+        vector<vec3> positions(mesh.vertices.size());
+        for (uint s = strokes; ; s--)
+        {
+            for (PagedVertexStore* undone : { &store, &small })
+            {
+                undone->read(positions.data());
+                if (memcmp(positions.data(), expected[s].data(), positions.size() * sizeof(vec3)) != 0)
+                {
+                    printf("test24 FAILED (undo to stroke %u isn't exact)\n", s);
+                    return 1;
+                }
+            }
+            if (s == 0)
+            {
+                break;
+            }
+            store.undo();
+            small.undo();
+        }
+        for (uint s = 1; s <= strokes; s++)
+        {
+            for (PagedVertexStore* redone : { &store, &small })
+            {
+                redone->redo();
+                redone->read(positions.data());
+                if (memcmp(positions.data(), expected[s].data(), positions.size() * sizeof(vec3)) != 0)
+                {
+                    printf("test24 FAILED (redo to stroke %u isn't exact)\n", s);
+                    return 1;
+                }
+            }
+        }
+        if (smallStats.historyBytes > stats.historyBytes / 4 || smallStats.compressedPages == 0 || smallStats.droppedCheckpoints > 0)
+        {
+            printf("test24 FAILED (the history isn't within its budget)\n");
+            return 1;
+        }
+
+        mesh.vertices = positions;
+        writeobj("data\\testresult24.obj", mesh);
+        printf("test24 success (history of %.1f%% of %u mesh copies, %.1f%% once %u of %u pages are compressed, %.1f pages written per frame)\n",
+            100.0 * stats.historyBytes / ((double)strokes * mesh.vertices.size() * sizeof(vec3)), strokes,
+            100.0 * smallStats.historyBytes / ((double)strokes * mesh.vertices.size() * sizeof(vec3)),
+            smallStats.compressedPages, smallStats.historyPages, (double)deformedPages / data.deformations.size());
+    }
+
+    // --------------------
+    // This demonstrates undoing strokes by integrating them backward. The Kelvinlets of the
+    // recorded stroke of test 6 are split into several strokes. Their round trip is within
+    // maxerror, so undo only keeps their Kelvinlets. With a tolerance of zero, every stroke
+    // keeps a copy of the positions instead, and undo is exact.
+    if (true)
+    {
+        Mesh mesh = readmesh("data\\meshes\\test0_mesh.bin");
+        Stroke stroke;
+        DataFromPoses data = readStrokeData("data\\strokes\\test0_righthandstroke.bin", stroke);
+
+        const uint strokes = 4;
+        ThreadPool pool;
+        ReversibleUndo reversible(maxerror);
+        ReversibleUndo exact(0.0f);
+        vector<vector<vec3>> expected(1, mesh.vertices);
+        vector<vec3> positions = mesh.vertices;
+        vector<vec3> exactPositions = mesh.vertices;
+        float roundTrip = 0.0f;
+        for (uint s = 0; s < strokes; s++)
+        {
+            uint first = s * (uint)data.kelvinlets.size() / strokes;
+            uint last = (s + 1) * (uint)data.kelvinlets.size() / strokes;
+            if (!reversible.apply(pool, positions.data(), (uint)positions.size(), &data.kelvinlets[first], last - first))
+            {
+                printf("test25 FAILED (stroke %u isn't reversible, %.2f of maxerror)\n", s, reversible.lastRoundTripError() / maxerror);
+                return 1;
+            }
+            roundTrip = max(roundTrip, reversible.lastRoundTripError());
+            exact.apply(pool, exactPositions.data(), (uint)exactPositions.size(), &data.kelvinlets[first], last - first);
+            expected.push_back(exactPositions);
+        }
+        if (memcmp(positions.data(), exactPositions.data(), positions.size() * sizeof(vec3)) != 0 || exact.snapshotCount() != strokes)
+        {
+            printf("test25 FAILED (the strokes weren't applied the same way)\n");
+            return 1;
+        }
+        size_t reversibleBytes = reversible.historyBytes();
+        size_t exactBytes = exact.historyBytes();
+
+        float error = 0.0f;
+        for (uint s = strokes; s > 0; s--)
+        {
+            reversible.undo(pool, positions.data(), (uint)positions.size());
+            exact.undo(pool, exactPositions.data(), (uint)exactPositions.size());
+            if (memcmp(exactPositions.data(), expected[s - 1].data(), exactPositions.size() * sizeof(vec3)) != 0)
+            {
+                printf("test25 FAILED (undo to stroke %u isn't exact)\n", s - 1);
+                return 1;
+            }
+            for (uint i = 0; i < positions.size(); i++)
+            {
+                error = max(error, length(positions[i] - expected[s - 1][i]));
+            }
+        }
+        if (error > strokes * maxerror)
+        {
+            printf("test25 FAILED (undo is %.2f of maxerror away)\n", error / maxerror);
+            return 1;
+        }
+
+        mesh.vertices = positions;
+        writeobj("data\\testresult25.obj", mesh);
+        printf("test25 success (%zu bytes of history instead of %zu, round trips within %.2f of maxerror, undo within %.2f)\n",
+            reversibleBytes, exactBytes, roundTrip / maxerror, error / maxerror);
+    }
+
+    // --------------------
+    // This demonstrates scrubbing through the replay of the recorded stroke of test 6. The
+    // timeline plays the whole stroke once, taking checkpoints, with a budget of a few copies
+    // of the mesh. Seeks then restore the checkpoint before the frame, and only replay the
+    // frames after it. The positions are bit-identical to replaying from the first frame.
+    if (true)
+    {
+        Mesh mesh = readmesh("data\\meshes\\test0_mesh.bin");
+        Stroke stroke;
+        DataFromPoses data = readStrokeData("data\\strokes\\test0_righthandstroke.bin", stroke);
+        uint frames = (uint)data.kelvinlets.size();
+
+        ThreadPool pool;
+        auto replay = [&](uint frame)
+        {
+            return replayKelvinlets(pool, mesh.vertices, vector<deformation::Kelvinlet>(data.kelvinlets.begin(), data.kelvinlets.begin() + frame));
+        };
+
+        ReplayTimeline timeline(mesh.vertices.data(), (uint)mesh.vertices.size(), data.kelvinlets.data(), frames, 4 * mesh.vertices.size() * sizeof(vec3));
+        timeline.seek(pool, frames);
+        double playSeconds = timeline.stats().lastSeekSeconds;
+
+        uint seeks[] = { frames / 2, frames / 3, frames / 3 + 5, 0, frames - 1, frames / 7 };
+        uint maxSeekFrames = 0;
+        double maxSeekSeconds = 0.0;
+        for (uint frame : seeks)
+        {
+            const vec3* positions = timeline.seek(pool, frame);
+            vector<vec3> reference = replay(frame);
+            if (memcmp(positions, reference.data(), reference.size() * sizeof(vec3)) != 0)
+            {
+                printf("test26 FAILED (seeking to frame %u isn't the same as replaying it)\n", frame);
+                return 1;
+            }
+            maxSeekFrames = max((int)maxSeekFrames, (int)timeline.stats().lastSeekFrames);
+            maxSeekSeconds = std::max(maxSeekSeconds, timeline.stats().lastSeekSeconds);
+        }
+
+        // play forward from the last seek
+        timeline.play(pool);
+        timeline.play(pool);
+        vector<vec3> reference = replay(frames / 7 + 2);
+        if (memcmp(timeline.currentPositions(), reference.data(), reference.size() * sizeof(vec3)) != 0)
+        {
+            printf("test26 FAILED (playing forward after a seek isn't the same as replaying)\n");
+            return 1;
+        }
+
+        TimelineStats stats = timeline.stats();
+        if (stats.checkpointBytes > 4 * mesh.vertices.size() * sizeof(vec3) || maxSeekFrames >= frames / 2)
+        {
+            printf("test26 FAILED (%u checkpoints of %zu bytes, seeks replay up to %u of %u frames)\n", stats.checkpoints, stats.checkpointBytes, maxSeekFrames, frames);
+            return 1;
+        }
+
+        mesh.vertices = reference;
+        writeobj("data\\testresult26.obj", mesh);
+        printf("test26 success (%u checkpoints in %.1f%% of the budget, seeks replay up to %u of %u frames, %.2fms instead of %.2fms)\n",
+            stats.checkpoints, 100.0 * stats.checkpointBytes / (4 * mesh.vertices.size() * sizeof(vec3)), maxSeekFrames, frames, maxSeekSeconds * 1000, playSeconds * 1000);
+    }
+
+    // --------------------
+    // This demonstrates sending only the vertices that moved to a consumer of the positions,
+    // like a vertex buffer or a remote copy of the sculpt, while a brush deforms the mesh one
+    // frame at a time, like test 19. One encoder deforms the mesh and sends float deltas in the
+    // same pass; the others send the same positions with quantized deltas, one of them with
+    // steps larger than the threshold, so that the deltas that round to zero aren't sent. The
+    // consumers never drift more than the threshold (or half a step in every axis) away.
+    if (true)
+    {
+        Mesh mesh = readmesh("data\\meshes\\test0_mesh.bin");
+        Stroke stroke;
+        DataFromPoses data = readStrokeData("data\\strokes\\test0_righthandstroke.bin", stroke);
+
+        const float threshold = maxerror;
+        const float quantization = maxerror / 4;
+        ThreadPool pool;
+        SparseDeltaEncoder encoder(mesh.vertices.data(), (uint)mesh.vertices.size(), threshold);
+        SparseDeltaEncoder quantizedEncoder(mesh.vertices.data(), (uint)mesh.vertices.size(), threshold, quantization);
+        SparseDeltaEncoder coarseEncoder(mesh.vertices.data(), (uint)mesh.vertices.size(), threshold, 4 * threshold);
+        vector<vec3> consumer = mesh.vertices;
+        vector<vec3> quantizedConsumer = mesh.vertices;
+        vector<vec3> coarseConsumer = mesh.vertices;
+        SparseDeltas deltas;
+        size_t bytes = 0;
+        size_t quantizedBytes = 0;
+        float error = 0.0f;
+        float quantizedError = 0.0f;
+        float coarseError = 0.0f;
+        for (uint frame = 0; frame < data.deformations.size(); frame++)
+        {
+            const deformation::Deformation& deformation = data.deformations[frame];
+            encoder.deform(pool, mesh.vertices.data(), [&](vec3 position) { return brushFrame(position, deformation, stroke); }, deltas);
+            applySparseDeltas(deltas, consumer.data());
+            bytes += deltas.bytes();
+
+            quantizedEncoder.encode(pool, mesh.vertices.data(), deltas);
+            applySparseDeltas(deltas, quantizedConsumer.data());
+            quantizedBytes += deltas.bytes();
+
+            coarseEncoder.encode(pool, mesh.vertices.data(), deltas);
+            applySparseDeltas(deltas, coarseConsumer.data());
+            for (uint k = 0; k < deltas.count(); k++)
+            {
+                if (deltas.quantized[k * 3 + 0] == 0 && deltas.quantized[k * 3 + 1] == 0 && deltas.quantized[k * 3 + 2] == 0)
+                {
+                    printf("test27 FAILED (a delta that rounds to zero was sent)\n");
+                    return 1;
+                }
+            }
+
+            for (uint i = 0; i < mesh.vertices.size(); i++)
+            {
+                error = max(error, length(consumer[i] - mesh.vertices[i]));
+                quantizedError = max(quantizedError, length(quantizedConsumer[i] - mesh.vertices[i]));
+                coarseError = max(coarseError, length(coarseConsumer[i] - mesh.vertices[i]));
+            }
+            if (memcmp(consumer.data(), encoder.sentPositions(), consumer.size() * sizeof(vec3)) != 0 ||
+                memcmp(quantizedConsumer.data(), quantizedEncoder.sentPositions(), quantizedConsumer.size() * sizeof(vec3)) != 0)
+            {
+                printf("test27 FAILED (a consumer doesn't have what was sent)\n");
+                return 1;
+            }
+        }
+        if (error > threshold || quantizedError > max(threshold, quantization * sqrt(3.0f) / 2) || coarseError > 4 * threshold * sqrt(3.0f) / 2)
+        {
+            printf("test27 FAILED (the consumers are %.2f, %.2f and %.2f of the threshold away)\n", error / threshold, quantizedError / threshold, coarseError / threshold);
+            return 1;
+        }
+
+        double full = (double)data.deformations.size() * mesh.vertices.size() * sizeof(vec3);
+        writeobj("data\\testresult27.obj", mesh);
+        printf("test27 success (%.1fx less to send, %.1fx quantized, within %.2f and %.2f of the threshold)\n",
+            full / bytes, full / quantizedBytes, error / threshold, quantizedError / threshold);
+    }
+
+    // --------------------
+    // This demonstrates deforming ahead of the tool. The poses of the recorded stroke of test 6
+    // arrive one at a time, and the mesh is deformed with Kelvinlets for the predicted next pose
+    // while waiting for it. With a tolerance of zero, every prediction misses, and the results
+    // are bit-identical to test 6. With a tolerance of a fraction of the radius of the tool, the
+    // predictions that are close enough are used, and the mesh stays close to test 6.
+    if (true)
+    {
+        Mesh mesh = readmesh("data\\meshes\\test0_mesh.bin");
+        Stroke stroke;
+        DataFromPoses data = readStrokeData("data\\strokes\\test0_righthandstroke.bin", stroke);
+
+        ThreadPool pool;
+        vector<vec3> reference = replayKelvinlets(pool, mesh.vertices, data.kelvinlets);
+
+        auto solverFor = [&](const deformation::Motion& motion)
+        {
+            return kelvinletMotionSolver(motion, stroke);
+        };
+
+        SpeculativeDeformer exact(mesh.vertices.data(), (uint)mesh.vertices.size(), 0.0f, stroke.outerRadius, solverFor);
+        SpeculativeDeformer speculative(mesh.vertices.data(), (uint)mesh.vertices.size(), 0.05f * stroke.outerRadius, stroke.outerRadius, solverFor);
+        for (const deformation::Pose& pose : stroke.poses)
+        {
+            exact.update(pool, pose);
+            speculative.update(pool, pose);
+        }
+
+        if (memcmp(exact.currentPositions(), reference.data(), reference.size() * sizeof(vec3)) != 0 || exact.getStats().hits != 0)
+        {
+            printf("test28 FAILED (without predictions, the mesh isn't the same as test 6)\n");
+            return 1;
+        }
+
+        float error = 0.0f;
+        for (uint i = 0; i < reference.size(); i++)
+        {
+            error = max(error, length(speculative.currentPositions()[i] - reference[i]));
+        }
+        SpeculativeStats stats = speculative.getStats();
+        if (stats.hits == 0 || error > 0.05f * stroke.outerRadius)
+        {
+            printf("test28 FAILED (%u predictions used, %.3f of the radius away from test 6)\n", stats.hits, error / stroke.outerRadius);
+            return 1;
+        }
+
+        mesh.vertices.assign(speculative.currentPositions(), speculative.currentPositions() + mesh.vertices.size());
+        writeobj("data\\testresult28.obj", mesh);
+        printf("test28 success (%.0f%% of the predictions used, %.3fms in update() per pose instead of %.3fms, within %.3f of the radius of test 6)\n",
+            100.0f * stats.hitRate(), stats.waitSeconds * 1000 / (stats.hits + stats.misses), exact.getStats().waitSeconds * 1000 / (stats.hits + stats.misses), error / stroke.outerRadius);
+    }
+
+    // --------------------
+    // This demonstrates taking the poses from a tracking thread, instead of the render loop.
+    // A thread plays back the stroke of test 6 into a PoseRing, as a tracking thread would
+    // push the poses of the controller, and a PoseStreamDeformer deforms the mesh on its own
+    // thread, with all the poses it finds in the ring at once. The main thread, like a render
+    // thread, only copies the positions it publishes. The results are bit-identical to test 6.
+    if (true)
+    {
+        Mesh mesh = readmesh("data\\meshes\\test0_mesh.bin");
+        Stroke stroke;
+        DataFromPoses data = readStrokeData("data\\strokes\\test0_righthandstroke.bin", stroke);
+
+        ThreadPool pool;
+        vector<vec3> reference = replayKelvinlets(pool, mesh.vertices, data.kelvinlets);
+
+        auto solverFor = [&](const deformation::Motion& motion)
+        {
+            return kelvinletMotionSolver(motion, stroke);
+        };
+
+        PoseRing ring(16);
+        PoseStreamDeformer deformer(ring, mesh.vertices.data(), (uint)mesh.vertices.size(), solverFor);
+        std::thread tracking([&]()
+        {
+            for (const deformation::Pose& pose : stroke.poses)
+            {
+                // a tracking thread would drop the pose instead, but the test needs all of them
+                while (!ring.push(pose))
+                {
+                    std::this_thread::yield();
+                }
+            }
+        });
+
+        uint renderFrames = 0;
+        vector<vec3> rendered;
+        while (deformer.getStats().poses < stroke.poses.size())
+        {
+            deformer.copyPositions(rendered);
+            renderFrames++;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        tracking.join();
+        deformer.stop();
+
+        if (memcmp(deformer.currentPositions(), reference.data(), reference.size() * sizeof(vec3)) != 0)
+        {
+            printf("test29 FAILED (the mesh isn't the same as test 6)\n");
+            return 1;
+        }
+
+        PoseStreamStats stats = deformer.getStats();
+        mesh.vertices.assign(deformer.currentPositions(), deformer.currentPositions() + mesh.vertices.size());
+        writeobj("data\\testresult29.obj", mesh);
+        printf("test29 success (%u poses in %u passes over the mesh, up to %u motions per pass, %u render frames)\n", stats.poses, stats.batches, stats.maxBatch, renderFrames);
+    }
+
+    // --------------------
+    // This demonstrates rendering while the mesh is deformed, without locks or copies of the mesh.
+    // The main thread deforms an EpochVertexStore with the Kelvinlets of test 6, one frame at a
+    // time, and every frame publishes a new version of the mesh. Two reader threads, like a
+    // renderer and an exporter, pin whatever version is current and read it while the next ones
+    // are deformed. Every version they read is the one that was published for its epoch, and the
+    // last one is bit-identical to test 6.
+    if (true)
+    {
+        Mesh mesh = readmesh("data\\meshes\\test0_mesh.bin");
+        Stroke stroke;
+        DataFromPoses data = readStrokeData("data\\strokes\\test0_righthandstroke.bin", stroke);
+
+        ThreadPool pool;
+        vector<vec3> reference = replayKelvinlets(pool, mesh.vertices, data.kelvinlets);
+
+        auto checksum = [](const vector<vec3>& positions)
+        {
+            unsigned long long sum = 0;
+            const uint* bits = (const uint*)positions.data();
+            for (uint i = 0; i < positions.size() * 3; i++)
+            {
+                sum = sum * 1099511628211ull + bits[i];
+            }
+            return sum;
+        };
+
+        EpochVertexStore store(mesh.vertices.data(), (uint)mesh.vertices.size());
+        uint epochCount = (uint)data.kelvinlets.size() + 1;
+        vector<unsigned long long> published(epochCount + 1, 0);
+        vector<vec3> positions(mesh.vertices.size());
+        store.currentVersion().read(positions.data());
+        published[1] = checksum(positions);
+
+        // the readers check what they read once the deformation is done
+        std::atomic<bool> done(false);
+        vector<vector<pair<unsigned long long, unsigned long long>>> reads(2);
+        vector<std::thread> readers;
+        for (uint r = 0; r < reads.size(); r++)
+        {
+            readers.push_back(std::thread([&, r]()
+            {
+                uint reader = store.addReader();
+                vector<vec3> copy(mesh.vertices.size());
+                while (!done)
+                {
+                    const EpochVertexStore::Version& version = store.pin(reader);
+                    version.read(copy.data());
+                    reads[r].push_back(make_pair(version.epoch, checksum(copy)));
+                    store.unpin(reader);
+                }
+                store.removeReader(reader);
+            }));
+        }
+
+        uint copiedPages = 0;
+        for (uint frame = 0; frame < data.kelvinlets.size(); frame++)
+        {
+            const deformation::Kelvinlet& kelvinlet = data.kelvinlets[frame];
+            copiedPages += store.deform(pool, [&](vec3 position)
+            {
+                return replayKelvinlet(position, kelvinlet);
+            });
+            store.currentVersion().read(positions.data());
+            published[store.currentVersion().epoch] = checksum(positions);
+        }
+        done = true;
+        for (std::thread& reader : readers)
+        {
+            reader.join();
+        }
+        store.reclaim();
+
+        if (memcmp(positions.data(), reference.data(), reference.size() * sizeof(vec3)) != 0)
+        {
+            printf("test30 FAILED (the mesh isn't the same as test 6)\n");
+            return 1;
+        }
+
+        uint readCount = 0;
+        for (const auto& readerReads : reads)
+        {
+            for (const auto& read : readerReads)
+            {
+                if (read.first == 0 || read.first > epochCount || read.second != published[read.first])
+                {
+                    printf("test30 FAILED (a reader read a version of epoch %llu that wasn't published)\n", read.first);
+                    return 1;
+                }
+                readCount++;
+            }
+        }
+
+        EpochVertexStoreStats stats = store.stats();
+        if (stats.retiredVersions != 0 || stats.retiredPages != 0)
+        {
+            printf("test30 FAILED (%u versions and %u pages aren't freed once the readers are gone)\n", stats.retiredVersions, stats.retiredPages);
+            return 1;
+        }
+
+        mesh.vertices = positions;
+        writeobj("data\\testresult30.obj", mesh);
+        printf("test30 success (%u versions published, %u pages copied, %u reads of pinned versions)\n", (uint)stats.epoch, copiedPages, readCount);
+    }
+
+    // --------------------
+    // This demonstrates previewing a stroke on a coarse proxy of a dense mesh.
+    // The mesh of test 6 is subdivided, and the Kelvinlets of test 6 are integrated on the proxy
+    // vertices only, one frame at a time; the rest of the vertices move with the proxy vertices
+    // they are bound to. Under the brush, the preview is within 2% of the radius of integrating
+    // every vertex on average, and committing the stroke integrates every vertex, for results
+    // that are bit-identical to it.
+    if (true)
+    {
+        Mesh mesh = subdivide(readmesh("data\\meshes\\test0_mesh.bin"));
+        Stroke stroke;
+        DataFromPoses data = readStrokeData("data\\strokes\\test0_righthandstroke.bin", stroke);
+
+        ThreadPool pool;
+        vector<vec3> reference = replayKelvinlets(pool, mesh.vertices, data.kelvinlets);
+
+        ProxyDeformer proxy(pool, mesh.vertices.data(), (uint)mesh.vertices.size(), 0.1f * stroke.outerRadius);
+        auto start = std::chrono::steady_clock::now();
+        for (uint frame = 0; frame < data.kelvinlets.size(); frame++)
+        {
+            const deformation::Kelvinlet kelvinlet = data.kelvinlets[frame];
+            proxy.preview(pool, [kelvinlet](vec3 position)
+            {
+                return replayKelvinlet(position, kelvinlet);
+            });
+        }
+        double previewSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        // the preview can be off where the stroke stretches the mesh the most, but not on average
+        // over the vertices the brush passes over (the others barely move, and would hide it)
+        float error = 0.0f;
+        double averageError = 0.0;
+        uint brushedVertices = 0;
+        for (uint i = 0; i < reference.size(); i++)
+        {
+            float vertexError = length(proxy.currentPreview()[i] - reference[i]);
+            error = max(error, vertexError);
+            for (const deformation::Pose& pose : stroke.poses)
+            {
+                if (length(mesh.vertices[i] - pose.position) <= stroke.outerRadius)
+                {
+                    averageError += vertexError;
+                    brushedVertices++;
+                    break;
+                }
+            }
+        }
+        averageError /= max((int)brushedVertices, 1);
+        if (brushedVertices == 0 || averageError > 0.02f * stroke.outerRadius)
+        {
+            printf("test31 FAILED (the preview is %.3f of the radius away from integrating every vertex, on average within the radius of the brush)\n", averageError / stroke.outerRadius);
+            return 1;
+        }
+
+        start = std::chrono::steady_clock::now();
+        proxy.commit(pool, mesh.vertices.data());
+        double commitSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (memcmp(mesh.vertices.data(), reference.data(), reference.size() * sizeof(vec3)) != 0)
+        {
+            printf("test31 FAILED (the committed mesh isn't the same as integrating every vertex)\n");
+            return 1;
+        }
+
+        writeobj("data\\testresult31.obj", mesh);
+        printf("test31 success (%u proxy vertices for %u vertices, preview in %.1fms instead of %.1fms, within %.4f of the radius on average over %u vertices under the brush, and %.3f at most)\n",
+            proxy.proxyVertexCount(), (uint)mesh.vertices.size(), previewSeconds * 1000, commitSeconds * 1000, averageError / stroke.outerRadius, brushedVertices, error / stroke.outerRadius);
+    }
+
+    // --------------------
+    // This demonstrates refining the mesh only where a stroke stretched it.
+    // After the stroke of test 6, the edges that are more than twice as long as the average edge,
+    // and that the stroke made more than twice as long, are split, with the new vertices moved by
+    // the same Kelvinlets from where they would have been before the stroke. Every vertex, old or
+    // new, is bit-identical to integrating it like test 6, and the split leaves no cracks.
+    if (true)
+    {
+        Mesh mesh = readmesh("data\\meshes\\test0_mesh.bin");
+        Stroke stroke;
+        DataFromPoses data = readStrokeData("data\\strokes\\test0_righthandstroke.bin", stroke);
+
+        auto flow = [&](vec3 position)
+        {
+            return replayKelvinlets(position, data.kelvinlets);
+        };
+
+        float averageEdge = 0.0f;
+        for (uint i = 0; i < mesh.indices.size(); i++)
+        {
+            averageEdge += distance(mesh.vertices[mesh.indices[i]], mesh.vertices[mesh.indices[i % 3 == 2 ? i - 2 : i + 1]]) / mesh.indices.size();
+        }
+
+        vector<vec3> before = mesh.vertices;
+        for (uint i = 0; i < mesh.vertices.size(); i++)
+        {
+            mesh.vertices[i] = flow(mesh.vertices[i]);
+        }
+
+        ThreadPool pool;
+        uint vertexCount = (uint)mesh.vertices.size();
+        AdaptiveTessellator tessellator(2.0f * averageEdge, 2.0f);
+        TessellationStats stats = tessellator.refine(pool, before, mesh.vertices, mesh.indices, flow);
+
+        for (uint i = 0; i < mesh.vertices.size(); i++)
+        {
+            vec3 expected = flow(before[i]);
+            if (memcmp(&expected, &mesh.vertices[i], sizeof(vec3)) != 0)
+            {
+                printf("test32 FAILED (vertex %u isn't where the stroke moves it)\n", i);
+                return 1;
+            }
+        }
+
+        // splitting an edge in the middle doesn't change the length of the border before the stroke,
+        // unless a triangle isn't split with its neighbour, and leaves a crack
+        Mesh original = readmesh("data\\meshes\\test0_mesh.bin");
+        auto borderLength = [](const vector<uint>& indices, const vector<vec3>& positions, uint& edgeCount)
+        {
+            unordered_map<unsigned long long, int> edges;
+            for (uint i = 0; i < indices.size(); i++)
+            {
+                uint a = indices[i];
+                uint b = indices[i % 3 == 2 ? i - 2 : i + 1];
+                edges[((unsigned long long)min(a, b) << 32) | max(a, b)]++;
+            }
+            double length = 0.0;
+            for (const auto& edge : edges)
+            {
+                if (edge.second == 1)
+                {
+                    length += distance(positions[edge.first >> 32], positions[edge.first & 0xffffffff]);
+                }
+            }
+            edgeCount = (uint)edges.size();
+            return length;
+        };
+        uint edgeCount;
+        uint originalEdgeCount;
+        double border = borderLength(mesh.indices, before, edgeCount);
+        double originalBorder = borderLength(original.indices, original.vertices, originalEdgeCount);
+        if (stats.addedVertices == 0 || fabs(border - originalBorder) > 0.0001 * originalBorder)
+        {
+            printf("test32 FAILED (%u vertices added, the border is %f long instead of %f)\n", stats.addedVertices, border, originalBorder);
+            return 1;
+        }
+
+        // the vertices of a uniform subdivision as deep as the deepest split
+        unsigned long long uniformVertices = vertexCount;
+        unsigned long long uniformEdges = originalEdgeCount;
+        unsigned long long uniformTriangles = original.indices.size() / 3;
+        for (uint pass = 0; pass < stats.passes; pass++)
+        {
+            uniformVertices += uniformEdges;
+            uniformEdges = uniformEdges * 2 + uniformTriangles * 3;
+            uniformTriangles *= 4;
+        }
+
+        writeobj("data\\testresult32.obj", mesh);
+        printf("test32 success (%u vertices added to %u in %u passes instead of %llu for a uniform subdivision as deep, %u edges still stretched)\n",
+            stats.addedVertices, vertexCount, stats.passes, uniformVertices - vertexCount, stats.stretchedEdges);
+    }
+
+    // --------------------
+    // This demonstrates how the adaptive solvers recover from a step with too much error. The
+    // first step of every solver has four times the error allowed, so it is rejected, and the
+    // next attempt takes the step size that the error estimate asks for, not half of the step.
+    // The flow is x' = 20 x, and the times the solvers evaluate it at give the size of their steps.
+    if (true)
+    {
+        vector<float> times;
+        RecordedFlow flow = { 20.0f, &times };
+        const vec3 start = vec3(1, 1, 1);
+        const float tstart = 0.0f;
+        const float tend = 1.0f;
+        const float dt = (tend - tstart) * ADAPTIVE_INTEGRATOR_INITIAL_DT;
+
+        // error(t, dt) is the error estimate of the solver's step from t, and solve(maxerror)
+        // integrates from t. Returns how far the second attempt is from the step size it asks for.
+        auto rejectedStep = [&](float t, float exponent, const std::function<float(float, float)>& error, const std::function<vec3(float)>& solve)
+        {
+            float maxerror = error(t, t == tstart ? dt : -dt) / 4.0f;
+            times.clear();
+            solve(maxerror);
+            uint second = 1;
+            while (second < times.size() && times[second] != t)
+            {
+                second++;
+            }
+            if (second + 1 >= times.size())
+            {
+                return 1.0f;
+            }
+            float secondDt = dt * (times[second + 1] - t) / (times[1] - t);
+            float expectedDt = dt * 0.9f * pow(0.25f, exponent);
+            return fabs(secondDt - expectedDt) / expectedDt;
+        };
+
+        auto rkf45Error = [&](float t, float dt) { IntegrateRecordedFlowRK45Result r = IntegrateRecordedFlowrungekuttafehlberg(t, dt, start, flow); return length(r.fifthorder - r.fourthorder) / fabs(dt); };
+        auto dp54Error = [&](float t, float dt) { IntegrateRecordedFlowDormandPrinceRungeKuttaResult r = IntegrateRecordedFlowdormandprincerungekutta(t, dt, start, flow); return length(r.fifthorder - r.fourthorder) / fabs(dt); };
+        auto bs32Error = [&](float t, float dt) { IntegrateRecordedFlowBogackiShampineRungeKuttaResult r = IntegrateRecordedFlowbogackishampinerungekutta(t, dt, start, flow); return length(r.thirdorder - r.secondorder) / fabs(dt); };
+
+        struct Check { const char* name; float error; };
+        Check checks[] =
+        {
+            { "RKF45", rejectedStep(tstart, 0.2f, rkf45Error, [&](float maxerror) { return IntegrateRecordedFlow_AdaptiveRKF45(start, tstart, tend, maxerror, flow); }) },
+            { "DP54", rejectedStep(tstart, 0.2f, dp54Error, [&](float maxerror) { return IntegrateRecordedFlow_AdaptiveDP54(start, tstart, tend, maxerror, flow); }) },
+            { "BS32", rejectedStep(tstart, 1 / 3.0f, bs32Error, [&](float maxerror) { return IntegrateRecordedFlow_AdaptiveBS32(start, tstart, tend, maxerror, flow); }) },
+            { "RKF45Backward", rejectedStep(tend, 0.2f, rkf45Error, [&](float maxerror) { return IntegrateRecordedFlow_AdaptiveRKF45Backward(start, tstart, tend, maxerror, flow); }) },
+            { "DP54Backward", rejectedStep(tend, 0.2f, dp54Error, [&](float maxerror) { return IntegrateRecordedFlow_AdaptiveDP54Backward(start, tstart, tend, maxerror, flow); }) },
+            { "BS32Backward", rejectedStep(tend, 1 / 3.0f, bs32Error, [&](float maxerror) { return IntegrateRecordedFlow_AdaptiveBS32Backward(start, tstart, tend, maxerror, flow); }) },
+        };
+        float worst = 0.0f;
+        for (const Check& check : checks)
+        {
+            if (check.error > 0.001f)
+            {
+                printf("test33 FAILED (%s retries a rejected step %.1f%% away from the step size it asks for)\n", check.name, check.error * 100);
+                return 1;
+            }
+            worst = max(worst, check.error);
+        }
+
+        printf("test33 success (rejected steps retry within %.4f%% of the step size they ask for)\n", worst * 100);
+    }
+
     printf("All tests successfully completed\n");
 
     return 0;